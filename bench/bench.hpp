@@ -0,0 +1,403 @@
+#ifndef SJTU_BENCH_HPP
+#define SJTU_BENCH_HPP
+
+// Shared pieces of the benchmarks in this directory: key distributions, a
+// Zipfian generator, an allocation counter, latency statistics and a small
+// JSON writer. Each benchmark is a single translation unit that includes this
+// header once, which also replaces the global operator new to count
+// allocations and live heap bytes.
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../trie/src.hpp"
+
+namespace sjtu::bench {
+
+inline std::atomic<uint64_t> allocations{0};
+// Bytes currently allocated through operator new, as malloc sized the blocks.
+inline std::atomic<int64_t> live_bytes{0};
+
+}  // namespace sjtu::bench
+
+// GCC cannot tell that these functions are each other's counterparts and
+// warns wherever a delete is inlined next to a new.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    sjtu::bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        sjtu::bench::live_bytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept {
+    if (p) sjtu::bench::live_bytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    std::free(p);
+}
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+
+namespace sjtu::bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Draws integers in [0, n) with P(i) proportional to 1 / (i + 1)^theta, as
+// in YCSB (Gray et al., "Quickly generating billion-record synthetic
+// databases"). Rank 0 is the most popular item.
+class Zipfian {
+   public:
+    explicit Zipfian(uint64_t n, double theta = 0.99) : n_(n), theta_(theta) {
+        if (n == 0) throw std::invalid_argument("Zipfian: empty range");
+        zeta_n_ = Zeta(n, theta);
+        const double zeta2 = Zeta(2, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zeta_n_);
+        half_pow_theta_ = 1.0 + std::pow(0.5, theta);
+    }
+
+    template <class Rng>
+    auto operator()(Rng& rng) -> uint64_t {
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        const double uz = u * zeta_n_;
+        if (uz < 1.0) return 0;
+        if (uz < half_pow_theta_) return 1;
+        return std::min<uint64_t>(n_ - 1, static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_)));
+    }
+
+   private:
+    static auto Zeta(uint64_t n, double theta) -> double {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        return sum;
+    }
+
+    uint64_t n_;
+    double theta_;
+    double zeta_n_;
+    double alpha_;
+    double eta_;
+    double half_pow_theta_;
+};
+
+// Spreads Zipfian ranks over the key space, so that the popular keys are not
+// all neighbours.
+inline auto ScrambleRank(uint64_t rank, uint64_t n) -> uint64_t {
+    uint64_t x = rank + 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return (x ^ (x >> 31)) % n;
+}
+
+// The key `i` of the sequential key space: zero-padded decimal, so that the
+// order of the keys is their numeric order.
+inline auto SequentialKey(uint64_t i, int width = 10) -> std::string {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%0*llu", width, static_cast<unsigned long long>(i));
+    return buffer;
+}
+
+// A set of distinct keys and the order in which a benchmark touches them.
+struct KeySet {
+    std::string name;
+    std::vector<std::string> keys;
+    // Indices into `keys`, one per operation. Repeats are possible.
+    std::vector<uint32_t> order;
+};
+
+// The key distributions shared by the benchmarks:
+//   sequential  zero-padded counters, touched in order
+//   random      random 16-byte alphanumeric keys, touched in random order
+//   zipfian     the sequential keys, touched with Zipfian (0.99) skew
+//   prefix      keys behind a 128-byte shared prefix, touched in random order
+//   fanout      3-byte keys over all 256 byte values, touched in random order
+inline auto MakeKeySet(const std::string& name, size_t n, uint64_t seed = 42) -> KeySet {
+    KeySet set{name, {}, {}};
+    std::mt19937_64 rng(seed);
+    set.keys.reserve(n);
+    set.order.resize(n);
+    std::iota(set.order.begin(), set.order.end(), 0);
+    if (name == "sequential" || name == "zipfian") {
+        for (size_t i = 0; i < n; ++i) set.keys.push_back(SequentialKey(i));
+        if (name == "zipfian") {
+            Zipfian zipf(n);
+            for (auto& index : set.order) index = static_cast<uint32_t>(ScrambleRank(zipf(rng), n));
+        }
+        return set;
+    }
+    if (name == "random" || name == "prefix") {
+        static constexpr char kAlphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+        const std::string shared = name == "prefix" ? std::string(128, 'p') : std::string();
+        while (set.keys.size() < n) {
+            std::string key = shared;
+            for (int i = 0; i < 16; ++i) key.push_back(kAlphabet[rng() % (sizeof(kAlphabet) - 1)]);
+            set.keys.push_back(std::move(key));
+        }
+    } else if (name == "fanout") {
+        if (n > (1u << 24)) throw std::invalid_argument("MakeKeySet: too many fanout keys");
+        for (size_t i = 0; i < n; ++i) {
+            // Multiplying by an odd constant permutes the 24-bit space and
+            // spreads the keys over every first byte.
+            const uint32_t x = static_cast<uint32_t>((i * 0x9e3779b1ull) & 0xffffff);
+            set.keys.push_back({static_cast<char>(x >> 16), static_cast<char>(x >> 8), static_cast<char>(x)});
+        }
+    } else {
+        throw std::invalid_argument("MakeKeySet: unknown distribution " + name);
+    }
+    std::shuffle(set.order.begin(), set.order.end(), rng);
+    return set;
+}
+
+inline auto KeySetNames() -> std::vector<std::string> { return {"sequential", "random", "zipfian", "prefix", "fanout"}; }
+
+// The cost of reading the clock, subtracted from timed samples.
+inline auto TimerOverhead() -> double {
+    constexpr int kRounds = 1 << 16;
+    const auto start = Clock::now();
+    for (int i = 0; i < kRounds; ++i) (void)Clock::now();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kRounds;
+}
+
+// Latency samples in nanoseconds.
+class Latencies {
+   public:
+    void Reserve(size_t n) { samples_.reserve(n); }
+    void Add(double ns) {
+        samples_.push_back(std::max(0.0, ns));
+        sorted_ = false;
+    }
+    void Merge(const Latencies& other) {
+        samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+        sorted_ = false;
+    }
+    auto Count() const -> size_t { return samples_.size(); }
+
+    // The q-quantile, 0 <= q <= 1. Sorts the samples on first use.
+    auto Quantile(double q) -> double {
+        if (samples_.empty()) return 0;
+        if (!sorted_) std::sort(samples_.begin(), samples_.end());
+        sorted_ = true;
+        return samples_[std::min(samples_.size() - 1, static_cast<size_t>(q * samples_.size()))];
+    }
+
+    auto Mean() const -> double {
+        return samples_.empty() ? 0 : std::accumulate(samples_.begin(), samples_.end(), 0.0) / samples_.size();
+    }
+
+   private:
+    std::vector<double> samples_;
+    bool sorted_{false};
+};
+
+// TrieStore keeps every version, which a long write-heavy run cannot hold in
+// memory. A HistoryTrimmer runs the writes of a benchmark and, every `every`
+// writes, replaces the store's history with its newest version. Writers pause
+// for the trim; readers do not. The pauses are an artifact of the benchmark,
+// so they are tracked apart from the writes: a writer subtracts
+// TakePausedNs() from the latency of its write, and Trims() and
+// TrimSeconds() are reported on their own.
+class HistoryTrimmer {
+   public:
+    explicit HistoryTrimmer(TrieStore& store, uint64_t every = 1 << 14) : store_(store), every_(every) {}
+
+    template <class F>
+    auto Write(F&& write) -> decltype(write()) {
+        auto result = [&] {
+            const uint64_t trims = trims_.load(std::memory_order_relaxed);
+            const auto before = Clock::now();
+            std::shared_lock<std::shared_mutex> lock(lock_);
+            // Waited for another writer's trim.
+            if (trims_.load(std::memory_order_relaxed) != trims) paused_ns_ += Nanos(Clock::now() - before);
+            return write();
+        }();
+        if (writes_.fetch_add(1, std::memory_order_relaxed) + 1 == every_) {
+            const auto before = Clock::now();
+            {
+                std::unique_lock<std::shared_mutex> lock(lock_);
+                auto newest = store_.GetSnapshot();
+                store_.Restore(std::move(newest->second), newest->first);
+                writes_.store(0, std::memory_order_relaxed);
+                trims_.fetch_add(1, std::memory_order_relaxed);
+            }
+            const double pause = Nanos(Clock::now() - before);
+            paused_ns_ += pause;
+            trim_ns_.fetch_add(static_cast<uint64_t>(pause), std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // The time the calling thread spent running or waiting for trims since
+    // its last call.
+    static auto TakePausedNs() -> double { return std::exchange(paused_ns_, 0); }
+
+    auto Trims() const -> uint64_t { return trims_.load(std::memory_order_relaxed); }
+    auto TrimSeconds() const -> double { return trim_ns_.load(std::memory_order_relaxed) / 1e9; }
+
+   private:
+    static auto Nanos(Clock::duration d) -> double { return std::chrono::duration<double, std::nano>(d).count(); }
+
+    TrieStore& store_;
+    const uint64_t every_;
+    std::shared_mutex lock_;
+    std::atomic<uint64_t> writes_{0};
+    std::atomic<uint64_t> trims_{0};
+    std::atomic<uint64_t> trim_ns_{0};
+    static inline thread_local double paused_ns_ = 0;
+};
+
+// Builds one JSON value. Keys and values are appended in order; commas are
+// inserted automatically.
+class Json {
+   public:
+    auto BeginObject() -> Json& { return Open('{'); }
+    auto EndObject() -> Json& { return Close('}'); }
+    auto BeginArray() -> Json& { return Open('['); }
+    auto EndArray() -> Json& { return Close(']'); }
+
+    auto Key(std::string_view key) -> Json& {
+        Separate();
+        String(key);
+        out_ << ':';
+        after_key_ = true;
+        return *this;
+    }
+
+    auto Value(std::string_view value) -> Json& {
+        Separate();
+        String(value);
+        return *this;
+    }
+    auto Value(const char* value) -> Json& { return Value(std::string_view(value)); }
+    auto Value(double value) -> Json& {
+        Separate();
+        if (std::isfinite(value)) out_ << value;
+        else out_ << "null";
+        return *this;
+    }
+    auto Value(uint64_t value) -> Json& {
+        Separate();
+        out_ << value;
+        return *this;
+    }
+    auto Value(int value) -> Json& { return Value(static_cast<double>(value)); }
+    auto Value(bool value) -> Json& {
+        Separate();
+        out_ << (value ? "true" : "false");
+        return *this;
+    }
+
+    template <class V>
+    auto Field(std::string_view key, V value) -> Json& {
+        return Key(key).Value(value);
+    }
+
+    auto Str() const -> std::string { return out_.str(); }
+
+   private:
+    auto Open(char c) -> Json& {
+        Separate();
+        out_ << c;
+        first_ = true;
+        return *this;
+    }
+    auto Close(char c) -> Json& {
+        out_ << c;
+        first_ = false;
+        return *this;
+    }
+    void Separate() {
+        if (after_key_) after_key_ = false;
+        else if (!first_) out_ << ',';
+        first_ = false;
+    }
+    void String(std::string_view s) {
+        out_ << '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') out_ << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out_ << escaped;
+            } else out_ << c;
+        }
+        out_ << '"';
+    }
+
+    std::ostringstream out_;
+    bool first_{true};
+    bool after_key_{false};
+};
+
+// Command line flags of the form --name=value or --name.
+class Flags {
+   public:
+    Flags(int argc, char** argv) : args_(argv + 1, argv + argc) {}
+
+    auto Has(std::string_view name) const -> bool {
+        for (const auto& arg : args_)
+            if (Matches(arg, name) && (arg.size() == name.size() + 2 || arg[name.size() + 2] == '=')) return true;
+        return false;
+    }
+
+    auto Get(std::string_view name, std::string fallback) const -> std::string {
+        for (const auto& arg : args_)
+            if (Matches(arg, name) && arg.size() > name.size() + 2 && arg[name.size() + 2] == '=')
+                return arg.substr(name.size() + 3);
+        return fallback;
+    }
+
+    auto Get(std::string_view name, uint64_t fallback) const -> uint64_t {
+        const std::string value = Get(name, std::string());
+        return value.empty() ? fallback : std::stoull(value);
+    }
+
+    auto Get(std::string_view name, double fallback) const -> double {
+        const std::string value = Get(name, std::string());
+        return value.empty() ? fallback : std::stod(value);
+    }
+
+    // A comma-separated list.
+    auto List(std::string_view name, std::vector<std::string> fallback) const -> std::vector<std::string> {
+        const std::string value = Get(name, std::string());
+        if (value.empty()) return fallback;
+        std::vector<std::string> items;
+        std::stringstream in(value);
+        for (std::string item; std::getline(in, item, ',');)
+            if (!item.empty()) items.push_back(item);
+        return items;
+    }
+
+   private:
+    static auto Matches(const std::string& arg, std::string_view name) -> bool {
+        return arg.size() >= name.size() + 2 && arg.compare(0, 2, "--") == 0 && arg.compare(2, name.size(), name) == 0;
+    }
+
+    std::vector<std::string> args_;
+};
+
+}  // namespace sjtu::bench
+
+#endif  // SJTU_BENCH_HPP
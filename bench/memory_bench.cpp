@@ -0,0 +1,127 @@
+// Memory footprint of Trie and TrieStore.
+//
+//   memory_bench [--keys=N] [--versions=K] [--value-size=B]
+//                [--shapes=sequential,random,prefix,fanout]
+//                [--patterns=overwrite,insert,remove,hot] [--json]
+//
+// Per key: a Trie of N keys of each shape is built with Trie::Put. Per
+// version: K commits of each update pattern go to a TrieStore preloaded with
+// N sequential keys, and every version is kept. Both report the live heap
+// bytes measured through operator new (including malloc's rounding and, per
+// version, the store's list of versions) next to the estimate of
+// sjtu::MemoryCounter, broken down by kind.
+
+#include "bench.hpp"
+#include "../trie/memory.hpp"
+
+#include <iostream>
+
+namespace {
+
+struct Result {
+    std::string kind;  // "key" or "version"
+    std::string name;
+    size_t count{0};
+    double measured_bytes{0};
+    sjtu::MemoryUsage estimate;
+};
+
+auto Value(size_t size, uint64_t i) -> std::string {
+    std::string value(size, 'v');
+    for (size_t j = 0; j < size && j < 8; ++j) value[j] = static_cast<char>('a' + (i >> (4 * j)) % 16);
+    return value;
+}
+
+auto PerKey(const std::string& shape, size_t keys, size_t value_size) -> Result {
+    const auto set = sjtu::bench::MakeKeySet(shape, keys);
+    const int64_t before = sjtu::bench::live_bytes.load();
+    sjtu::Trie trie;
+    for (size_t i = 0; i < set.keys.size(); ++i) trie = trie.Put<std::string>(set.keys[i], Value(value_size, i));
+    const int64_t after = sjtu::bench::live_bytes.load();
+    return {"key", shape, keys, static_cast<double>(after - before), sjtu::MeasureMemory<std::string>(trie)};
+}
+
+auto PerVersion(const std::string& pattern, size_t keys, size_t versions, size_t value_size) -> Result {
+    if (pattern == "remove" && versions > keys) throw std::invalid_argument("more removals than keys");
+    sjtu::TrieStore store;
+    {
+        sjtu::TrieBuilder builder;
+        for (size_t i = 0; i < keys; ++i) builder.Put<std::string>(sjtu::bench::SequentialKey(i), Value(value_size, i));
+        store.Restore(builder.Build(), 0);
+    }
+    std::mt19937_64 rng(7);
+    sjtu::bench::Zipfian zipf(keys);
+    auto existing = [&] { return sjtu::bench::SequentialKey(rng() % keys); };
+
+    const int64_t before = sjtu::bench::live_bytes.load();
+    for (size_t v = 0; v < versions; ++v) {
+        if (pattern == "overwrite") {
+            store.Put<std::string>(existing(), Value(value_size, v));
+        } else if (pattern == "insert") {
+            store.Put<std::string>(sjtu::bench::SequentialKey(keys + v), Value(value_size, v));
+        } else if (pattern == "remove") {
+            // Removing a missing key publishes nothing; retry.
+            while (store.get_version() == v) store.Remove(existing());
+        } else if (pattern == "hot") {
+            store.Put<std::string>(sjtu::bench::SequentialKey(sjtu::bench::ScrambleRank(zipf(rng), keys)),
+                                   Value(value_size, v));
+        } else {
+            throw std::invalid_argument("unknown pattern " + pattern);
+        }
+    }
+    const int64_t after = sjtu::bench::live_bytes.load();
+
+    sjtu::MemoryCounter<std::string> counter;
+    counter.Add(store.GetSnapshot(0)->second);
+    sjtu::MemoryUsage added;
+    for (size_t v = 1; v <= versions; ++v) added += counter.Add(store.GetSnapshot(v)->second);
+    return {"version", pattern, versions, static_cast<double>(after - before), added};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    sjtu::bench::Flags flags(argc, argv);
+    const size_t keys = std::max<uint64_t>(1, flags.Get("keys", uint64_t{100000}));
+    const size_t versions = std::max<uint64_t>(1, flags.Get("versions", uint64_t{10000}));
+    const size_t value_size = flags.Get("value-size", uint64_t{32});
+    const bool json = flags.Has("json");
+
+    std::vector<Result> results;
+    for (const auto& shape : flags.List("shapes", {"sequential", "random", "prefix", "fanout"}))
+        results.push_back(PerKey(shape, keys, value_size));
+    for (const auto& pattern : flags.List("patterns", {"overwrite", "insert", "remove", "hot"}))
+        results.push_back(PerVersion(pattern, keys, versions, value_size));
+
+    auto per = [](size_t bytes, const Result& r) { return static_cast<double>(bytes) / r.count; };
+    if (json) {
+        sjtu::bench::Json out;
+        out.BeginObject().Field("benchmark", "memory_bench").Field("keys", uint64_t{keys});
+        out.Field("versions", uint64_t{versions}).Field("value_size", uint64_t{value_size});
+        out.Key("results").BeginArray();
+        for (const auto& r : results) {
+            const auto& e = r.estimate;
+            out.BeginObject().Field("per", r.kind).Field("name", r.name).Field("count", uint64_t{r.count});
+            out.Field("measured_bytes", r.measured_bytes / r.count).Field("estimated_bytes", per(e.Bytes(), r));
+            out.Field("node_bytes", per(e.node_bytes, r)).Field("map_bytes", per(e.map_bytes, r));
+            out.Field("control_block_bytes", per(e.control_block_bytes, r)).Field("value_bytes", per(e.value_bytes, r));
+            out.Field("nodes", per(e.nodes, r)).Field("map_entries", per(e.map_entries, r));
+            out.Field("control_blocks", per(e.control_blocks, r)).Field("values", per(e.values, r));
+            out.Field("allocations", per(e.allocations, r)).EndObject();
+        }
+        out.EndArray().EndObject();
+        std::cout << out.Str() << std::endl;
+        return 0;
+    }
+
+    std::printf("%-8s %-10s %10s %10s %8s %8s %8s %8s %7s %7s\n", "per", "name", "measured", "estimate", "nodes",
+                "map", "ctrl", "values", "nodes#", "allocs");
+    for (const auto& r : results) {
+        const auto& e = r.estimate;
+        std::printf("%-8s %-10s %10.1f %10.1f %8.1f %8.1f %8.1f %8.1f %7.2f %7.2f\n", r.kind.c_str(),
+                    r.name.c_str(), r.measured_bytes / r.count, per(e.Bytes(), r), per(e.node_bytes, r),
+                    per(e.map_bytes, r), per(e.control_block_bytes, r), per(e.value_bytes, r), per(e.nodes, r),
+                    per(e.allocations, r));
+    }
+    return 0;
+}
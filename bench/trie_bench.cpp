@@ -0,0 +1,141 @@
+// Microbenchmarks of Trie and TrieStore Get/Put/Remove over the key
+// distributions of bench.hpp.
+//
+//   trie_bench [--keys=N] [--dists=sequential,random,...] [--ops=trie_get,...] [--json]
+//
+// Every operation is timed on its own; the clock overhead is measured once and
+// subtracted. Allocations are counted through the global operator new.
+
+#include "bench.hpp"
+#include "../trie/src.hpp"
+
+#include <functional>
+#include <iostream>
+
+namespace {
+
+using sjtu::bench::Clock;
+
+struct Result {
+    std::string op;
+    std::string dist;
+    size_t ops{0};
+    double ns_per_op{0};
+    double allocs_per_op{0};
+    sjtu::bench::Latencies latencies;
+};
+
+// Run `op(i)` for i in [0, ops) once, timing each call.
+auto Measure(const std::string& name, const std::string& dist, size_t ops, double overhead,
+             const std::function<void(size_t)>& op) -> Result {
+    Result result{name, dist, ops, 0, 0, {}};
+    result.latencies.Reserve(ops);
+    const uint64_t allocations = sjtu::bench::allocations.load();
+    const auto start = Clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        const auto before = Clock::now();
+        op(i);
+        result.latencies.Add(std::chrono::duration<double, std::nano>(Clock::now() - before).count() - overhead);
+    }
+    const double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    // The per-op allocations exclude the latency vector, which was reserved.
+    result.allocs_per_op = static_cast<double>(sjtu::bench::allocations.load() - allocations) / ops;
+    result.ns_per_op = elapsed / ops - 2 * overhead;
+    return result;
+}
+
+auto Build(const sjtu::bench::KeySet& set) -> sjtu::Trie {
+    sjtu::TrieBuilder builder;
+    for (size_t i = 0; i < set.keys.size(); ++i) builder.Put<uint64_t>(set.keys[i], i);
+    return builder.Build();
+}
+
+// Keeps results alive so the compiler cannot drop the lookups.
+volatile uint64_t sink;
+
+auto RunAll(const sjtu::bench::KeySet& set, const std::vector<std::string>& ops, double overhead)
+    -> std::vector<Result> {
+    std::vector<Result> results;
+    const size_t n = set.order.size();
+    auto key = [&set](size_t i) -> const std::string& { return set.keys[set.order[i]]; };
+    auto wanted = [&ops](const std::string& op) { return std::find(ops.begin(), ops.end(), op) != ops.end(); };
+    const sjtu::Trie full = Build(set);
+
+    if (wanted("trie_get")) {
+        results.push_back(Measure("trie_get", set.name, n, overhead, [&](size_t i) {
+            const uint64_t* value = full.Get<uint64_t>(key(i));
+            sink = value ? *value : 0;
+        }));
+    }
+    if (wanted("trie_put")) {
+        sjtu::Trie trie;
+        results.push_back(Measure("trie_put", set.name, n, overhead,
+                                  [&](size_t i) { trie = trie.Put<uint64_t>(key(i), i); }));
+    }
+    if (wanted("trie_remove")) {
+        sjtu::Trie trie = full;
+        results.push_back(
+            Measure("trie_remove", set.name, n, overhead, [&](size_t i) { trie = trie.Remove(key(i)); }));
+    }
+    if (wanted("store_get") || wanted("store_put") || wanted("store_remove")) {
+        sjtu::TrieStore store;
+        if (wanted("store_put")) {
+            results.push_back(Measure("store_put", set.name, n, overhead,
+                                      [&](size_t i) { store.Put<uint64_t>(key(i), i); }));
+        }
+        store.Restore(full, 0);
+        if (wanted("store_get")) {
+            results.push_back(Measure("store_get", set.name, n, overhead, [&](size_t i) {
+                auto guard = store.Get<uint64_t>(key(i));
+                sink = guard ? **guard : 0;
+            }));
+        }
+        if (wanted("store_remove")) {
+            results.push_back(
+                Measure("store_remove", set.name, n, overhead, [&](size_t i) { store.Remove(key(i)); }));
+        }
+    }
+    return results;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    sjtu::bench::Flags flags(argc, argv);
+    const size_t keys = flags.Get("keys", uint64_t{100000});
+    const auto dists = flags.List("dists", sjtu::bench::KeySetNames());
+    const auto ops = flags.List("ops", {"trie_get", "trie_put", "trie_remove", "store_get", "store_put", "store_remove"});
+    const bool json = flags.Has("json");
+
+    const double overhead = sjtu::bench::TimerOverhead();
+    std::vector<Result> results;
+    for (const auto& dist : dists) {
+        const auto set = sjtu::bench::MakeKeySet(dist, keys);
+        for (auto& result : RunAll(set, ops, overhead)) results.push_back(std::move(result));
+    }
+
+    if (json) {
+        sjtu::bench::Json out;
+        out.BeginObject().Field("benchmark", "trie_bench").Field("keys", uint64_t{keys});
+        out.Field("timer_overhead_ns", overhead).Key("results").BeginArray();
+        for (auto& r : results) {
+            out.BeginObject().Field("op", r.op).Field("dist", r.dist).Field("ops", uint64_t{r.ops});
+            out.Field("ns_per_op", r.ns_per_op).Field("allocs_per_op", r.allocs_per_op);
+            out.Field("p50_ns", r.latencies.Quantile(0.5)).Field("p90_ns", r.latencies.Quantile(0.9));
+            out.Field("p99_ns", r.latencies.Quantile(0.99)).Field("p999_ns", r.latencies.Quantile(0.999));
+            out.Field("max_ns", r.latencies.Quantile(1.0)).EndObject();
+        }
+        out.EndArray().EndObject();
+        std::cout << out.Str() << std::endl;
+        return 0;
+    }
+
+    std::printf("%-13s %-11s %10s %10s %9s %9s %9s %9s\n", "op", "dist", "ns/op", "allocs/op", "p50", "p99",
+                "p999", "max");
+    for (auto& r : results) {
+        std::printf("%-13s %-11s %10.1f %10.2f %9.0f %9.0f %9.0f %9.0f\n", r.op.c_str(), r.dist.c_str(),
+                    r.ns_per_op, r.allocs_per_op, r.latencies.Quantile(0.5), r.latencies.Quantile(0.99),
+                    r.latencies.Quantile(0.999), r.latencies.Quantile(1.0));
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+// Reader/writer scaling of TrieStore.
+//
+//   trie_store_scaling_bench [--threads=1,2,4,8] [--read-ratio=0.75]
+//                            [--readers=R --writers=W] [--keys=N] [--value-size=B]
+//                            [--duration-ms=D] [--dist=uniform|zipfian] [--sample-every=K] [--json]
+//
+// Each configuration runs twice: readers alone, then readers and writers
+// together. The first run is the baseline for the reader slowdown caused by
+// concurrent commits. Every commit is timed, and every K-th read. Without
+// --readers/--writers the benchmark sweeps the total thread counts of
+// --threads, giving round(T * read-ratio) threads to readers (at least one,
+// and at least one writer if the ratio is below 1).
+//
+// Writers go through a HistoryTrimmer so long runs stay in memory. Its pauses
+// are left out of the commit latencies and reported as trims.
+
+#include "bench.hpp"
+
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using sjtu::bench::Clock;
+
+struct Config {
+    size_t readers;
+    size_t writers;
+};
+
+struct Options {
+    size_t keys;
+    size_t value_size;
+    std::chrono::milliseconds duration;
+    bool zipfian;
+    uint64_t sample_every;
+};
+
+struct Phase {
+    uint64_t reads{0};
+    uint64_t commits{0};
+    double seconds{0};
+    sjtu::bench::Latencies read_latency;
+    sjtu::bench::Latencies commit_latency;
+    uint64_t trims{0};
+    double trim_seconds{0};
+};
+
+struct Result {
+    Config config;
+    Phase alone;
+    Phase loaded;
+};
+
+class KeyPicker {
+   public:
+    KeyPicker(const Options& options, uint64_t seed)
+        : rng_(seed), zipf_(options.zipfian ? std::make_unique<sjtu::bench::Zipfian>(options.keys) : nullptr),
+          keys_(options.keys) {}
+
+    auto operator()() -> uint64_t {
+        if (zipf_) return sjtu::bench::ScrambleRank((*zipf_)(rng_), keys_);
+        return std::uniform_int_distribution<uint64_t>(0, keys_ - 1)(rng_);
+    }
+
+   private:
+    std::mt19937_64 rng_;
+    std::unique_ptr<sjtu::bench::Zipfian> zipf_;
+    uint64_t keys_;
+};
+
+auto RunPhase(sjtu::TrieStore& store, const std::vector<std::string>& keys, const Config& config,
+              const Options& options, bool with_writers) -> Phase {
+    const size_t writers = with_writers ? config.writers : 0;
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    sjtu::bench::HistoryTrimmer trimmer(store);
+    std::vector<Phase> phases(config.readers + writers);
+    std::vector<std::thread> threads;
+    const std::string value(options.value_size, 'v');
+
+    for (size_t t = 0; t < config.readers; ++t) {
+        threads.emplace_back([&, t] {
+            Phase& phase = phases[t];
+            KeyPicker pick(options, t + 1);
+            uint64_t found = 0;
+            while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                const std::string& key = keys[pick()];
+                if (phase.reads % options.sample_every == 0) {
+                    const auto before = Clock::now();
+                    found += store.Get<std::string>(key).has_value();
+                    phase.read_latency.Add(std::chrono::duration<double, std::nano>(Clock::now() - before).count());
+                } else {
+                    found += store.Get<std::string>(key).has_value();
+                }
+                ++phase.reads;
+            }
+            if (found > phase.reads) std::abort();
+        });
+    }
+    for (size_t t = 0; t < writers; ++t) {
+        threads.emplace_back([&, t] {
+            Phase& phase = phases[config.readers + t];
+            KeyPicker pick(options, 1000 + t);
+            while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                const std::string& key = keys[pick()];
+                const auto before = Clock::now();
+                trimmer.Write([&] { return store.Put<std::string>(key, value); });
+                const double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - before).count();
+                phase.commit_latency.Add(elapsed - sjtu::bench::HistoryTrimmer::TakePausedNs());
+                ++phase.commits;
+            }
+        });
+    }
+
+    const auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(options.duration);
+    stop.store(true);
+    for (auto& thread : threads) thread.join();
+
+    Phase total;
+    total.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    for (const auto& phase : phases) {
+        total.reads += phase.reads;
+        total.commits += phase.commits;
+        total.read_latency.Merge(phase.read_latency);
+        total.commit_latency.Merge(phase.commit_latency);
+    }
+    total.trims = trimmer.Trims();
+    total.trim_seconds = trimmer.TrimSeconds();
+    return total;
+}
+
+auto Run(const Config& config, const Options& options, const std::vector<std::string>& keys) -> Result {
+    sjtu::TrieStore store;
+    {
+        sjtu::TrieBuilder builder;
+        for (const auto& key : keys) builder.Put<std::string>(key, std::string(options.value_size, 'v'));
+        store.Restore(builder.Build(), 0);
+    }
+    Result result{config, {}, {}};
+    if (config.readers > 0 && config.writers > 0) result.alone = RunPhase(store, keys, config, options, false);
+    result.loaded = RunPhase(store, keys, config, options, true);
+    if (config.writers == 0) result.alone = result.loaded;
+    return result;
+}
+
+auto PerSecond(uint64_t count, const Phase& phase) -> double { return phase.seconds > 0 ? count / phase.seconds : 0; }
+
+// Reader throughput without writers over reader throughput with them.
+auto Slowdown(const Result& r) -> double {
+    const double loaded = PerSecond(r.loaded.reads, r.loaded);
+    return loaded > 0 ? PerSecond(r.alone.reads, r.alone) / loaded : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    sjtu::bench::Flags flags(argc, argv);
+    Options options{};
+    options.keys = flags.Get("keys", uint64_t{100000});
+    options.value_size = flags.Get("value-size", uint64_t{16});
+    options.duration = std::chrono::milliseconds(flags.Get("duration-ms", uint64_t{1000}));
+    options.zipfian = flags.Get("dist", std::string("uniform")) == "zipfian";
+    options.sample_every = std::max<uint64_t>(1, flags.Get("sample-every", uint64_t{8}));
+    const bool json = flags.Has("json");
+    if (options.keys == 0) {
+        std::cerr << "--keys must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<Config> configs;
+    if (flags.Has("readers") || flags.Has("writers")) {
+        configs.push_back({flags.Get("readers", uint64_t{0}), flags.Get("writers", uint64_t{0})});
+    } else {
+        const double ratio = std::clamp(flags.Get("read-ratio", 0.75), 0.0, 1.0);
+        std::vector<std::string> counts;
+        for (size_t t = 1; t <= std::max(2u, std::thread::hardware_concurrency()); t *= 2)
+            counts.push_back(std::to_string(t));
+        for (const auto& count : flags.List("threads", counts)) {
+            const size_t total = std::stoull(count);
+            size_t readers = std::max<size_t>(ratio > 0 ? 1 : 0, static_cast<size_t>(std::lround(total * ratio)));
+            if (ratio < 1 && total > 1) readers = std::min(readers, total - 1);
+            readers = std::min(readers, total);
+            configs.push_back({readers, total - readers});
+        }
+    }
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < options.keys; ++i) keys.push_back(sjtu::bench::SequentialKey(i));
+
+    std::vector<Result> results;
+    for (const auto& config : configs) results.push_back(Run(config, options, keys));
+
+    if (json) {
+        sjtu::bench::Json out;
+        out.BeginObject().Field("benchmark", "trie_store_scaling_bench").Field("keys", uint64_t{options.keys});
+        out.Field("value_size", uint64_t{options.value_size});
+        out.Field("duration_ms", static_cast<uint64_t>(options.duration.count()));
+        out.Field("dist", options.zipfian ? "zipfian" : "uniform").Key("results").BeginArray();
+        for (auto& r : results) {
+            out.BeginObject().Field("readers", uint64_t{r.config.readers}).Field("writers", uint64_t{r.config.writers});
+            out.Field("reads_per_s_alone", PerSecond(r.alone.reads, r.alone));
+            out.Field("reads_per_s", PerSecond(r.loaded.reads, r.loaded));
+            out.Field("commits_per_s", PerSecond(r.loaded.commits, r.loaded));
+            out.Field("reader_slowdown", Slowdown(r));
+            out.Field("read_p50_ns", r.loaded.read_latency.Quantile(0.5));
+            out.Field("read_p99_ns", r.loaded.read_latency.Quantile(0.99));
+            out.Field("read_p999_ns", r.loaded.read_latency.Quantile(0.999));
+            out.Field("read_p50_ns_alone", r.alone.read_latency.Quantile(0.5));
+            out.Field("commit_p50_ns", r.loaded.commit_latency.Quantile(0.5));
+            out.Field("commit_p99_ns", r.loaded.commit_latency.Quantile(0.99));
+            out.Field("commit_p999_ns", r.loaded.commit_latency.Quantile(0.999));
+            out.Field("trims", r.loaded.trims).Field("trim_pause_ms", r.loaded.trim_seconds * 1e3).EndObject();
+        }
+        out.EndArray().EndObject();
+        std::cout << out.Str() << std::endl;
+        return 0;
+    }
+
+    std::printf("%3s %3s %12s %12s %10s %9s %9s %9s %10s %10s %10s %6s %9s\n", "R", "W", "reads/s", "commits/s",
+                "slowdown", "rd p50", "rd p99", "rd p999", "cm p50", "cm p99", "cm p999", "trims", "trim ms");
+    for (auto& r : results) {
+        std::printf("%3zu %3zu %12.0f %12.0f %9.2fx %9.0f %9.0f %9.0f %10.0f %10.0f %10.0f %6llu %9.1f\n",
+                    r.config.readers, r.config.writers, PerSecond(r.loaded.reads, r.loaded),
+                    PerSecond(r.loaded.commits, r.loaded), Slowdown(r), r.loaded.read_latency.Quantile(0.5),
+                    r.loaded.read_latency.Quantile(0.99), r.loaded.read_latency.Quantile(0.999),
+                    r.loaded.commit_latency.Quantile(0.5), r.loaded.commit_latency.Quantile(0.99),
+                    r.loaded.commit_latency.Quantile(0.999), static_cast<unsigned long long>(r.loaded.trims),
+                    r.loaded.trim_seconds * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,362 @@
+// A YCSB-style workload driver (Cooper et al., "Benchmarking Cloud Serving
+// Systems with YCSB"). It runs the core workloads against a Backend:
+//
+//   A  50% read, 50% update                  zipfian
+//   B  95% read, 5% update                   zipfian
+//   C  100% read                             zipfian
+//   D  95% read, 5% insert                   latest
+//   E  95% scan (1-100 keys), 5% insert      zipfian
+//   F  50% read, 50% read-modify-write       zipfian
+//
+//   ycsb_bench [--workloads=A,B,C,D,E,F] [--backend=trie_store|trie_store_wal]
+//              [--records=N] [--operations=M] [--threads=T] [--value-size=B]
+//              [--dist=zipfian|uniform|latest] [--max-scan=L] [--json]
+//
+// Every workload starts from a fresh backend filled by a load phase of N
+// inserts, then runs M operations split across T threads. --dist overrides
+// the request distribution of every workload. Results carry kDriverVersion;
+// compare runs of the same driver version only.
+
+#include "bench.hpp"
+#include "../trie/wal.hpp"
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace {
+
+using sjtu::bench::Clock;
+
+constexpr uint64_t kDriverVersion = 1;
+
+// A key-value store under test. Implementations must be safe to call from
+// many threads.
+class Backend {
+   public:
+    virtual ~Backend() = default;
+
+    virtual auto Read(const std::string& key, std::string& value) -> bool = 0;
+    virtual void Update(const std::string& key, const std::string& value) = 0;
+    virtual void Insert(const std::string& key, const std::string& value) = 0;
+    // Up to `count` pairs with keys at or above `start`, in key order.
+    virtual auto Scan(const std::string& start, size_t count) -> size_t = 0;
+
+    // The time the calling thread spent on the backend's own upkeep (e.g.
+    // history trims) since its last call. It is left out of op latencies.
+    virtual auto TakePausedNs() -> double { return 0; }
+    // Upkeep pauses in total, reported next to the latencies.
+    virtual auto Pauses() -> uint64_t { return 0; }
+    virtual auto PauseSeconds() -> double { return 0; }
+};
+
+// Visit the values of `node`'s subtree in key order, starting at the first
+// key at or above `start` when `bounded`. Stops once `left` reaches zero.
+template <class F>
+void ScanNode(const sjtu::TrieNode* node, std::string& key, std::string_view start, bool bounded, size_t& left,
+              F& fn) {
+    if (bounded && key.size() == start.size()) bounded = false;
+    if (!bounded) {
+        if (const std::string* value = sjtu::TrieAccess::ValueOf<std::string>(node)) {
+            fn(key, *value);
+            if (--left == 0) return;
+        }
+    }
+    auto it = bounded ? node->children_.lower_bound(start[key.size()]) : node->children_.begin();
+    for (; it != node->children_.end() && left > 0; ++it) {
+        key.push_back(it->first);
+        ScanNode(it->second.get(), key, start, bounded && it->first == start[key.size() - 1], left, fn);
+        key.pop_back();
+    }
+}
+
+class TrieStoreBackend : public Backend {
+   public:
+    TrieStoreBackend() = default;
+
+    // Log every commit to a WriteAheadLog in `wal_dir`, synced every 10 ms.
+    explicit TrieStoreBackend(const std::string& wal_dir) : wal_dir_{wal_dir} {
+        std::filesystem::remove_all(wal_dir);
+        store_.AddListener(std::make_shared<sjtu::WriteAheadLog<std::string>>(
+            wal_dir, sjtu::WalOptions{sjtu::WalSyncMode::kInterval}));
+    }
+
+    auto Read(const std::string& key, std::string& value) -> bool override {
+        auto guard = store_.Get<std::string>(key);
+        if (!guard) return false;
+        value = **guard;
+        return true;
+    }
+
+    void Update(const std::string& key, const std::string& value) override {
+        trimmer_.Write([&] { return store_.Put<std::string>(key, value); });
+    }
+
+    void Insert(const std::string& key, const std::string& value) override { Update(key, value); }
+
+    auto TakePausedNs() -> double override { return sjtu::bench::HistoryTrimmer::TakePausedNs(); }
+    auto Pauses() -> uint64_t override { return trimmer_.Trims(); }
+    auto PauseSeconds() -> double override { return trimmer_.TrimSeconds(); }
+
+    auto Scan(const std::string& start, size_t count) -> size_t override {
+        auto snapshot = store_.GetSnapshot();
+        const sjtu::TrieNode* root = sjtu::TrieAccess::Root(snapshot->second).get();
+        if (!root || count == 0) return 0;
+        size_t left = count;
+        std::string key;
+        size_t bytes = 0;
+        auto visit = [&bytes](const std::string& k, const std::string& v) { bytes += k.size() + v.size(); };
+        ScanNode(root, key, start, true, left, visit);
+        return count - left;
+    }
+
+   private:
+    // Removes the log once the store, and with it the log's listener, is gone.
+    struct TempDir {
+        std::string path;
+        ~TempDir() {
+            if (!path.empty()) std::filesystem::remove_all(path);
+        }
+    };
+
+    TempDir wal_dir_;
+    sjtu::TrieStore store_;
+    sjtu::bench::HistoryTrimmer trimmer_{store_};
+};
+
+auto MakeBackend(const std::string& name) -> std::unique_ptr<Backend> {
+    if (name == "trie_store") return std::make_unique<TrieStoreBackend>();
+    if (name == "trie_store_wal")
+        return std::make_unique<TrieStoreBackend>("/tmp/ycsb_bench_wal." + std::to_string(getpid()));
+    throw std::invalid_argument("unknown backend " + name);
+}
+
+enum class Op { kRead, kUpdate, kInsert, kScan, kReadModifyWrite };
+
+constexpr const char* kOpNames[] = {"read", "update", "insert", "scan", "rmw"};
+
+struct Workload {
+    std::string name;
+    double read, update, insert, scan, rmw;
+    std::string dist;
+};
+
+auto CoreWorkloads() -> std::vector<Workload> {
+    return {{"A", 0.50, 0.50, 0, 0, 0, "zipfian"}, {"B", 0.95, 0.05, 0, 0, 0, "zipfian"},
+            {"C", 1.00, 0, 0, 0, 0, "zipfian"},    {"D", 0.95, 0, 0.05, 0, 0, "latest"},
+            {"E", 0, 0, 0.05, 0.95, 0, "zipfian"}, {"F", 0.50, 0, 0, 0, 0.50, "zipfian"}};
+}
+
+// YCSB's record keys: "user" and a hash of the record number, so that
+// inserts in order land all over the key space.
+auto RecordKey(uint64_t record) -> std::string {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= (record >> (8 * i)) & 0xff;
+        hash *= 0x100000001b3ull;
+    }
+    return "user" + std::to_string(hash);
+}
+
+struct Options {
+    uint64_t records;
+    uint64_t operations;
+    size_t threads;
+    size_t value_size;
+    size_t max_scan;
+    std::string backend;
+    std::string dist;
+};
+
+struct Result {
+    std::string workload;
+    double load_seconds{0};
+    double run_seconds{0};
+    uint64_t operations{0};
+    std::map<std::string, sjtu::bench::Latencies> latencies;
+    uint64_t pauses{0};
+    double pause_seconds{0};
+};
+
+// Picks the record of each request. Records [0, inserted) exist; inserts
+// claim new record numbers from `next`.
+class RequestPicker {
+   public:
+    RequestPicker(const std::string& dist, uint64_t records, uint64_t expected, std::atomic<uint64_t>& inserted,
+                  uint64_t seed)
+        : dist_(dist), rng_(seed), inserted_(inserted) {
+        if (dist_ != "uniform") zipf_ = std::make_unique<sjtu::bench::Zipfian>(std::max(records, expected));
+    }
+
+    auto operator()() -> uint64_t {
+        const uint64_t n = inserted_.load(std::memory_order_acquire);
+        if (dist_ == "uniform") return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng_);
+        while (true) {
+            const uint64_t rank = (*zipf_)(rng_);
+            if (rank >= n) continue;
+            // "latest" favours the newest records, zipfian a scattered set.
+            return dist_ == "latest" ? n - 1 - rank : sjtu::bench::ScrambleRank(rank, n);
+        }
+    }
+
+   private:
+    std::string dist_;
+    std::mt19937_64 rng_;
+    std::unique_ptr<sjtu::bench::Zipfian> zipf_;
+    std::atomic<uint64_t>& inserted_;
+};
+
+auto Run(const Workload& workload, const Options& options) -> Result {
+    Result result;
+    result.workload = workload.name;
+    auto backend = MakeBackend(options.backend);
+    const std::string value(options.value_size, 'v');
+
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < options.records; ++i) backend->Insert(RecordKey(i), value);
+    result.load_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const uint64_t load_pauses = backend->Pauses();
+    const double load_pause_seconds = backend->PauseSeconds();
+
+    std::atomic<uint64_t> next{options.records};
+    std::atomic<uint64_t> inserted{options.records};
+    const uint64_t expected = options.records + static_cast<uint64_t>(options.operations * workload.insert) + 1;
+    const std::string dist = options.dist.empty() ? workload.dist : options.dist;
+    std::vector<std::map<std::string, sjtu::bench::Latencies>> latencies(options.threads);
+    std::vector<std::thread> threads;
+    start = Clock::now();
+    for (size_t t = 0; t < options.threads; ++t) {
+        const uint64_t ops = options.operations / options.threads + (t < options.operations % options.threads);
+        threads.emplace_back([&, t, ops] {
+            RequestPicker pick(dist, options.records, expected, inserted, t + 1);
+            std::mt19937_64 rng(1000 + t);
+            std::uniform_real_distribution<double> coin(0, 1);
+            std::uniform_int_distribution<size_t> scan_length(1, options.max_scan);
+            sjtu::bench::Latencies* by_op[5];
+            for (int op = 0; op < 5; ++op) by_op[op] = &latencies[t][kOpNames[op]];
+            std::string read;
+            for (uint64_t i = 0; i < ops; ++i) {
+                double x = coin(rng);
+                Op op = Op::kReadModifyWrite;
+                if ((x -= workload.read) < 0) op = Op::kRead;
+                else if ((x -= workload.update) < 0) op = Op::kUpdate;
+                else if ((x -= workload.insert) < 0) op = Op::kInsert;
+                else if ((x -= workload.scan) < 0) op = Op::kScan;
+                const auto before = Clock::now();
+                switch (op) {
+                    case Op::kRead:
+                        backend->Read(RecordKey(pick()), read);
+                        break;
+                    case Op::kUpdate:
+                        backend->Update(RecordKey(pick()), value);
+                        break;
+                    case Op::kInsert: {
+                        const uint64_t record = next.fetch_add(1);
+                        backend->Insert(RecordKey(record), value);
+                        // Publish the record once every smaller one exists.
+                        uint64_t done = record;
+                        while (!inserted.compare_exchange_weak(done, record + 1)) {
+                            done = record;
+                            std::this_thread::yield();
+                        }
+                        break;
+                    }
+                    case Op::kScan:
+                        backend->Scan(RecordKey(pick()), scan_length(rng));
+                        break;
+                    case Op::kReadModifyWrite: {
+                        const std::string key = RecordKey(pick());
+                        if (!backend->Read(key, read)) read = value;
+                        read.back() ^= 1;
+                        backend->Update(key, read);
+                        break;
+                    }
+                }
+                const double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - before).count();
+                by_op[static_cast<int>(op)]->Add(elapsed - backend->TakePausedNs());
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    result.run_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.operations = options.operations;
+    result.pauses = backend->Pauses() - load_pauses;
+    result.pause_seconds = backend->PauseSeconds() - load_pause_seconds;
+    for (auto& per_thread : latencies)
+        for (auto& [op, samples] : per_thread)
+            if (samples.Count() > 0) result.latencies[op].Merge(samples);
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    sjtu::bench::Flags flags(argc, argv);
+    Options options{};
+    options.records = flags.Get("records", uint64_t{100000});
+    options.operations = flags.Get("operations", uint64_t{200000});
+    options.threads = std::max<uint64_t>(1, flags.Get("threads", uint64_t{std::max(1u, std::thread::hardware_concurrency())}));
+    options.value_size = std::max<uint64_t>(1, flags.Get("value-size", uint64_t{100}));
+    options.max_scan = std::max<uint64_t>(1, flags.Get("max-scan", uint64_t{100}));
+    options.backend = flags.Get("backend", std::string("trie_store"));
+    options.dist = flags.Get("dist", std::string());
+    const bool json = flags.Has("json");
+    if (options.records == 0) {
+        std::cerr << "--records must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    const auto names = flags.List("workloads", {"A", "B", "C", "D", "E", "F"});
+    for (const auto& workload : CoreWorkloads())
+        if (std::find(names.begin(), names.end(), workload.name) != names.end())
+            results.push_back(Run(workload, options));
+
+    if (json) {
+        sjtu::bench::Json out;
+        out.BeginObject().Field("benchmark", "ycsb_bench").Field("driver_version", kDriverVersion);
+        out.Field("backend", options.backend).Field("records", options.records);
+        out.Field("operations", options.operations).Field("threads", uint64_t{options.threads});
+        out.Field("value_size", uint64_t{options.value_size}).Key("results").BeginArray();
+        for (auto& r : results) {
+            out.BeginObject().Field("workload", r.workload).Field("load_seconds", r.load_seconds);
+            out.Field("load_ops_per_s", options.records / r.load_seconds);
+            out.Field("run_seconds", r.run_seconds).Field("ops_per_s", r.operations / r.run_seconds);
+            out.Field("pauses", r.pauses).Field("pause_ms", r.pause_seconds * 1e3);
+            out.Key("ops").BeginObject();
+            for (auto& [op, samples] : r.latencies) {
+                out.Key(op).BeginObject().Field("count", uint64_t{samples.Count()}).Field("mean_ns", samples.Mean());
+                out.Field("p50_ns", samples.Quantile(0.5)).Field("p95_ns", samples.Quantile(0.95));
+                out.Field("p99_ns", samples.Quantile(0.99)).Field("p999_ns", samples.Quantile(0.999)).EndObject();
+            }
+            out.EndObject().EndObject();
+        }
+        out.EndArray().EndObject();
+        std::cout << out.Str() << std::endl;
+        return 0;
+    }
+
+    std::printf("%-2s %12s %12s  %-6s %9s %10s %10s %10s %10s\n", "wl", "load ops/s", "run ops/s", "op", "count",
+                "mean", "p95", "p99", "p999");
+    for (auto& r : results) {
+        bool first = true;
+        for (auto& [op, samples] : r.latencies) {
+            if (first) {
+                std::printf("%-2s %12.0f %12.0f", r.workload.c_str(), options.records / r.load_seconds,
+                            r.operations / r.run_seconds);
+            } else {
+                std::printf("%-2s %12s %12s", "", "", "");
+            }
+            first = false;
+            std::printf("  %-6s %9zu %10.0f %10.0f %10.0f %10.0f\n", op.c_str(), samples.Count(), samples.Mean(),
+                        samples.Quantile(0.95), samples.Quantile(0.99), samples.Quantile(0.999));
+        }
+        if (r.pauses > 0)
+            std::printf("%-2s %12s %12s  %llu upkeep pauses, %.1f ms, not in the latencies\n", "", "", "",
+                        static_cast<unsigned long long>(r.pauses), r.pause_seconds * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "../trie/background_snapshot.hpp"
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main() {
+    std::string dir = "/tmp/trie_background_snapshot_test." + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    sjtu::TrieStore store;
+    for (int i = 0; i < 20000; i++) store.Put<std::string>("key" + std::to_string(i), "value" + std::to_string(i));
+    size_t version = store.get_version();
+
+    // Writers are not blocked while a rate-limited snapshot runs
+    std::atomic<size_t> reports{0}, last_bytes{0};
+    std::atomic<bool> monotonic{true}, saw_done{false};
+    sjtu::SnapshotOptions options;
+    options.bytes_per_second = 1 << 20;
+    options.on_progress = [&](const sjtu::SnapshotProgress& progress) {
+        if (progress.version != version || progress.bytes_written < last_bytes) monotonic = false;
+        last_bytes = progress.bytes_written;
+        if (progress.done) saw_done = true;
+        reports++;
+    };
+    auto job = sjtu::SnapshotToFile<std::string>(store, version, dir + "/snapshot", options);
+    int writes = 0;
+    while (!job->Done()) {
+        store.Put<std::string>("key" + std::to_string(writes % 20000), "new" + std::to_string(writes));
+        writes++;
+    }
+    job->Wait();
+    if (writes < 100) {
+        std::cout << "Test failed: only " << writes << " writes while the snapshot ran" << std::endl;
+        return 1;
+    }
+    if (!monotonic || !saw_done || reports < 2 || job->BytesWritten() != std::filesystem::file_size(dir + "/snapshot")) {
+        std::cout << "Test failed: progress was not reported correctly" << std::endl;
+        return 1;
+    }
+
+    // The file holds the pinned version, not what was written since
+    std::ifstream in(dir + "/snapshot", std::ios::binary);
+    sjtu::Trie trie = sjtu::Deserialize<std::string>(in);
+    for (int i = 0; i < 20000; i++) {
+        const std::string* value = trie.Get<std::string>("key" + std::to_string(i));
+        if (!value || *value != "value" + std::to_string(i)) {
+            std::cout << "Test failed: snapshot differs at key" << i << std::endl;
+            return 1;
+        }
+    }
+
+    // A cancelled snapshot leaves no file behind
+    options.bytes_per_second = 1 << 10;
+    options.on_progress = nullptr;
+    auto slow = sjtu::SnapshotToFile<std::string>(store, -1, dir + "/cancelled", options);
+    if (slow->Version() != store.get_version()) {
+        std::cout << "Test failed: default version is not the newest" << std::endl;
+        return 1;
+    }
+    // Let it fall behind its rate; cancelling must not wait out the pause
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto cancelled = std::chrono::steady_clock::now();
+    slow->Cancel();
+    try {
+        slow->Wait();
+        std::cout << "Test failed: cancelled snapshot completed" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+    if (std::chrono::steady_clock::now() - cancelled > std::chrono::seconds(5)) {
+        std::cout << "Test failed: cancel waited for the rate limit" << std::endl;
+        return 1;
+    }
+    if (std::filesystem::exists(dir + "/cancelled") || std::filesystem::exists(dir + "/cancelled.tmp")) {
+        std::cout << "Test failed: cancelled snapshot left a file" << std::endl;
+        return 1;
+    }
+
+    try {
+        sjtu::SnapshotToFile<std::string>(store, store.get_version() + 1, dir + "/missing");
+        std::cout << "Test failed: snapshot of a missing version started" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include "../trie/checkpoint.hpp"
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+int Compare(const sjtu::Trie& expected, const sjtu::Trie& actual, int keys) {
+    for (int i = 0; i < keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        auto a = expected.Get<std::string>(key);
+        auto b = actual.Get<std::string>(key);
+        if ((a == nullptr) != (b == nullptr) || (a && *a != *b)) {
+            std::cout << "Test failed: checkpoint differs at " << key << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    std::string dir = "/tmp/trie_checkpoint_test." + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+
+    sjtu::TrieStore store;
+    for (int i = 0; i < 5000; i++) store.Put<std::string>("key" + std::to_string(i), "value" + std::to_string(i));
+
+    size_t full_nodes;
+    std::string nodes;
+    {
+        sjtu::Checkpointer<std::string> checkpointer(dir);
+        nodes = checkpointer.NodesPath();
+        if (checkpointer.Latest()) {
+            std::cout << "Test failed: empty directory has a checkpoint" << std::endl;
+            return 1;
+        }
+        auto full = checkpointer.Checkpoint(store);
+        full_nodes = full.nodes_written;
+        if (full.version != store.get_version() || full_nodes < 5000) {
+            std::cout << "Test failed: first checkpoint did not write the whole trie" << std::endl;
+            return 1;
+        }
+
+        // Only the paths to the changed keys are written again
+        store.Put<std::string>("key42", "changed");
+        store.Remove("key4242");
+        auto incremental = checkpointer.Checkpoint(store);
+        if (incremental.nodes_written == 0 || incremental.nodes_written > 20 ||
+            incremental.bytes_written * 50 > full.bytes_written) {
+            std::cout << "Test failed: incremental checkpoint wrote " << incremental.nodes_written << " nodes"
+                      << std::endl;
+            return 1;
+        }
+        auto nothing = checkpointer.Checkpoint(store);
+        if (nothing.nodes_written != 0) {
+            std::cout << "Test failed: unchanged trie was written again" << std::endl;
+            return 1;
+        }
+    }
+
+    // A torn checkpoint past the manifest is ignored
+    {
+        std::ofstream out(nodes, std::ios::binary | std::ios::app);
+        out << "garbage from a crashed checkpoint";
+    }
+    auto latest = store.GetSnapshot();
+    {
+        sjtu::Checkpointer<std::string> reopened(dir);
+        auto loaded = reopened.Latest();
+        if (!loaded || loaded->first != latest->first || Compare(latest->second, loaded->second, 5000)) {
+            std::cout << "Test failed: reopened checkpoint does not match the store" << std::endl;
+            return 1;
+        }
+
+        // The loaded trie is known to be on disk, so changes on top of it are
+        // still incremental
+        auto trie = loaded->second.Put<std::string>("key7", "after reopen");
+        auto stats = reopened.Checkpoint(trie, loaded->first + 1);
+        if (stats.nodes_written == 0 || stats.nodes_written > 20) {
+            std::cout << "Test failed: checkpoint after reopen wrote " << stats.nodes_written << " nodes"
+                      << std::endl;
+            return 1;
+        }
+        latest->second = trie;
+    }
+    {
+        sjtu::Checkpointer<std::string> reopened(dir);
+        auto loaded = reopened.Latest();
+        if (!loaded || loaded->first != latest->first + 1 || Compare(latest->second, loaded->second, 5000) ||
+            *loaded->second.Get<std::string>("key7") != "after reopen") {
+            std::cout << "Test failed: second reopen does not match" << std::endl;
+            return 1;
+        }
+    }
+
+    // A failed checkpoint is cut off, and the nodes it wrote are not reused
+    {
+        sjtu::Trie good;
+        for (int i = 0; i < 100; i++) good = good.Put<std::string>("key" + std::to_string(i), "value");
+        sjtu::Checkpointer<std::string> checkpointer(dir + "/failed");
+        checkpointer.Checkpoint(good, 1);
+        const auto size = std::filesystem::file_size(checkpointer.NodesPath());
+        // The new "key200" nodes are written before "zz" throws
+        sjtu::Trie bad = good.Put<std::string>("key200", "new").Put<int>("zz", 1);
+        try {
+            checkpointer.Checkpoint(bad, 2);
+            std::cout << "Test failed: value of another type was checkpointed" << std::endl;
+            return 1;
+        } catch (const std::invalid_argument&) {
+        }
+        if (std::filesystem::file_size(checkpointer.NodesPath()) != size) {
+            std::cout << "Test failed: failed checkpoint left nodes behind" << std::endl;
+            return 1;
+        }
+        checkpointer.Checkpoint(bad.Remove("zz"), 2);
+    }
+    {
+        sjtu::Checkpointer<std::string> reopened(dir + "/failed");
+        auto loaded = reopened.Latest();
+        if (!loaded || loaded->first != 2 || !loaded->second.Get<std::string>("key200") ||
+            *loaded->second.Get<std::string>("key200") != "new" || !loaded->second.Get<std::string>("key99")) {
+            std::cout << "Test failed: checkpoint after a failed one does not match" << std::endl;
+            return 1;
+        }
+    }
+
+    // The first checkpoint in a fresh directory and checkpoints that only add
+    // keys leave nothing dead to compact
+    {
+        sjtu::CheckpointerOptions options;
+        options.compact_ratio = 2;
+        options.compact_min_bytes = 1;
+        sjtu::Checkpointer<std::string> checkpointer(dir + "/growing", options);
+        sjtu::Trie trie;
+        for (int i = 0; i < 1000; i++) trie = trie.Put<std::string>("key" + std::to_string(i), "value");
+        if (checkpointer.Checkpoint(trie, 1).compacted) {
+            std::cout << "Test failed: the first checkpoint was compacted" << std::endl;
+            return 1;
+        }
+        for (int round = 1; round < 4; round++) {
+            for (int i = 0; i < 1000 << round; i++)
+                trie = trie.Put<std::string>(std::to_string(round) + "/" + std::to_string(i), "value");
+            if (checkpointer.Checkpoint(trie, round + 1).compacted) {
+                std::cout << "Test failed: a growing store was compacted" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Overwrites leave dead nodes behind until the file is compacted, which
+    // keeps it within compact_ratio of the live nodes
+    {
+        sjtu::CheckpointerOptions options;
+        options.compact_ratio = 2;
+        options.compact_min_bytes = 1;
+        sjtu::Checkpointer<std::string> checkpointer(dir + "/compact", options);
+        sjtu::Trie trie;
+        for (int i = 0; i < 1000; i++) trie = trie.Put<std::string>("key" + std::to_string(i), "value");
+        checkpointer.Checkpoint(trie, 1);
+        const auto live = std::filesystem::file_size(checkpointer.NodesPath());
+        int compactions = 0;
+        for (int i = 0; i < 2000; i++) {
+            trie = trie.Put<std::string>("key" + std::to_string(i % 1000), "v" + std::to_string(i));
+            compactions += checkpointer.Checkpoint(trie, i + 2).compacted;
+            if (std::filesystem::file_size(checkpointer.NodesPath()) > live * 5 / 2) {
+                std::cout << "Test failed: the node file grew past the compaction ratio" << std::endl;
+                return 1;
+            }
+        }
+        auto files = std::distance(std::filesystem::directory_iterator(dir + "/compact"),
+                                   std::filesystem::directory_iterator());
+        if (compactions == 0 || files != 2) {
+            std::cout << "Test failed: compaction did not replace the node file" << std::endl;
+            return 1;
+        }
+        // Checkpoints after a compaction are still incremental
+        trie = trie.Put<std::string>("key1", "last");
+        auto stats = checkpointer.Checkpoint(trie, 3000);
+        if (stats.nodes_written == 0 || stats.nodes_written > 20) {
+            std::cout << "Test failed: checkpoint after compaction wrote " << stats.nodes_written << " nodes"
+                      << std::endl;
+            return 1;
+        }
+    }
+    {
+        sjtu::Checkpointer<std::string> reopened(dir + "/compact");
+        auto loaded = reopened.Latest();
+        if (!loaded || loaded->first != 3000 || *loaded->second.Get<std::string>("key1") != "last" ||
+            *loaded->second.Get<std::string>("key999") != "v1999") {
+            std::cout << "Test failed: compacted checkpoint does not match" << std::endl;
+            return 1;
+        }
+    }
+
+    // A subtree shared by two parents is written once and loaded once
+    {
+        sjtu::Trie shared;
+        for (int i = 0; i < 100; i++) shared = shared.Put<std::string>(std::to_string(i), "value");
+        auto trie = sjtu::Trie().Graft("a/", shared).Graft("b/", shared);
+        sjtu::Checkpointer<std::string> checkpointer(dir + "/shared");
+        checkpointer.Checkpoint(trie, 1);
+    }
+    {
+        sjtu::Checkpointer<std::string> reopened(dir + "/shared");
+        auto loaded = reopened.Latest();
+        if (!loaded || !loaded->second.Get<std::string>("b/99") ||
+            sjtu::TrieAccess::Root(loaded->second.SubTrie("a/")) !=
+                sjtu::TrieAccess::Root(loaded->second.SubTrie("b/"))) {
+            std::cout << "Test failed: a shared subtree was loaded twice" << std::endl;
+            return 1;
+        }
+    }
+
+    // A key far longer than the stack could recurse over is written and
+    // loaded
+    const std::string long_key(200000, 'k');
+    {
+        sjtu::Checkpointer<std::string> checkpointer(dir + "/long");
+        checkpointer.Checkpoint(sjtu::Trie().Put<std::string>(long_key, "deep").Put<std::string>("k", "short"), 1);
+    }
+    {
+        sjtu::Checkpointer<std::string> reopened(dir + "/long");
+        auto loaded = reopened.Latest();
+        if (!loaded || !loaded->second.Get<std::string>(long_key) ||
+            *loaded->second.Get<std::string>(long_key) != "deep" || !loaded->second.Get<std::string>("k")) {
+            std::cout << "Test failed: a long key did not round-trip" << std::endl;
+            return 1;
+        }
+    }
+
+    // An empty trie round-trips
+    {
+        sjtu::Checkpointer<std::string> empty(dir + "/empty");
+        empty.Checkpoint(sjtu::Trie(), 0);
+    }
+    {
+        sjtu::Checkpointer<std::string> empty(dir + "/empty");
+        if (!empty.Latest() || empty.Latest()->second.Get<std::string>("")) {
+            std::cout << "Test failed: empty checkpoint did not round-trip" << std::endl;
+            return 1;
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../trie/parallel.hpp"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using Change = std::tuple<std::string, const int*, const int*>;
+
+int main() {
+    std::mt19937 gen(58);
+    std::uniform_int_distribution<> dis(1, 100000);
+
+    // Two replicas diverge from a common base
+    sjtu::Trie base;
+    std::map<std::string, int> base_map;
+    for (int i = 0; i < 20000; i++) {
+        std::string key = "key" + std::to_string(dis(gen));
+        base = base.Put<int>(key, i);
+        base_map[key] = i;
+    }
+    sjtu::Trie left = base, right = base;
+    std::map<std::string, int> left_map = base_map, right_map = base_map;
+    for (int i = 0; i < 5000; i++) {
+        std::string key = "key" + std::to_string(dis(gen));
+        left = left.Put<int>(key, -i);
+        left_map[key] = -i;
+        key = "key" + std::to_string(dis(gen));
+        right = right.Put<int>(key, i + 100000);
+        right_map[key] = i + 100000;
+        key = "key" + std::to_string(dis(gen));
+        right = right.Remove(key);
+        right_map.erase(key);
+    }
+
+    // Sequential diff against the maps
+    std::vector<Change> changes;
+    sjtu::Trie::Diff<int>(base, right, [&](const std::string& key, const int* before, const int* after) {
+        changes.emplace_back(key, before, after);
+    });
+    size_t expected = 0;
+    for (const auto& [key, value] : base_map) expected += !right_map.count(key) || right_map[key] != value;
+    for (const auto& [key, value] : right_map) expected += !base_map.count(key);
+    if (changes.size() != expected) {
+        std::cout << "Test failed: diff reported " << changes.size() << " changes, expected " << expected << std::endl;
+        return 1;
+    }
+    for (const auto& [key, before, after] : changes) {
+        if (before != base.Get<int>(key) || after != right.Get<int>(key)) {
+            std::cout << "Test failed: diff reported wrong values for " << key << std::endl;
+            return 1;
+        }
+    }
+
+    // Parallel diff reports the same changes
+    sjtu::ThreadPool pool(4);
+    std::mutex lock;
+    std::vector<Change> parallel_changes;
+    sjtu::ParallelDiff<int>(base, right, [&](const std::string& key, const int* before, const int* after) {
+        std::lock_guard<std::mutex> guard(lock);
+        parallel_changes.emplace_back(key, before, after);
+    }, pool);
+    std::sort(parallel_changes.begin(), parallel_changes.end());
+    std::sort(changes.begin(), changes.end());
+    if (parallel_changes != changes) {
+        std::cout << "Test failed: parallel diff differs from the sequential diff" << std::endl;
+        return 1;
+    }
+
+    // Merge: right wins on conflicts
+    auto merged = sjtu::Trie::Merge(left, right);
+    auto parallel_merged = sjtu::ParallelMerge(left, right, pool);
+    std::map<std::string, int> merged_map = left_map;
+    for (const auto& [key, value] : right_map) merged_map[key] = value;
+    for (const auto& [key, value] : merged_map) {
+        if (merged.Get<int>(key) == nullptr || *merged.Get<int>(key) != value ||
+            parallel_merged.Get<int>(key) != merged.Get<int>(key)) {
+            std::cout << "Test failed: merge lost " << key << std::endl;
+            return 1;
+        }
+    }
+    size_t diff = 0;
+    sjtu::Trie::Diff<int>(merged, parallel_merged, [&](const std::string&, const int*, const int*) { diff++; });
+    if (diff != 0) {
+        std::cout << "Test failed: parallel merge differs from the sequential merge" << std::endl;
+        return 1;
+    }
+
+    // Identical tries share everything
+    if (!(sjtu::Trie::Merge(base, base) == base) || !(sjtu::ParallelMerge(base, sjtu::Trie(), pool) == base)) {
+        std::cout << "Test failed: merging shared tries copied nodes" << std::endl;
+        return 1;
+    }
+
+    // Changes come in key order, comparing bytes as unsigned
+    sjtu::Trie before = sjtu::Trie().Put<int>("k\x80", 1).Put<int>("kb", 1);
+    sjtu::Trie after = before.Remove("k\x80").Put<int>("k\xff", 2).Put<int>("ka", 2).Put<int>("kb", 2);
+    std::vector<std::string> keys;
+    sjtu::Trie::Diff<int>(before, after, [&](const std::string& key, const int*, const int*) { keys.push_back(key); });
+    if (keys != std::vector<std::string>{"ka", "kb", "k\x80", "k\xff"}) {
+        std::cout << "Test failed: diff of bytes above 0x7f is out of key order" << std::endl;
+        return 1;
+    }
+
+    // Keys far longer than the stack could recurse over are diffed and merged,
+    // sequentially and below the tasks of the parallel versions
+    {
+        const std::string long_key(200000, 'k');
+        auto a = sjtu::Trie().Put<int>(long_key, 1).Put<int>("k", 3).Put<int>("z", 1);
+        auto b = sjtu::Trie().Put<int>(long_key, 2).Put<int>(long_key + "x", 5).Put<int>("z", 2);
+        std::vector<std::string> deep;
+        sjtu::Trie::Diff<int>(a, b, [&](const std::string& key, const int*, const int*) { deep.push_back(key); });
+        std::vector<std::string> parallel_deep;
+        sjtu::ParallelDiff<int>(a, b, [&](const std::string& key, const int*, const int*) {
+            std::lock_guard<std::mutex> guard(lock);
+            parallel_deep.push_back(key);
+        }, pool);
+        std::sort(parallel_deep.begin(), parallel_deep.end());
+        if (deep != std::vector<std::string>{"k", long_key, long_key + "x", "z"} || parallel_deep != deep) {
+            std::cout << "Test failed: diff along a long key" << std::endl;
+            return 1;
+        }
+        for (const auto& whole : {sjtu::Trie::Merge(a, b), sjtu::ParallelMerge(a, b, pool)}) {
+            if (!whole.Get<int>(long_key) || *whole.Get<int>(long_key) != 2 || !whole.Get<int>(long_key + "x") ||
+                !whole.Get<int>("k") || *whole.Get<int>("z") != 2) {
+                std::cout << "Test failed: merge along a long key" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
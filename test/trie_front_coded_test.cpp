@@ -0,0 +1,112 @@
+#include "../trie/front_coded.hpp"
+#include "../trie/serialize.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+template <class Codec>
+int RoundTrip(const sjtu::Trie& trie, const std::vector<std::string>& keys, sjtu::FrontCodingOptions options) {
+    std::stringstream stream;
+    sjtu::ExportFrontCoded<std::string, Codec>(trie, stream, options);
+    const std::string image = stream.str();
+
+    sjtu::Trie imported = sjtu::ImportFrontCoded<std::string, Codec>(stream);
+    sjtu::FrontCodedReader<Codec> reader(image);
+    if (reader.Size() != keys.size()) {
+        std::cout << "Test failed: reader counts " << reader.Size() << " keys" << std::endl;
+        return 1;
+    }
+    for (const auto& key : keys) {
+        const std::string* expected = trie.Get<std::string>(key);
+        const std::string* actual = imported.Get<std::string>(key);
+        auto read = reader.Get(key);
+        if (!actual || *actual != *expected || !read || *read != *expected) {
+            std::cout << "Test failed: front-coded round trip differs at " << key << std::endl;
+            return 1;
+        }
+        if (reader.Get(key + "~") || reader.Get(key.substr(0, key.size() - 1) + "!")) {
+            std::cout << "Test failed: reader found a missing key near " << key << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    sjtu::Trie trie;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 5000; i++) {
+        char key[64];
+        snprintf(key, sizeof(key), "user/%08d/profile", i * 7);
+        keys.push_back(key);
+        trie = trie.Put<std::string>(key, "{\"name\":\"user" + std::to_string(i) + "\",\"active\":true}");
+    }
+    // Bytes above 0x7f sort after ASCII in std::string order
+    keys.push_back("\xc3\xa9t\xc3\xa9");
+    trie = trie.Put<std::string>(keys.back(), "summer");
+    keys.push_back("zz");
+    trie = trie.Put<std::string>(keys.back(), "");
+
+    sjtu::FrontCodingOptions options;
+    if (RoundTrip<sjtu::LzCompression>(trie, keys, options)) return 1;
+    options.block_bytes = 512;
+    options.restart_interval = 3;
+    if (RoundTrip<sjtu::NoCompression>(trie, keys, options)) return 1;
+    if (RoundTrip<sjtu::LzCompression>(trie, keys, options)) return 1;
+
+    // Front coding and compression beat the plain snapshot format
+    std::stringstream plain, compact;
+    sjtu::Serialize<std::string>(trie, plain);
+    sjtu::ExportFrontCoded<std::string>(trie, compact);
+    if (compact.str().size() * 2 > plain.str().size()) {
+        std::cout << "Test failed: front-coded export is " << compact.str().size() << " bytes, snapshot is "
+                  << plain.str().size() << std::endl;
+        return 1;
+    }
+
+    // Keys stream out in std::string order
+    std::vector<std::string> order;
+    sjtu::Trie small;
+    for (const char* key : {"b", "\x80", "a", "ab", "\xff"}) small = small.Put<std::string>(key, key);
+    std::string image;
+    sjtu::ExportFrontCoded<std::string, sjtu::NoCompression>(
+        small, [&image](const char* data, size_t size) { image.append(data, size); });
+    sjtu::FrontCodedReader<sjtu::NoCompression> reader(image);
+    for (const char* key : {"a", "ab", "b", "\x80", "\xff"}) {
+        if (reader.Get(key) != std::optional<std::string>(key)) {
+            std::cout << "Test failed: small export lost " << key << std::endl;
+            return 1;
+        }
+    }
+
+    // A key far longer than the stack could recurse over round-trips
+    const std::string long_key(200000, 'k');
+    if (RoundTrip<sjtu::NoCompression>(sjtu::Trie().Put<std::string>(long_key, "deep").Put<std::string>("k", "short"),
+                                       {"k", long_key}, sjtu::FrontCodingOptions{}))
+        return 1;
+
+    // Empty tries, codec mismatches and truncated input
+    std::stringstream empty;
+    sjtu::ExportFrontCoded<std::string>(sjtu::Trie(), empty);
+    if (sjtu::FrontCodedReader<>(empty.str()).Get("a") ||
+        sjtu::ImportFrontCoded<std::string>(empty).Get<std::string>("a")) {
+        std::cout << "Test failed: empty export is not empty" << std::endl;
+        return 1;
+    }
+    try {
+        sjtu::FrontCodedReader<sjtu::NoCompression> wrong(compact.str());
+        std::cout << "Test failed: opened an image written with another codec" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        sjtu::ImportFrontCoded<std::string>(sjtu::StringSource(std::string_view(compact.str()).substr(0, 1000)));
+        std::cout << "Test failed: imported a truncated export" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "../trie/src.hpp"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+size_t EditDistance(const std::string& a, const std::string& b) {
+    std::vector<size_t> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) row[j] = j;
+    for (size_t i = 1; i <= a.size(); i++) {
+        size_t diag = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            size_t up = row[j];
+            row[j] = std::min({up + 1, row[j - 1] + 1, diag + (a[i - 1] == b[j - 1] ? 0 : 1)});
+            diag = up;
+        }
+    }
+    return row[b.size()];
+}
+
+int main() {
+    sjtu::Trie trie;
+    std::map<std::string, int> map;
+
+    std::mt19937 gen(20231017);
+    std::uniform_int_distribution<> len(1, 8);
+    std::uniform_int_distribution<> letter('a', 'e');
+
+    // Insert random short keys over a small alphabet so that many keys are
+    // within a few edits of each other
+    for (int i = 0; i < 5000; i++) {
+        std::string key;
+        for (int j = len(gen); j > 0; j--) key.push_back(static_cast<char>(letter(gen)));
+        trie = trie.Put<int>(key, i);
+        map[key] = i;
+    }
+    trie = trie.Put<std::string>("abcde", "wrong type");
+    map.erase("abcde");
+
+    // Compare against a brute-force scan over every key
+    for (int q = 0; q < 200; q++) {
+        std::string query;
+        for (int j = len(gen); j > 0; j--) query.push_back(static_cast<char>(letter(gen)));
+        size_t max_edits = q % 3;
+
+        std::map<std::string, size_t> expected;
+        for (const auto& pair : map) {
+            size_t d = EditDistance(pair.first, query);
+            if (d <= max_edits) expected[pair.first] = d;
+        }
+
+        std::map<std::string, size_t> found;
+        bool ordered = true;
+        std::string last;
+        trie.FuzzySearch<int>(query, max_edits, [&](const std::string& key, const int& value, size_t distance) {
+            if (!found.empty() && key <= last) ordered = false;
+            last = key;
+            if (map[key] != value) {
+                std::cout << "Test failed: " << key << " returned a wrong value" << std::endl;
+                exit(1);
+            }
+            found[key] = distance;
+        });
+
+        if (!ordered) {
+            std::cout << "Test failed: results for " << query << " are not in key order" << std::endl;
+            return 1;
+        }
+        if (found != expected) {
+            std::cout << "Test failed: query " << query << " with " << max_edits
+                      << " edits returned " << found.size() << " keys, expected " << expected.size() << std::endl;
+            return 1;
+        }
+    }
+
+    // An exact query only finds the key itself
+    size_t hits = 0;
+    trie.FuzzySearch<int>(map.begin()->first, 0, [&](const std::string&, const int&, size_t) { hits++; });
+    if (hits != 1) {
+        std::cout << "Test failed: exact query returned " << hits << " keys" << std::endl;
+        return 1;
+    }
+
+    // Key order compares bytes as unsigned, as std::string does
+    sjtu::Trie bytes = sjtu::Trie().Put<int>("a\xff", 1).Put<int>("a\x01", 2).Put<int>("a\x80", 3);
+    std::vector<std::string> keys;
+    bytes.FuzzySearch<int>("a", 1, [&](const std::string& key, const int&, size_t) { keys.push_back(key); });
+    if (keys != std::vector<std::string>{"a\x01", "a\x80", "a\xff"}) {
+        std::cout << "Test failed: bytes above 0x7f are out of key order" << std::endl;
+        return 1;
+    }
+
+    // A key far longer than the stack could recurse over is reached when the
+    // edit budget covers it
+    const std::string long_key(200000, 'k');
+    auto deep = sjtu::Trie().Put<int>(long_key, 1).Put<int>("k", 2);
+    std::vector<std::pair<std::string, size_t>> distances;
+    deep.FuzzySearch<int>("", long_key.size(), [&](const std::string& key, const int&, size_t distance) {
+        distances.emplace_back(key, distance);
+    });
+    if (distances != std::vector<std::pair<std::string, size_t>>{{"k", 1}, {long_key, long_key.size()}}) {
+        std::cout << "Test failed: fuzzy search along a long key" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,272 @@
+#include "../trie/log_store.hpp"
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+std::string Key(int i) { return "key" + std::to_string(i); }
+
+// `expected` mirrors every commit made through the logged store, so that it
+// outlives the log's TrieStore.
+int Compare(sjtu::TrieStore& expected, sjtu::LogStore<std::string>& log, size_t from, size_t to, int keys) {
+    for (size_t version = from; version <= to; version += std::max<size_t>(1, (to - from) / 20)) {
+        for (int i = 0; i < keys; i++) {
+            auto a = expected.Get<std::string>(Key(i), version);
+            auto b = log.Get(Key(i), version);
+            if (a.has_value() != b.has_value() || (a && **a != *b)) {
+                std::cout << "Test failed: log differs at " << Key(i) << " in version " << version << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void Workload(sjtu::TrieStore& store, sjtu::TrieStore& mirror, int from, int to) {
+    for (int i = from; i < to; i++) {
+        store.Put<std::string>(Key(i % 500), "value" + std::to_string(i));
+        mirror.Put<std::string>(Key(i % 500), "value" + std::to_string(i));
+        if (i % 9 == 0) {
+            store.Remove(Key(i % 300));
+            mirror.Remove(Key(i % 300));
+        }
+    }
+}
+
+int main() {
+    std::string dir = "/tmp/trie_log_store_test." + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+
+    sjtu::LogStoreOptions options;
+    options.segment_bytes = 16 << 10;
+    options.cache_nodes = 64;
+    sjtu::TrieStore mirror;
+    size_t history_bytes = 0;
+    {
+        sjtu::TrieStore store;
+        auto log = std::make_shared<sjtu::LogStore<std::string>>(dir, options);
+        store.AddListener(log);
+        Workload(store, mirror, 0, 2000);
+        store.RemovePrefix("key1");
+        mirror.RemovePrefix("key1");
+        if (Compare(mirror, *log, 1, mirror.get_version(), 500)) return 1;
+
+        // Each commit appends only its path: at most one node per key byte
+        // plus the root
+        if (log->NodesWritten() > mirror.get_version() * (Key(499).size() + 1)) {
+            std::cout << "Test failed: commits wrote " << log->NodesWritten() << " nodes" << std::endl;
+            return 1;
+        }
+        if (log->SegmentCount() < 3) {
+            std::cout << "Test failed: the log was not split into segments" << std::endl;
+            return 1;
+        }
+    }
+
+    // Reopen, restart a store from the newest version and keep committing
+    {
+        auto log = std::make_shared<sjtu::LogStore<std::string>>(dir, options);
+        if (log->NewestVersion() != mirror.get_version() || log->OldestVersion() != size_t{1} ||
+            Compare(mirror, *log, 1, mirror.get_version(), 500))
+            return 1;
+        auto newest = log->Load();
+        sjtu::TrieStore store;
+        store.Restore(newest->second, newest->first);
+        store.AddListener(log);
+        size_t before = log->NodesWritten();
+        Workload(store, mirror, 2000, 2100);
+        if (log->NodesWritten() - before > 100 * (Key(499).size() + 1) * 2) {
+            std::cout << "Test failed: commits after Load rewrote the trie" << std::endl;
+            return 1;
+        }
+
+        // Compaction without retention keeps every version in two segments
+        log->Compact();
+        if (log->SegmentCount() != 2 || log->OldestVersion() != size_t{1} ||
+            Compare(mirror, *log, 1, mirror.get_version(), 500)) {
+            std::cout << "Test failed: compaction lost versions" << std::endl;
+            return 1;
+        }
+        Workload(store, mirror, 2100, 2200);
+        if (Compare(mirror, *log, mirror.get_version() - 100, mirror.get_version(), 500)) return 1;
+        history_bytes = log->DiskBytes();
+    }
+
+    // Background compaction with retention drops the old history, while writers and readers run
+    options.retain_versions = 50;
+    options.compact_interval = std::chrono::milliseconds(1);
+    options.compact_segments = 2;
+    {
+        auto log = std::make_shared<sjtu::LogStore<std::string>>(dir, options);
+        auto newest = log->Load();
+        sjtu::TrieStore store;
+        store.Restore(newest->second, newest->first);
+        store.AddListener(log);
+        std::atomic<bool> done{false};
+        std::atomic<int> errors{0};
+        std::thread reader([&] {
+            while (!done) {
+                auto version = log->NewestVersion();
+                auto value = log->Get(Key(7), *version);
+                auto expected = mirror.Get<std::string>(Key(7), *version);
+                // A version may be dropped by retention between the calls
+                if (expected && value && *value != **expected) errors++;
+                if (expected && !value && *log->OldestVersion() <= *version) errors++;
+            }
+        });
+        Workload(store, mirror, 2200, 5000);
+        done = true;
+        reader.join();
+        if (errors) {
+            std::cout << "Test failed: reads during compaction returned stale values" << std::endl;
+            return 1;
+        }
+        log->Compact();
+        if (log->DiskBytes() * 4 >= history_bytes || log->OldestVersion() != mirror.get_version() - 49 ||
+            log->Get(Key(7), mirror.get_version() - 50) ||
+            Compare(mirror, *log, mirror.get_version() - 49, mirror.get_version(), 500)) {
+            std::cout << "Test failed: compaction did not keep exactly the retained versions" << std::endl;
+            return 1;
+        }
+    }
+    {
+        sjtu::LogStore<std::string> log(dir, options);
+        if (log.NewestVersion() != mirror.get_version() ||
+            Compare(mirror, log, mirror.get_version() - 49, mirror.get_version(), 500))
+            return 1;
+    }
+
+    // Writing straight to the log, through a cache much smaller than the data
+    {
+        sjtu::LogStoreOptions direct;
+        direct.segment_bytes = 16 << 10;
+        direct.cache_nodes = 16;
+        sjtu::TrieStore expected;
+        {
+            sjtu::LogStore<std::string> log(dir + "/direct", direct);
+            for (int i = 0; i < 3000; i++) {
+                size_t version = log.Put(Key(i % 700), "value" + std::to_string(i));
+                expected.Put<std::string>(Key(i % 700), "value" + std::to_string(i));
+                if (i % 7 == 0 && log.Remove(Key(i % 400)) != expected.Remove(Key(i % 400))) version = 0;
+                if (version == 0 || log.NewestVersion() != expected.get_version()) {
+                    std::cout << "Test failed: direct writes numbered versions wrongly" << std::endl;
+                    return 1;
+                }
+            }
+            if (log.NodesWritten() > 3500 * (Key(699).size() + 1)) {
+                std::cout << "Test failed: direct writes wrote " << log.NodesWritten() << " nodes" << std::endl;
+                return 1;
+            }
+            if (Compare(expected, log, 1, expected.get_version(), 700)) return 1;
+        }
+        sjtu::LogStore<std::string> log(dir + "/direct", direct);
+        log.Compact();
+        if (Compare(expected, log, 1, expected.get_version(), 700)) return 1;
+        for (int i = 0; i < 700; i++) log.Remove(Key(i));
+        if (log.Load()->second.Get<std::string>(Key(1)) || log.Get(Key(699))) {
+            std::cout << "Test failed: removing every key left some behind" << std::endl;
+            return 1;
+        }
+    }
+
+    // A key far longer than the stack could recurse over is committed,
+    // compacted and loaded
+    {
+        const std::string long_key(200000, 'k');
+        sjtu::TrieStore store;
+        auto log = std::make_shared<sjtu::LogStore<std::string>>(dir + "/long");
+        store.AddListener(log);
+        store.Put<std::string>(long_key, "deep");
+        store.Put<std::string>("k", "short");
+        log->Compact();
+        auto loaded = log->Load();
+        if (log->Get(long_key) != "deep" || !loaded || !loaded->second.Get<std::string>(long_key) ||
+            *loaded->second.Get<std::string>(long_key) != "deep" || !loaded->second.Get<std::string>("k")) {
+            std::cout << "Test failed: a long key did not round-trip" << std::endl;
+            return 1;
+        }
+    }
+
+    // A log takes commits in version order only, and is written either by a
+    // store or through Put and Remove, never both
+    {
+        auto log = std::make_shared<sjtu::LogStore<std::string>>(dir + "/order");
+        {
+            sjtu::TrieStore store;
+            store.AddListener(log);
+            store.Put<std::string>("a", "1");
+            store.Put<std::string>("b", "2");
+        }
+        sjtu::TrieStore fresh;
+        fresh.AddListener(log);
+        auto throws = [](auto write) {
+            try {
+                write();
+                return false;
+            } catch (const std::runtime_error&) {
+                return true;
+            }
+        };
+        if (!throws([&] { fresh.Put<std::string>("c", "3"); }) || !throws([&] { log->Put("d", "4"); }) ||
+            fresh.Get<std::string>("c") || log->NewestVersion() != size_t{2} || log->Get("c") || log->Get("d")) {
+            std::cout << "Test failed: a log took a commit out of order or a direct write" << std::endl;
+            return 1;
+        }
+
+        auto direct = std::make_shared<sjtu::LogStore<std::string>>(dir + "/order-direct");
+        direct->Put("a", "1");
+        sjtu::TrieStore store;
+        store.Restore(direct->Load()->second, 1);
+        store.AddListener(direct);
+        if (!throws([&] { store.Put<std::string>("b", "2"); }) || direct->NewestVersion() != size_t{1}) {
+            std::cout << "Test failed: a log written directly took a commit" << std::endl;
+            return 1;
+        }
+    }
+
+    // A commit whose write fails partway is cut off the segment, so later
+    // commits still land where their addresses say
+    {
+        sjtu::LogStore<std::string> log(dir + "/failed");
+        log.Put("a", "1");
+        log.Put("b", "2");
+        std::string segment;
+        for (const auto& entry : std::filesystem::directory_iterator(dir + "/failed")) segment = entry.path();
+        // Writes past the file size limit fail with EFBIG instead of killing
+        // the process
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit old;
+        getrlimit(RLIMIT_FSIZE, &old);
+        rlimit limited = old;
+        limited.rlim_cur = std::filesystem::file_size(segment) + 100;
+        setrlimit(RLIMIT_FSIZE, &limited);
+        bool threw = false;
+        try {
+            log.Put("c", std::string(1000, 'c'));
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        setrlimit(RLIMIT_FSIZE, &old);
+        if (!threw || log.Put("d", "4") != 3 || log.Get("d") != "4" || log.Get("c")) {
+            std::cout << "Test failed: a commit after a failed write was misplaced" << std::endl;
+            return 1;
+        }
+    }
+    {
+        sjtu::LogStore<std::string> log(dir + "/failed");
+        if (log.NewestVersion() != size_t{3} || log.Get("a") != "1" || log.Get("d") != "4" || log.Get("c")) {
+            std::cout << "Test failed: a failed write hid later commits on reopen" << std::endl;
+            return 1;
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
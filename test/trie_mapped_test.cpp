@@ -0,0 +1,155 @@
+#include "../trie/mapped_trie.hpp"
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+int main() {
+    sjtu::Trie trie;
+    std::map<std::string, std::string> map;
+    std::mt19937 gen(60);
+    std::uniform_int_distribution<> dis(1, 1000000);
+    for (int i = 0; i < 50000; i++) {
+        std::string key = "key" + std::to_string(dis(gen));
+        trie = trie.Put<std::string>(key, "value" + std::to_string(i));
+        map[key] = "value" + std::to_string(i);
+    }
+    for (std::string key : {"k", "ke", "\xe0x", "\x01", "key1"}) {
+        trie = trie.Put<std::string>(key, key + "!");
+        map[key] = key + "!";
+    }
+
+    std::string path = "/tmp/trie_mapped_test." + std::to_string(getpid());
+    sjtu::WriteMappedTrie<std::string>(trie, path);
+    {
+        auto mapped = sjtu::MappedTrie::Open(path);
+
+        // Point lookups
+        for (const auto& pair : map) {
+            auto value = mapped.Get(pair.first);
+            if (!value || *value != pair.second) {
+                std::cout << "Test failed: " << pair.first << " does not return " << pair.second << std::endl;
+                return 1;
+            }
+        }
+        if (mapped.Get("key") || mapped.Get("missing") || mapped.Get("")) {
+            std::cout << "Test failed: lookup of a missing key returned a value" << std::endl;
+            return 1;
+        }
+        if (mapped.GetAs<std::string>("k") != std::optional<std::string>("k!")) {
+            std::cout << "Test failed: GetAs did not decode the value" << std::endl;
+            return 1;
+        }
+
+        // Scan returns the keys with the prefix in std::string order
+        std::vector<std::string> scanned, expected;
+        mapped.Scan("key1", [&](const std::string& key, std::string_view value) {
+            if (value != map[key]) scanned.push_back("bad value");
+            scanned.push_back(key);
+            return true;
+        });
+        for (auto it = map.lower_bound("key1"); it != map.end() && it->first.compare(0, 4, "key1") == 0; ++it)
+            expected.push_back(it->first);
+        if (scanned != expected) {
+            std::cout << "Test failed: scan returned " << scanned.size() << " keys, expected " << expected.size()
+                      << std::endl;
+            return 1;
+        }
+        std::vector<std::string> everything;
+        mapped.Scan("", [&](const std::string& key, std::string_view) {
+            everything.push_back(key);
+            return everything.size() < 10;
+        });
+        if (everything.size() != 10 || everything.front() != "\x01" || everything[1] != "k") {
+            std::cout << "Test failed: full scan is not ordered or did not stop" << std::endl;
+            return 1;
+        }
+
+        // Longest prefix match
+        auto match = mapped.LongestPrefixMatch("key1zzz");
+        if (!match || match->first != "key1" || match->second != "key1!") {
+            std::cout << "Test failed: longest prefix of key1zzz" << std::endl;
+            return 1;
+        }
+        match = mapped.LongestPrefixMatch("kex");
+        if (!match || match->first != "ke" || match->second != "ke!") {
+            std::cout << "Test failed: longest prefix of kex" << std::endl;
+            return 1;
+        }
+        if (mapped.LongestPrefixMatch("zzz")) {
+            std::cout << "Test failed: longest prefix of zzz" << std::endl;
+            return 1;
+        }
+    }
+
+    // Integer values and an empty trie
+    sjtu::Trie numbers;
+    numbers = numbers.Put<int>("a", 1).Put<int>("ab", 2);
+    std::string image;
+    sjtu::WriteMappedImage<int>(numbers, [&](const char* data, size_t n) { image.append(data, n); });
+    auto view = sjtu::MappedTrie::View(image.data(), image.size());
+    if (view.GetAs<int>("ab") != 2 || view.NodeCount() != 3) {
+        std::cout << "Test failed: integer image" << std::endl;
+        return 1;
+    }
+
+    // A corrupt child offset is reported instead of followed
+    std::string corrupt = image;
+    uint64_t root;
+    std::memcpy(&root, corrupt.data() + corrupt.size() - 32, 8);
+    const uint64_t far = corrupt.size() * 2;
+    std::memcpy(&corrupt[root + 16], &far, 8);
+    try {
+        sjtu::MappedTrie::View(corrupt.data(), corrupt.size()).GetAs<int>("ab");
+        std::cout << "Test failed: corrupt image was read" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    // Rewriting the file leaves existing mappings on the old image
+    sjtu::WriteMappedTrie<int>(numbers, path);
+    auto old = sjtu::MappedTrie::Open(path);
+    sjtu::WriteMappedTrie<int>(sjtu::Trie().Put<int>("a", 7), path);
+    if (old.GetAs<int>("ab") != 2 || sjtu::MappedTrie::Open(path).GetAs<int>("a") != 7) {
+        std::cout << "Test failed: rewriting disturbed a mapped image" << std::endl;
+        return 1;
+    }
+
+    sjtu::WriteMappedTrie<int>(sjtu::Trie(), path);
+    if (sjtu::MappedTrie::Open(path).Get("a")) {
+        std::cout << "Test failed: empty image returned a value" << std::endl;
+        return 1;
+    }
+
+    // A key far longer than the stack could recurse over is written, read
+    // and scanned
+    {
+        const std::string long_key(200000, 'k');
+        auto deep = sjtu::Trie().Put<std::string>(long_key, "deep").Put<std::string>("k", "short");
+        sjtu::WriteMappedTrie<std::string>(deep, path);
+        auto mapped = sjtu::MappedTrie::Open(path);
+        if (mapped.Get(long_key) != std::optional<std::string_view>("deep") || mapped.Get(long_key.substr(1)) ||
+            mapped.NodeCount() != long_key.size() + 1) {
+            std::cout << "Test failed: a long key did not round-trip" << std::endl;
+            return 1;
+        }
+        std::vector<std::string> keys;
+        mapped.Scan("", [&](const std::string& key, std::string_view) {
+            keys.push_back(key);
+            return true;
+        });
+        if (keys != std::vector<std::string>{"k", long_key}) {
+            std::cout << "Test failed: scan over a long key" << std::endl;
+            return 1;
+        }
+    }
+
+    std::remove(path.c_str());
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
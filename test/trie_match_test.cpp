@@ -0,0 +1,133 @@
+#include "../trie/src.hpp"
+#include <chrono>
+#include <iostream>
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+int Check(const sjtu::Trie& trie, const std::set<std::string>& keys, const sjtu::Pattern& pattern,
+          const std::regex& reference, const std::string& text) {
+    std::vector<std::string> expected;
+    for (const auto& key : keys) {
+        if (std::regex_match(key, reference)) expected.push_back(key);
+    }
+    std::vector<std::string> found;
+    for (const auto& [key, value] : trie.Match<std::string>(pattern)) {
+        if (*value != "v" + key) {
+            std::cout << "Test failed: " << key << " returned a wrong value" << std::endl;
+            return 1;
+        }
+        found.push_back(key);
+    }
+    if (found != expected) {
+        std::cout << "Test failed: pattern " << text << " returned " << found.size() << " keys, expected "
+                  << expected.size() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    sjtu::Trie trie;
+    std::set<std::string> keys;
+    const char* segments[] = {"alice", "bob", "carol", "dave"};
+    const char* kinds[] = {"session", "profile", "sessions", "cart"};
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            for (int n = 0; n < 10; n++) {
+                std::string key = std::string("user:") + segments[i] + std::to_string(n) + ":" + kinds[j];
+                trie = trie.Put<std::string>(key, "v" + key);
+                keys.insert(key);
+            }
+        }
+    }
+    for (int n = 0; n < 50; n++) {
+        std::string key = "order:" + std::to_string(n * 7);
+        trie = trie.Put<std::string>(key, "v" + key);
+        keys.insert(key);
+    }
+    trie = trie.Put<int>("user:eve:session", 1);
+
+    int failed = 0;
+    failed |= Check(trie, keys, sjtu::Pattern::Glob("user:*:session"), std::regex("user:.*:session"), "user:*:session");
+    failed |= Check(trie, keys, sjtu::Pattern::Glob("user:?ob[0-4]:*"), std::regex("user:.ob[0-4]:.*"), "user:?ob[0-4]:*");
+    failed |= Check(trie, keys, sjtu::Pattern::Glob("order:[!1]*"), std::regex("order:[^1].*"), "order:[!1]*");
+    failed |= Check(trie, keys, sjtu::Pattern::Glob("*"), std::regex(".*"), "*");
+    failed |= Check(trie, keys, sjtu::Pattern::Glob("nothing*"), std::regex("nothing.*"), "nothing*");
+    failed |= Check(trie, keys, sjtu::Pattern::Regex("^user:(alice|dave)[0-9]:(session|cart)$"),
+                    std::regex("user:(alice|dave)[0-9]:(session|cart)"), "alternation");
+    failed |= Check(trie, keys, sjtu::Pattern::Regex("order:(1|2)?[0-9]+"), std::regex("order:(1|2)?[0-9]+"),
+                    "repetition");
+    failed |= Check(trie, keys, sjtu::Pattern::Regex("user:c.*s+ion"), std::regex("user:c.*s+ion"), "plus");
+
+    // The glob convenience overload compiles the pattern as a glob
+    if (trie.Match<std::string>("order:7").size() != 1) {
+        std::cout << "Test failed: literal glob did not find order:7" << std::endl;
+        failed = 1;
+    }
+    // Type mismatched values are skipped
+    if (trie.Match<int>("user:*:session").size() != 1) {
+        std::cout << "Test failed: int pattern match did not return user:eve:session" << std::endl;
+        failed = 1;
+    }
+
+    // Key order compares bytes as unsigned, whether the node is scanned or
+    // its live bytes are looked up
+    sjtu::Trie bytes;
+    for (const char* key : {"x\xff", "x\x01", "xa", "x\x80", "x\x02"}) bytes = bytes.Put<int>(key, 0);
+    auto keys_of = [](const std::vector<std::pair<std::string, const int*>>& matches) {
+        std::vector<std::string> result;
+        for (const auto& match : matches) result.push_back(match.first);
+        return result;
+    };
+    if (keys_of(bytes.Match<int>("x?")) != std::vector<std::string>{"x\x01", "x\x02", "xa", "x\x80", "x\xff"} ||
+        keys_of(bytes.Match<int>(sjtu::Pattern::Regex("x(\xff|\x01|\x80)"))) !=
+            std::vector<std::string>{"x\x01", "x\x80", "x\xff"}) {
+        std::cout << "Test failed: bytes above 0x7f are out of key order" << std::endl;
+        failed = 1;
+    }
+
+    try {
+        sjtu::Pattern::Regex("(unclosed");
+        std::cout << "Test failed: malformed regex was accepted" << std::endl;
+        failed = 1;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // A key far longer than the stack could recurse over is matched
+    const std::string long_key(200000, 'k');
+    auto deep = sjtu::Trie().Put<int>(long_key, 1).Put<int>(long_key + "x", 2).Put<int>("k", 3);
+    if (keys_of(deep.Match<int>("k*")) != std::vector<std::string>{"k", long_key, long_key + "x"} ||
+        keys_of(deep.Match<int>("*x")) != std::vector<std::string>{long_key + "x"}) {
+        std::cout << "Test failed: match along a long key" << std::endl;
+        failed = 1;
+    }
+
+    // A pattern whose DFA would blow up is rejected quickly, while one below
+    // the limit still compiles
+    auto rejected = [](auto compile) {
+        try {
+            compile();
+            return false;
+        } catch (const std::invalid_argument&) {
+            return true;
+        }
+    };
+    auto started = std::chrono::steady_clock::now();
+    if (!rejected([] { sjtu::Pattern::Glob("*a??????????????"); }) ||
+        !rejected([] { sjtu::Pattern::Regex(".*a" + std::string(16, '.')); }) ||
+        std::chrono::steady_clock::now() - started > std::chrono::seconds(2)) {
+        std::cout << "Test failed: a pattern with too many DFA states was not rejected quickly" << std::endl;
+        failed = 1;
+    }
+    auto wide = sjtu::Pattern::Glob("*a????????");
+    if (!wide.Matches("xxa12345678") || wide.Matches("xxb12345678") || wide.Matches("a1234567")) {
+        std::cout << "Test failed: a pattern below the state limit" << std::endl;
+        failed = 1;
+    }
+
+    if (failed) return 1;
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
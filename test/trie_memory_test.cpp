@@ -0,0 +1,83 @@
+#include "../trie/memory.hpp"
+#include <iostream>
+#include <string>
+
+int main() {
+    using Counter = sjtu::MemoryCounter<std::string>;
+
+    if (sjtu::MeasureMemory<std::string>(sjtu::Trie()).Bytes() != 0) {
+        std::cout << "Test failed: empty trie uses memory" << std::endl;
+        return 1;
+    }
+
+    // "ab" and "ac": a root, "a", and two value nodes
+    sjtu::Trie trie;
+    trie = trie.Put<std::string>("ab", "short");
+    trie = trie.Put<std::string>("ac", std::string(100, 'x'));
+    auto usage = sjtu::MeasureMemory<std::string>(trie);
+    if (usage.nodes != 4 || usage.map_entries != 3 || usage.values != 2 || usage.control_blocks != 6) {
+        std::cout << "Test failed: wrong counts " << usage.nodes << " " << usage.map_entries << " "
+                  << usage.values << " " << usage.control_blocks << std::endl;
+        return 1;
+    }
+    size_t expected_values = 2 * sizeof(std::string) + 101;
+    size_t expected_nodes = 2 * sizeof(sjtu::TrieNode) + 2 * sizeof(sjtu::TrieNodeWithValue<std::string>);
+    // Node control blocks are estimated as separate blocks, value ones as
+    // sharing the value's allocation
+    size_t expected_control = 4 * Counter::kControlBlockBytes + 2 * Counter::kInplaceControlBlockBytes;
+    if (usage.value_bytes != expected_values || usage.node_bytes != expected_nodes ||
+        usage.map_bytes != 3 * Counter::kMapEntryBytes || usage.control_block_bytes != expected_control ||
+        usage.Bytes() != expected_values + expected_nodes + 3 * Counter::kMapEntryBytes + expected_control) {
+        std::cout << "Test failed: wrong byte counts" << std::endl;
+        return 1;
+    }
+    // 4 nodes, 4 separate control blocks, 3 map entries, 2 values and the
+    // long value's buffer
+    if (usage.allocations != 14) {
+        std::cout << "Test failed: counted " << usage.allocations << " allocations" << std::endl;
+        return 1;
+    }
+
+    // The estimate does not depend on how the nodes were allocated
+    sjtu::TrieBuilder builder;
+    builder.Put<std::string>("ab", "short");
+    builder.Put<std::string>("ac", std::string(100, 'x'));
+    auto built = sjtu::MeasureMemory<std::string>(builder.Build());
+    if (built.control_blocks != 6 || built.control_block_bytes != expected_control || built.allocations != 14) {
+        std::cout << "Test failed: TrieBuilder nodes were estimated differently" << std::endl;
+        return 1;
+    }
+
+    // A new version costs only its copied path; shared values are not recounted
+    Counter counter;
+    counter.Add(trie);
+    auto next = trie.Put<std::string>("ad", "new");
+    auto added = counter.Add(next);
+    if (added.nodes != 3 || added.values != 1 || added.map_entries != 4) {
+        std::cout << "Test failed: version delta counted " << added.nodes << " nodes" << std::endl;
+        return 1;
+    }
+    if (counter.Add(next).Bytes() != 0 || counter.Add(trie).Bytes() != 0) {
+        std::cout << "Test failed: a trie was counted twice" << std::endl;
+        return 1;
+    }
+    auto removed = counter.Add(next.Remove("ab"));
+    if (removed.nodes == 0 || removed.nodes > 3 || removed.values != 0) {
+        std::cout << "Test failed: removal delta counted " << removed.nodes << " nodes" << std::endl;
+        return 1;
+    }
+    if (counter.Total().nodes != usage.nodes + added.nodes + removed.nodes) {
+        std::cout << "Test failed: total does not add up" << std::endl;
+        return 1;
+    }
+
+    // Values of another type are plain nodes
+    auto mixed = sjtu::MeasureMemory<std::string>(sjtu::Trie().Put<int>("k", 1));
+    if (mixed.nodes != 2 || mixed.values != 0) {
+        std::cout << "Test failed: foreign value counted" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "../trie/parallel.hpp"
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+int main() {
+    std::mt19937 gen(56);
+    std::uniform_int_distribution<> dis(1, 200000);
+
+    // Keys share a long common prefix, so partitioning has to look past it
+    std::vector<std::pair<std::string, std::string>> input;
+    std::unordered_map<std::string, std::string> map;
+    for (int i = 0; i < 300000; i++) {
+        std::string key = "user:" + std::to_string(dis(gen));
+        if (i % 10 == 0) key = std::to_string(dis(gen));
+        std::string value = "value" + std::to_string(i);
+        input.emplace_back(key, value);
+        map[key] = value;
+    }
+    input.emplace_back("", "root");
+    input.emplace_back("user:", "prefix");
+    map["user:"] = "prefix";
+    input.emplace_back("user:1", "one");
+    map["user:1"] = "one";
+
+    auto trie = sjtu::ParallelBuild<std::string>(input, 4);
+    for (const auto& pair : map) {
+        if (trie.Get<std::string>(pair.first) == nullptr || *trie.Get<std::string>(pair.first) != pair.second) {
+            std::cout << "Test failed: " << pair.first << " does not return " << pair.second << std::endl;
+            return 1;
+        }
+    }
+    if (trie.Get<std::string>("") == nullptr || *trie.Get<std::string>("") != "root") {
+        std::cout << "Test failed: the empty key was not built" << std::endl;
+        return 1;
+    }
+
+    // The built trie behaves like any other
+    auto updated = trie.Put<std::string>("user:1", "updated").Remove("user:");
+    if (*updated.Get<std::string>("user:1") != "updated" || updated.Get<std::string>("user:") != nullptr ||
+        *trie.Get<std::string>("user:") != "prefix") {
+        std::cout << "Test failed: updating the built trie" << std::endl;
+        return 1;
+    }
+
+    // Non-copyable values are moved out of the input
+    std::vector<std::pair<std::string, std::unique_ptr<int>>> owned;
+    for (int i = 0; i < 10000; i++) owned.emplace_back("k" + std::to_string(i), std::make_unique<int>(i));
+    auto unique = sjtu::ParallelBuild<std::unique_ptr<int>>(std::move(owned), 2);
+    for (int i = 0; i < 10000; i++) {
+        if (**unique.Get<std::unique_ptr<int>>("k" + std::to_string(i)) != i) {
+            std::cout << "Test failed: k" << i << " does not return " << i << std::endl;
+            return 1;
+        }
+    }
+
+    // Keys sharing a long prefix do not recurse once per shared byte
+    {
+        const std::string prefix(2000, 'p');
+        std::vector<std::pair<std::string, int>> input;
+        for (int i = 0; i < 10000; i++) input.emplace_back(prefix + std::to_string(i), i);
+        auto deep = sjtu::ParallelBuild<int>(std::move(input), 4);
+        if (!deep.Get<int>(prefix + "9999") || *deep.Get<int>(prefix + "9999") != 9999 || deep.Get<int>(prefix)) {
+            std::cout << "Test failed: long shared prefix" << std::endl;
+            return 1;
+        }
+    }
+
+    // A builder started from a trie leaves that trie untouched
+    sjtu::TrieBuilder builder(trie);
+    builder.Put<std::string>("user:1", "builder");
+    builder.Put<std::string>("new", "key");
+    builder.Remove("user:");
+    auto built = builder.Build();
+    if (*built.Get<std::string>("user:1") != "builder" || *built.Get<std::string>("new") != "key" ||
+        built.Get<std::string>("user:") != nullptr) {
+        std::cout << "Test failed: builder did not apply its updates" << std::endl;
+        return 1;
+    }
+    if (*trie.Get<std::string>("user:1") != "one" || trie.Get<std::string>("new") != nullptr ||
+        *trie.Get<std::string>("user:") != "prefix") {
+        std::cout << "Test failed: builder modified its base trie" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
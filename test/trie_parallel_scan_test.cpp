@@ -0,0 +1,82 @@
+#include "../trie/parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+int main() {
+    std::mt19937 gen(57);
+    std::uniform_int_distribution<> dis(1, 1000000);
+
+    std::vector<std::pair<std::string, int>> input;
+    // Some keys carry bytes above 0x7f, which key order puts after the digits
+    for (int i = 0; i < 200000; i++)
+        input.emplace_back(std::string(i % 10 ? "key" : "key\xe9") + std::to_string(dis(gen)), i);
+    auto trie = sjtu::ParallelBuild<int>(input, 2);
+    trie = trie.Put<std::string>("key-string", "not an int");
+
+    // Keys in the order of a sequential traversal
+    std::vector<std::string> expected;
+    long long expected_sum = 0;
+    for (const auto& [key, value] : trie.Match<int>("*")) {
+        expected.push_back(key);
+        expected_sum += *value;
+    }
+    if (!std::is_sorted(expected.begin(), expected.end())) {
+        std::cout << "Test failed: Match is not in key order" << std::endl;
+        return 1;
+    }
+
+    sjtu::ThreadPool pool(4);
+
+    // Unordered for-each
+    std::atomic<long long> sum{0};
+    std::atomic<size_t> count{0};
+    sjtu::ParallelForEach<int>(trie, [&](const std::string&, const int& value) {
+        sum += value;
+        count++;
+    }, pool);
+    if (count != expected.size() || sum != expected_sum) {
+        std::cout << "Test failed: for-each visited " << count << " keys, expected " << expected.size() << std::endl;
+        return 1;
+    }
+
+    // Ordered for-each
+    std::vector<std::string> ordered;
+    sjtu::ParallelForEach<int>(trie, [&](const std::string& key, const int&) { ordered.push_back(key); }, pool, true);
+    if (ordered != expected) {
+        std::cout << "Test failed: ordered for-each is not in key order" << std::endl;
+        return 1;
+    }
+
+    // Reduce with a commutative combine
+    long long total = sjtu::ParallelReduce<int>(
+        trie, 0LL, [](long long& acc, const std::string&, const int& value) { acc += value; },
+        [](long long a, long long b) { return a + b; }, pool);
+    if (total != expected_sum) {
+        std::cout << "Test failed: reduce returned " << total << ", expected " << expected_sum << std::endl;
+        return 1;
+    }
+
+    // Reduce with an order-sensitive combine
+    std::string joined = sjtu::ParallelReduce<int>(
+        trie, std::string(), [](std::string& acc, const std::string& key, const int&) { acc += key + ","; },
+        [](std::string a, const std::string& b) { return a + b; }, 3);
+    std::string expected_joined;
+    for (const auto& key : expected) expected_joined += key + ",";
+    if (joined != expected_joined) {
+        std::cout << "Test failed: ordered reduce is not in key order" << std::endl;
+        return 1;
+    }
+
+    if (sjtu::ParallelReduce<int>(sjtu::Trie(), 7, [](int&, const std::string&, const int&) {},
+                                  [](int a, int b) { return a + b; }, pool) != 7) {
+        std::cout << "Test failed: reduce of an empty trie" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "../trie/recovery.hpp"
+#include <unistd.h>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+std::string Key(int i) { return std::string(1, static_cast<char>('a' + i % 26)) + std::to_string(i); }
+
+int Compare(sjtu::TrieStore& expected, sjtu::TrieStore& actual, int keys) {
+    if (expected.get_version() != actual.get_version()) {
+        std::cout << "Test failed: recovered version " << actual.get_version() << ", expected "
+                  << expected.get_version() << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < keys; i++) {
+        auto a = expected.Get<std::string>(Key(i));
+        auto b = actual.Get<std::string>(Key(i));
+        if (a.has_value() != b.has_value() || (a && **a != **b)) {
+            std::cout << "Test failed: recovered store differs at " << Key(i) << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void Workload(sjtu::TrieStore& store, int from, int to) {
+    for (int i = from; i < to; i++) {
+        store.Put<std::string>(Key(i), "value" + std::to_string(i));
+        if (i % 7 == 0) store.Put<std::string>(Key(i / 2), "again" + std::to_string(i));
+        if (i % 11 == 0) store.Remove(Key(i / 3));
+        if (i % 500 == 0) store.RemovePrefix(Key(i / 5).substr(0, 3));
+        if (i % 700 == 0) store.RemoveRange("c", "e");
+        if (i % 900 == 0) store.RemoveRange("m1", "m3");
+    }
+}
+
+int main() {
+    std::string dir = "/tmp/trie_recovery_test." + std::to_string(getpid());
+    std::string wal_dir = dir + "/wal", checkpoint_dir = dir + "/checkpoint";
+    std::filesystem::remove_all(dir);
+
+    sjtu::TrieStore store;
+    {
+        auto wal = std::make_shared<sjtu::WriteAheadLog<std::string>>(
+            wal_dir, sjtu::WalOptions{sjtu::WalSyncMode::kInterval, std::chrono::milliseconds(5), 16 << 10});
+        store.AddListener(wal);
+        Workload(store, 0, 3000);
+        sjtu::Checkpointer<std::string> checkpointer(checkpoint_dir);
+        checkpointer.Checkpoint(store);
+        Workload(store, 3000, 6000);
+        wal->Sync();
+    }
+
+    // Checkpoint plus log tail
+    sjtu::ThreadPool pool(4);
+    {
+        sjtu::TrieStore recovered;
+        sjtu::Checkpointer<std::string> checkpointer(checkpoint_dir);
+        auto stats = sjtu::Recover<std::string>(recovered, checkpointer, wal_dir, pool);
+        if (stats.checkpoint_version == 0 || stats.version != store.get_version() ||
+            stats.records_replayed != stats.version - stats.checkpoint_version) {
+            std::cout << "Test failed: wrong recovery stats" << std::endl;
+            return 1;
+        }
+        if (Compare(store, recovered, 6000)) return 1;
+        if (recovered.Get<std::string>(Key(1), stats.version - 1) || !recovered.GetSnapshot(stats.version)) {
+            std::cout << "Test failed: recovered store kept the replayed versions" << std::endl;
+            return 1;
+        }
+        // New commits continue the numbering
+        size_t version = recovered.Put<std::string>("after", "recovery");
+        if (version != stats.version + 1 || **recovered.Get<std::string>("after") != "recovery") {
+            std::cout << "Test failed: commit after recovery got version " << version << std::endl;
+            return 1;
+        }
+    }
+
+    // The log alone, and the same result as replaying it commit by commit
+    {
+        sjtu::TrieStore recovered, replayed;
+        sjtu::Recover<std::string>(recovered, wal_dir, 2);
+        sjtu::WriteAheadLog<std::string>::Replay(wal_dir, replayed);
+        if (Compare(store, recovered, 6000) || Compare(replayed, recovered, 6000)) return 1;
+    }
+
+    // Segments the checkpoint covers are not read, so damage there does not
+    // cut the log, and trimming deletes them
+    {
+        sjtu::Checkpointer<std::string> checkpointer(checkpoint_dir);
+        const size_t checkpointed = checkpointer.Latest()->first;
+        const auto segments = sjtu::WalSegments(wal_dir);
+        std::filesystem::resize_file(segments.front(), 3);
+        sjtu::TrieStore recovered;
+        sjtu::Recover<std::string>(recovered, checkpointer, wal_dir, pool);
+        if (Compare(store, recovered, 6000)) return 1;
+        const size_t trimmed = sjtu::TrimWal(wal_dir, checkpointed);
+        const auto rest = sjtu::WalSegments(wal_dir);
+        if (trimmed == 0 || rest.size() + trimmed != segments.size() ||
+            sjtu::detail::SegmentFirstVersion(rest.front()) > checkpointed + 1) {
+            std::cout << "Test failed: trimming deleted " << trimmed << " of " << segments.size() << " segments"
+                      << std::endl;
+            return 1;
+        }
+        sjtu::TrieStore again;
+        auto stats = sjtu::Recover<std::string>(again, checkpointer, wal_dir, pool);
+        if (stats.records_replayed != stats.version - stats.checkpoint_version || Compare(store, again, 6000))
+            return 1;
+    }
+
+    // A log that does not reach back to the checkpoint cannot be replayed
+    std::filesystem::remove(sjtu::WalSegments(wal_dir).front());
+    try {
+        sjtu::TrieStore recovered;
+        sjtu::Recover<std::string>(recovered, wal_dir, pool);
+        std::cout << "Test failed: recovered across a gap in the log" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
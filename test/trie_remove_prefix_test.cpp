@@ -0,0 +1,151 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+
+int Compare(const sjtu::Trie& trie, const std::map<std::string, int>& map, const std::string& what) {
+    for (const auto& pair : map) {
+        if (trie.Get<int>(pair.first) == nullptr || *trie.Get<int>(pair.first) != pair.second) {
+            std::cout << "Test failed: " << what << " lost " << pair.first << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    sjtu::Trie trie;
+    std::map<std::string, int> map;
+    std::mt19937 gen(54);
+    std::uniform_int_distribution<> len(1, 6);
+    std::uniform_int_distribution<> letter(0, 5);
+    const char alphabet[] = {'a', 'b', 'c', 'd', '\x7f', '\xe0'};
+
+    std::vector<std::string> all;
+    for (int i = 0; i < 3000; i++) {
+        std::string key;
+        for (int j = len(gen); j > 0; j--) key.push_back(alphabet[letter(gen)]);
+        trie = trie.Put<int>(key, i);
+        map[key] = i;
+        all.push_back(key);
+    }
+
+    // RemovePrefix
+    for (int round = 0; round < 50; round++) {
+        std::string prefix = all[gen() % all.size()].substr(0, 1 + round % 3);
+        auto removed = trie.RemovePrefix(prefix);
+        auto expected = map;
+        for (auto it = expected.begin(); it != expected.end();) {
+            if (it->first.compare(0, prefix.size(), prefix) == 0) it = expected.erase(it);
+            else ++it;
+        }
+        if (Compare(removed, expected, "RemovePrefix")) return 1;
+        for (const auto& pair : map) {
+            if (!expected.count(pair.first) && removed.Get<int>(pair.first) != nullptr) {
+                std::cout << "Test failed: RemovePrefix(" << prefix << ") kept " << pair.first << std::endl;
+                return 1;
+            }
+        }
+    }
+    if (!(trie.RemovePrefix("zzz") == trie)) {
+        std::cout << "Test failed: RemovePrefix of a missing prefix copied the trie" << std::endl;
+        return 1;
+    }
+
+    // RemoveRange
+    for (int round = 0; round < 200; round++) {
+        std::string lo = all[gen() % all.size()].substr(0, 1 + round % 4);
+        std::string hi = all[gen() % all.size()].substr(0, 1 + round % 5);
+        if (hi < lo) std::swap(lo, hi);
+        auto removed = trie.RemoveRange(lo, hi);
+        auto expected = map;
+        expected.erase(expected.lower_bound(lo), expected.lower_bound(hi));
+        if (Compare(removed, expected, "RemoveRange")) return 1;
+        for (const auto& pair : map) {
+            if (!expected.count(pair.first) && removed.Get<int>(pair.first) != nullptr) {
+                std::cout << "Test failed: RemoveRange kept " << pair.first << std::endl;
+                return 1;
+            }
+        }
+        if (expected.size() == map.size() && !(removed == trie)) {
+            std::cout << "Test failed: empty RemoveRange copied the trie" << std::endl;
+            return 1;
+        }
+    }
+
+    // TrieStore publishes exactly one version per call
+    sjtu::TrieStore store;
+    for (int i = 0; i < 100; i++) {
+        store.Put<int>("tenant" + std::to_string(i % 4) + "/" + std::to_string(i), i);
+    }
+    size_t version = store.get_version();
+    if (store.RemovePrefix("tenant1/") != version + 1 || store.get_version() != version + 1) {
+        std::cout << "Test failed: RemovePrefix did not publish one version" << std::endl;
+        return 1;
+    }
+    if (store.RemovePrefix("tenant1/") != version + 1) {
+        std::cout << "Test failed: no-op RemovePrefix published a version" << std::endl;
+        return 1;
+    }
+    if (store.RemoveRange("tenant2/", "tenant3/") != version + 2) {
+        std::cout << "Test failed: RemoveRange did not publish one version" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < 100; i++) {
+        std::string key = "tenant" + std::to_string(i % 4) + "/" + std::to_string(i);
+        bool present = store.Get<int>(key).has_value();
+        if (present != (i % 4 == 0 || i % 4 == 3)) {
+            std::cout << "Test failed: store has wrong presence for " << key << std::endl;
+            return 1;
+        }
+        if (!store.Get<int>(key, version).has_value()) {
+            std::cout << "Test failed: old version lost " << key << std::endl;
+            return 1;
+        }
+    }
+
+    // Remove leaves a dead branch behind; cutting it removes no key
+    store.Put<int>("dead/x", 1);
+    store.Remove("dead/x");
+    size_t dead = store.get_version();
+    if (store.RemovePrefix("dead/") != dead || store.RemovePrefix("de") != dead ||
+        store.RemoveRange("c", "e") != dead || store.RemoveRange("tenant0/", "tenant1/") != dead + 1) {
+        std::cout << "Test failed: removing a dead branch published a version" << std::endl;
+        return 1;
+    }
+
+    // Keys far longer than the stack could recurse over are removed by range
+    // and by prefix
+    {
+        const std::string long_key(200000, 'k');
+        auto deep = sjtu::Trie().Put<int>(long_key, 1).Put<int>(long_key + "x", 2).Put<int>("k", 3);
+        auto cut = deep.RemoveRange(long_key + "a", long_key + "z");
+        auto dead = deep.Remove(long_key).Remove(long_key + "x");
+        if (!cut.Get<int>(long_key) || cut.Get<int>(long_key + "x") || !cut.Get<int>("k") ||
+            dead.RemoveRange("k\x01", "l").Get<int>("k") == nullptr || deep.RemovePrefix("kk").Get<int>(long_key) ||
+            sjtu::TrieAccess::Root(dead.RemoveRange("kk", "l")) != sjtu::TrieAccess::Root(dead)) {
+            std::cout << "Test failed: removing below a long key" << std::endl;
+            return 1;
+        }
+    }
+
+    // Retired tries and the history dropped by Restore are released by the
+    // background reclaimer
+    sjtu::Trie big;
+    for (int i = 0; i < 1000; i++) big = big.Put<int>("t/" + std::to_string(i), i);
+    std::weak_ptr<sjtu::TrieNode> detached = sjtu::TrieAccess::Root(big);
+    sjtu::Retire(std::exchange(big, big.RemovePrefix("t/")));
+    std::weak_ptr<sjtu::TrieNode> history = sjtu::TrieAccess::Root(store.GetSnapshot(version)->second);
+    store.Restore(store.GetSnapshot()->second, store.get_version());
+    sjtu::WaitRetired();
+    if (!detached.expired() || !history.expired() || big.Get<int>("t/1")) {
+        std::cout << "Test failed: retired tries were not released" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
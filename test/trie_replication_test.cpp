@@ -0,0 +1,140 @@
+#include "../trie/replication.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int Compare(sjtu::TrieStore& expected, sjtu::TrieStore& actual, int keys) {
+    if (expected.get_version() != actual.get_version()) {
+        std::cout << "Test failed: follower at version " << actual.get_version() << ", expected "
+                  << expected.get_version() << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        auto a = expected.Get<std::string>(key);
+        auto b = actual.Get<std::string>(key);
+        if (a.has_value() != b.has_value() || (a && **a != **b)) {
+            std::cout << "Test failed: follower differs at " << key << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Writers run while the leader starts, so commits race with the snapshot.
+int Replicate(std::unique_ptr<sjtu::ReplicationTransport> sender,
+              std::unique_ptr<sjtu::ReplicationTransport> receiver) {
+    sjtu::TrieStore leader_store;
+    for (int i = 0; i < 500; i++) leader_store.Put<std::string>("key" + std::to_string(i), "initial");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&leader_store, t] {
+            for (int i = 0; i < 300; i++) {
+                std::string key = "key" + std::to_string(i * 4 + t);
+                leader_store.Put<std::string>(key, "value" + std::to_string(i));
+                if (i % 7 == 0) leader_store.Remove("key" + std::to_string((i / 2) * 4 + t));
+            }
+        });
+    }
+    auto leader = sjtu::ReplicationLeader<std::string>::Start(leader_store, std::move(sender));
+    sjtu::TrieStore follower_store;
+    sjtu::ReplicationFollower<std::string> follower(follower_store, std::move(receiver));
+    for (auto& thread : threads) thread.join();
+    leader_store.RemovePrefix("key11");
+    leader_store.RemoveRange("key5", "key6");
+
+    if (!follower.WaitForVersion(leader_store.get_version(), std::chrono::seconds(10))) {
+        std::cout << "Test failed: follower did not catch up" << std::endl;
+        return 1;
+    }
+    if (Compare(leader_store, follower_store, 1200)) return 1;
+
+    // Stopping ends the stream, and later commits stay on the leader
+    leader->Stop();
+    leader->CheckError();
+    follower.Wait();
+    if (leader->SentVersion() != follower.AppliedVersion()) {
+        std::cout << "Test failed: sent and applied versions differ" << std::endl;
+        return 1;
+    }
+    leader_store.Put<std::string>("key0", "after stop");
+    if (follower_store.Get<std::string>("key0") && **follower_store.Get<std::string>("key0") == "after stop") {
+        std::cout << "Test failed: a commit after Stop was replicated" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    auto pipe = sjtu::FdTransport::Pipe();
+    if (Replicate(std::move(pipe.first), std::move(pipe.second))) return 1;
+
+    auto pair = sjtu::FdTransport::SocketPair();
+    if (Replicate(std::move(pair.first), std::move(pair.second))) return 1;
+
+    std::string path = "/tmp/trie_replication_test." + std::to_string(getpid()) + ".sock";
+    std::unique_ptr<sjtu::FdTransport> accepted;
+    std::thread listener([&] { accepted = sjtu::FdTransport::AcceptUnix(path); });
+    std::unique_ptr<sjtu::FdTransport> connected;
+    for (int attempt = 0; !connected; attempt++) {
+        try {
+            connected = sjtu::FdTransport::ConnectUnix(path);
+        } catch (const std::runtime_error&) {
+            if (attempt == 1000) throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    listener.join();
+    if (Replicate(std::move(accepted), std::move(connected))) return 1;
+
+    // A follower rejects a stream it cannot apply
+    auto broken = sjtu::FdTransport::Pipe();
+    broken.first->Send("?");
+    broken.first->Close();
+    sjtu::TrieStore store;
+    sjtu::ReplicationFollower<std::string> follower(store, std::move(broken.second));
+    try {
+        follower.Wait();
+        std::cout << "Test failed: unknown message was accepted" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    // A follower that stops reading is cut off instead of growing the
+    // leader's buffer, and the leader can be detached from the store
+    {
+        auto stalled = sjtu::FdTransport::SocketPair();
+        sjtu::TrieStore leader_store;
+        sjtu::ReplicationOptions options;
+        options.max_pending_bytes = 64 << 10;
+        auto leader = sjtu::ReplicationLeader<std::string>::Start(leader_store, std::move(stalled.first), options);
+        for (int i = 0; i < 2000; i++) leader_store.Put<std::string>("key" + std::to_string(i), std::string(1024, 'x'));
+        leader->Stop();
+        try {
+            leader->CheckError();
+            std::cout << "Test failed: a stalled follower was not cut off" << std::endl;
+            return 1;
+        } catch (const std::runtime_error&) {
+        }
+        leader_store.RemoveListener(leader);
+        if (leader.use_count() != 1) {
+            std::cout << "Test failed: the store kept the removed leader" << std::endl;
+            return 1;
+        }
+    }
+
+    // Destroying a follower does not wait for a leader that never ends the
+    // stream
+    {
+        auto idle = sjtu::FdTransport::SocketPair();
+        sjtu::TrieStore follower_store;
+        sjtu::ReplicationFollower<std::string> idle_follower(follower_store, std::move(idle.second));
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "../trie/serialize.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+
+struct Point {
+    int x;
+    int y;
+};
+
+namespace sjtu {
+
+template <>
+struct ValueCodec<Point> {
+    static void Encode(const Point& p, std::string& out) {
+        PutVarint(out, static_cast<uint32_t>(p.x));
+        PutVarint(out, static_cast<uint32_t>(p.y));
+    }
+    static auto Decode(std::string_view bytes) -> Point {
+        int x = static_cast<int>(GetVarint(bytes));
+        int y = static_cast<int>(GetVarint(bytes));
+        return Point{x, y};
+    }
+};
+
+}  // namespace sjtu
+
+int main() {
+    sjtu::Trie trie;
+    std::map<std::string, std::string> map;
+    std::mt19937 gen(59);
+    std::uniform_int_distribution<> dis(1, 1000000);
+    for (int i = 0; i < 100000; i++) {
+        std::string key = "key" + std::to_string(dis(gen));
+        std::string value = "value" + std::to_string(i);
+        if (i % 1000 == 0) value.push_back('\0');
+        trie = trie.Put<std::string>(key, value);
+        map[key] = value;
+    }
+    trie = trie.Put<std::string>("\xff\x80", "high bytes");
+    map["\xff\x80"] = "high bytes";
+
+    // Round trip through a stream
+    std::stringstream stream;
+    size_t size = sjtu::Serialize<std::string>(trie, stream);
+    if (size != stream.str().size()) {
+        std::cout << "Test failed: Serialize returned " << size << " bytes" << std::endl;
+        return 1;
+    }
+    auto loaded = sjtu::Deserialize<std::string>(stream);
+    for (const auto& pair : map) {
+        if (loaded.Get<std::string>(pair.first) == nullptr || *loaded.Get<std::string>(pair.first) != pair.second) {
+            std::cout << "Test failed: " << pair.first << " was not restored" << std::endl;
+            return 1;
+        }
+    }
+    size_t diff = 0;
+    sjtu::Trie::Diff<std::string>(trie, loaded, [&](const std::string&, const std::string* a,
+                                                    const std::string* b) { diff += !a || !b || *a != *b; });
+    if (diff != 0) {
+        std::cout << "Test failed: restored trie has " << diff << " different keys" << std::endl;
+        return 1;
+    }
+
+    // Arithmetic values, a value at the root, and an empty trie
+    sjtu::TrieBuilder builder;
+    builder.Put<double>("", 0.5);
+    builder.Put<double>("pi", 3.14159);
+    sjtu::Trie numbers = builder.Build();
+    std::string bytes;
+    sjtu::Serialize<double>(numbers, [&](const char* data, size_t n) { bytes.append(data, n); });
+    auto restored = sjtu::Deserialize<double>(sjtu::StringSource(bytes));
+    if (*restored.Get<double>("") != 0.5 || *restored.Get<double>("pi") != 3.14159) {
+        std::cout << "Test failed: double values were not restored" << std::endl;
+        return 1;
+    }
+    std::stringstream empty;
+    sjtu::Serialize<int>(sjtu::Trie(), empty);
+    if (!(sjtu::Deserialize<int>(empty) == sjtu::Trie())) {
+        std::cout << "Test failed: empty trie was not restored" << std::endl;
+        return 1;
+    }
+
+    // A user-provided codec
+    sjtu::Trie points;
+    points = points.Put<Point>("origin", Point{0, 0}).Put<Point>("p", Point{-3, 7});
+    std::stringstream point_stream;
+    sjtu::Serialize<Point>(points, point_stream);
+    auto restored_points = sjtu::Deserialize<Point>(point_stream);
+    if (restored_points.Get<Point>("p")->x != -3 || restored_points.Get<Point>("p")->y != 7) {
+        std::cout << "Test failed: custom codec values were not restored" << std::endl;
+        return 1;
+    }
+
+    // A key far longer than the stack could recurse over round-trips, and
+    // both tries are freed without recursing either
+    {
+        const std::string long_key(200000, 'k');
+        auto deep = sjtu::Trie().Put<std::string>(long_key, "deep").Put<std::string>("k", "short");
+        std::string chain;
+        sjtu::Serialize<std::string>(deep, [&](const char* data, size_t n) { chain.append(data, n); });
+        auto loaded = sjtu::Deserialize<std::string>(sjtu::StringSource(chain));
+        if (!loaded.Get<std::string>(long_key) || *loaded.Get<std::string>(long_key) != "deep" ||
+            !loaded.Get<std::string>("k") || loaded.Get<std::string>(long_key.substr(1))) {
+            std::cout << "Test failed: a long key did not round-trip" << std::endl;
+            return 1;
+        }
+    }
+
+    // Truncated input and mixed value types are rejected
+    try {
+        sjtu::Deserialize<std::string>(sjtu::StringSource(std::string_view(stream.str()).substr(0, 1000)));
+        std::cout << "Test failed: truncated snapshot was accepted" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+    // A huge length field fails at the end of input rather than allocating
+    try {
+        std::string huge(sjtu::kSnapshotMagic);
+        huge += std::string("\x01\x00", 2);
+        sjtu::PutVarint(huge, uint64_t{1} << 62);
+        sjtu::Deserialize<std::string>(sjtu::StringSource(huge));
+        std::cout << "Test failed: huge value length was accepted" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        std::stringstream mixed;
+        sjtu::Serialize<std::string>(trie.Put<int>("int", 1), mixed);
+        std::cout << "Test failed: mixed value types were serialized" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
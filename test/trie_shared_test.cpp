@@ -0,0 +1,80 @@
+#include "../trie/shared_trie.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+sjtu::Trie Generation(int generation) {
+    sjtu::Trie trie;
+    for (int i = 0; i < 1000; i++)
+        trie = trie.Put<std::string>("key" + std::to_string(i), "v" + std::to_string(generation) + "-" + std::to_string(i));
+    return trie;
+}
+
+// Runs in a child process; returns its exit code.
+int Reader(const std::string& name, int ready_fd) {
+    sjtu::SharedTrieReader reader(name);
+    if (reader.Generation() != 1 || reader.Get("key7") != std::optional<std::string_view>("v1-7")) return 2;
+    char byte = 1;
+    if (write(ready_fd, &byte, 1) != 1) return 3;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!reader.Refresh()) {
+        if (std::chrono::steady_clock::now() > deadline) return 4;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (int i = 0; i < 1000; i++)
+        if (reader.Get("key" + std::to_string(i)) != std::optional<std::string_view>("v2-" + std::to_string(i)))
+            return 5;
+    return reader.Generation() == 2 ? 0 : 6;
+}
+
+int main() {
+    std::string name = "/sjtu_trie_shared_test." + std::to_string(getpid());
+    try {
+        sjtu::SharedTrieReader missing(name);
+        std::cout << "Test failed: attached to a missing publisher" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    sjtu::SharedTriePublisher publisher(name);
+    {
+        sjtu::SharedTrieReader early(name);
+        if (early.Generation() != 0 || early.Get("key1") || early.Snapshot()) {
+            std::cout << "Test failed: reader saw a snapshot before the first publish" << std::endl;
+            return 1;
+        }
+    }
+    publisher.Publish<std::string>(Generation(1));
+
+    // Another process reads generation 1, then picks up generation 2
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) return 1;
+    pid_t child = fork();
+    if (child == 0) _exit(Reader(name, pipe_fds[1]));
+    char byte;
+    if (read(pipe_fds[0], &byte, 1) != 1) {
+        std::cout << "Test failed: reader process did not start" << std::endl;
+        return 1;
+    }
+    sjtu::SharedTrieReader local(name);
+    publisher.Publish<std::string>(Generation(2));
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cout << "Test failed: reader process exited with " << WEXITSTATUS(status) << std::endl;
+        return 1;
+    }
+
+    // A reader keeps its snapshot until it refreshes, even though the
+    // publisher has unlinked it
+    if (local.Get("key3") != std::optional<std::string_view>("v1-3") || !local.Refresh() ||
+        local.GetAs<std::string>("key3") != "v2-3" || local.Refresh()) {
+        std::cout << "Test failed: local reader did not switch generations" << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+int Contains(const sjtu::Trie& trie, const std::map<std::string, int>& map, const std::string& what) {
+    for (const auto& pair : map) {
+        if (trie.Get<int>(pair.first) == nullptr || *trie.Get<int>(pair.first) != pair.second) {
+            std::cout << "Test failed: " << what << " lost " << pair.first << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Excludes(const sjtu::Trie& trie, const std::map<std::string, int>& map, const std::string& what) {
+    for (const auto& pair : map) {
+        if (trie.Get<int>(pair.first) != nullptr) {
+            std::cout << "Test failed: " << what << " has " << pair.first << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    sjtu::Trie trie;
+    std::map<std::string, int> map;
+    std::mt19937 gen(55);
+    std::uniform_int_distribution<> len(1, 6);
+    std::uniform_int_distribution<> letter(0, 4);
+    const char alphabet[] = {'0', '1', '2', 'z', '\xf0'};
+
+    std::vector<std::string> all;
+    for (int i = 0; i < 3000; i++) {
+        std::string key;
+        for (int j = len(gen); j > 0; j--) key.push_back(alphabet[letter(gen)]);
+        trie = trie.Put<int>(key, i);
+        map[key] = i;
+        all.push_back(key);
+    }
+
+    for (int round = 0; round < 100; round++) {
+        std::string split = all[gen() % all.size()].substr(0, 1 + round % 4);
+        if (round % 7 == 0) split.push_back('5');
+        auto [left, right] = trie.SplitAt(split);
+
+        std::map<std::string, int> below(map.begin(), map.lower_bound(split));
+        std::map<std::string, int> above(map.lower_bound(split), map.end());
+        if (Contains(left, below, "left") || Excludes(left, above, "left") ||
+            Contains(right, above, "right") || Excludes(right, below, "right")) {
+            std::cout << "  split key " << split << std::endl;
+            return 1;
+        }
+
+        // Values are shared, not copied
+        for (const auto& pair : below) {
+            if (left.Get<int>(pair.first) != trie.Get<int>(pair.first)) {
+                std::cout << "Test failed: split copied " << pair.first << std::endl;
+                return 1;
+            }
+        }
+
+        auto joined = sjtu::Trie::Join(left, right);
+        if (Contains(joined, map, "join")) return 1;
+    }
+
+    // Splitting outside the key space shares the whole trie
+    auto [none, whole] = trie.SplitAt("");
+    if (!(none == sjtu::Trie()) || !(whole == trie)) {
+        std::cout << "Test failed: split at the empty key" << std::endl;
+        return 1;
+    }
+    auto [all_left, empty] = trie.SplitAt("\xff");
+    if (!(all_left == trie) || !(empty == sjtu::Trie())) {
+        std::cout << "Test failed: split above every key" << std::endl;
+        return 1;
+    }
+
+    // Overlapping tries cannot be joined
+    try {
+        sjtu::Trie::Join(trie, trie);
+        std::cout << "Test failed: joined overlapping tries" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // Ordering is decided by the keys, not by the dead branches Remove leaves
+    auto dead_left = sjtu::Trie().Put<int>("a", 1).Put<int>("z", 2).Remove("z");
+    auto dead_right = sjtu::Trie().Put<int>("m", 3).Put<int>("0", 4).Remove("0");
+    auto joined = sjtu::Trie::Join(dead_left, dead_right);
+    if (!joined.Get<int>("a") || !joined.Get<int>("m") || joined.Get<int>("z") || joined.Get<int>("0")) {
+        std::cout << "Test failed: join across dead branches" << std::endl;
+        return 1;
+    }
+    try {
+        sjtu::Trie::Join(dead_left.Put<int>("z", 5), dead_right);
+        std::cout << "Test failed: joined tries out of order" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // A key far longer than the stack could recurse over is split and joined
+    // along its whole length
+    {
+        const std::string long_key(200000, 'k');
+        auto deep = sjtu::Trie().Put<int>(long_key, 1).Put<int>(long_key + "a", 2).Put<int>(long_key + "z", 3).Put<int>(
+            "k", 4);
+        auto [low, high] = deep.SplitAt(long_key + "m");
+        auto whole = sjtu::Trie::Join(low, high);
+        if (!low.Get<int>(long_key + "a") || low.Get<int>(long_key + "z") || !high.Get<int>(long_key + "z") ||
+            high.Get<int>(long_key) || !whole.Get<int>(long_key) || !whole.Get<int>(long_key + "z") ||
+            !whole.Get<int>("k")) {
+            std::cout << "Test failed: split and join along a long key" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main() {
+    sjtu::TrieStore store;
+    auto before = store.Stats();
+    if (before.gets || before.puts || before.versions_published || before.versions_retained != 1) {
+        std::cout << "Test failed: a new store has counts" << std::endl;
+        return 1;
+    }
+
+    store.Put<int>("a", 1);
+    store.Put<int>("ab", 2);
+    store.Get<int>("a");
+    store.Get<int>("missing");
+    store.Get<int>("a", 100);
+    store.Remove("ab");
+    store.Remove("ab");
+    store.RemovePrefix("zzz");
+    auto stats = store.Stats();
+    if (stats.gets != 3 || stats.hits != 1 || stats.misses != 2 || stats.puts != 2 || stats.removes != 3 ||
+        stats.noop_removes != 2 || stats.versions_published != 3 || stats.versions_retained != 4) {
+        std::cout << "Test failed: wrong operation counts" << std::endl;
+        return 1;
+    }
+    // "a" creates the root and "a"; "ab" copies both and adds "ab"; removing
+    // "ab" copies all three
+    if (stats.nodes_allocated != 8 || stats.nodes_cloned != 5) {
+        std::cout << "Test failed: counted " << stats.nodes_allocated << " new and " << stats.nodes_cloned
+                  << " cloned nodes" << std::endl;
+        return 1;
+    }
+
+    // Plain tries and other stores do not count towards this store
+    {
+        auto trie = sjtu::Trie().Put<int>("a", 1).Put<int>("ab", 2).Remove("ab");
+        sjtu::TrieStore other;
+        other.Put<int>("a", 1);
+        auto now = store.Stats();
+        if (now.nodes_allocated != stats.nodes_allocated || now.nodes_cloned != stats.nodes_cloned ||
+            other.Stats().nodes_allocated != 2) {
+            std::cout << "Test failed: node counts leaked between stores" << std::endl;
+            return 1;
+        }
+    }
+
+    // Counts from many threads add up, and contended locks report waiting
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&store, t] {
+            for (int i = 0; i < 500; i++) {
+                store.Put<int>("key" + std::to_string(t) + "-" + std::to_string(i), i);
+                store.Get<int>("key" + std::to_string(t) + "-" + std::to_string(i));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    auto after = store.Stats();
+    if (after.puts != stats.puts + 4000 || after.hits != stats.hits + 4000 ||
+        after.versions_published != stats.versions_published + 4000 ||
+        after.versions_retained != store.get_version() + 1) {
+        std::cout << "Test failed: concurrent counts were lost" << std::endl;
+        return 1;
+    }
+    if (after.write_lock_wait < stats.write_lock_wait || after.snapshots_lock_wait < stats.snapshots_lock_wait) {
+        std::cout << "Test failed: wait times went backwards" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <string>
+
+int main() {
+    sjtu::Trie trie;
+    for (int t = 0; t < 3; t++) {
+        for (int i = 0; i < 100; i++) {
+            std::string key = "tenant" + std::to_string(t) + "/item" + std::to_string(i);
+            trie = trie.Put<int>(key, t * 1000 + i);
+        }
+    }
+    trie = trie.Put<int>("tenant1/", -1);
+
+    // A sub-trie shares the nodes of the original trie
+    auto sub = trie.SubTrie("tenant1/");
+    for (int i = 0; i < 100; i++) {
+        std::string key = "item" + std::to_string(i);
+        if (sub.Get<int>(key) != trie.Get<int>("tenant1/" + key) || *sub.Get<int>(key) != 1000 + i) {
+            std::cout << "Test failed: sub-trie does not share " << key << std::endl;
+            return 1;
+        }
+    }
+    if (sub.Get<int>("") == nullptr || *sub.Get<int>("") != -1) {
+        std::cout << "Test failed: sub-trie lost the value at its root" << std::endl;
+        return 1;
+    }
+    if (sub.Get<int>("tenant1/item1") != nullptr) {
+        std::cout << "Test failed: sub-trie keeps the prefix" << std::endl;
+        return 1;
+    }
+    if (!(trie.SubTrie("tenant9/") == sjtu::Trie())) {
+        std::cout << "Test failed: sub-trie of a missing prefix is not empty" << std::endl;
+        return 1;
+    }
+
+    // Graft the sub-trie under a new tenant
+    auto grafted = trie.Graft("tenant7/", sub);
+    for (int i = 0; i < 100; i++) {
+        std::string key = "item" + std::to_string(i);
+        if (grafted.Get<int>("tenant7/" + key) != sub.Get<int>(key)) {
+            std::cout << "Test failed: graft does not share " << key << std::endl;
+            return 1;
+        }
+        if (grafted.Get<int>("tenant0/" + key) != trie.Get<int>("tenant0/" + key)) {
+            std::cout << "Test failed: graft lost tenant0/" << key << std::endl;
+            return 1;
+        }
+    }
+    if (trie.Get<int>("tenant7/item0") != nullptr) {
+        std::cout << "Test failed: graft modified the original trie" << std::endl;
+        return 1;
+    }
+
+    // Grafting over an existing prefix replaces its keys
+    sjtu::Trie small;
+    small = small.Put<int>("x", 42);
+    auto replaced = trie.Graft("tenant2/", small);
+    if (replaced.Get<int>("tenant2/item0") != nullptr || *replaced.Get<int>("tenant2/x") != 42 ||
+        *replaced.Get<int>("tenant0/item0") != 0) {
+        std::cout << "Test failed: graft over an existing prefix" << std::endl;
+        return 1;
+    }
+
+    // Grafting an empty trie drops the prefix
+    auto dropped = trie.Graft("tenant0/", sjtu::Trie());
+    if (dropped.Get<int>("tenant0/item5") != nullptr || *dropped.Get<int>("tenant2/item5") != 2005) {
+        std::cout << "Test failed: grafting an empty trie" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
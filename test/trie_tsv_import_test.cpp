@@ -0,0 +1,115 @@
+#include "../trie/tsv_import.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Parsing "slow" takes a while and records how far the reader got meanwhile.
+struct Slow {
+    int value;
+};
+
+std::atomic<size_t> source_calls{0};
+std::atomic<size_t> calls_after_slow{0};
+
+template <>
+struct sjtu::TsvValue<Slow> {
+    static auto Parse(std::string_view text) -> Slow {
+        if (text != "slow") return Slow{1};
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        calls_after_slow = source_calls.load();
+        return Slow{0};
+    }
+};
+
+int main() {
+    // Rows in random order, with duplicates, CRLF line ends and empty lines
+    std::string tsv;
+    for (int i = 0; i < 50000; i++) {
+        int k = (i * 7919) % 20000;
+        tsv += "user:" + std::to_string(k) + "\t" + std::to_string(i) + (i % 3 ? "\n" : "\r\n");
+        if (i % 1000 == 0) tsv += "\n";
+    }
+    std::istringstream in(tsv);
+    sjtu::TsvImportOptions options;
+    options.chunk_bytes = 4096;
+    options.parse_threads = 4;
+    options.queue_capacity = 2;
+    sjtu::TsvImportStats stats;
+    sjtu::Trie trie = sjtu::ImportTsv<int>(in, options, &stats);
+    if (stats.rows != 50000 || stats.malformed != 0 || stats.bytes != tsv.size()) {
+        std::cout << "Test failed: imported " << stats.rows << " rows of " << stats.bytes << " bytes" << std::endl;
+        return 1;
+    }
+    // The last row of each key wins
+    for (int i = 0; i < 50000; i++) {
+        int k = (i * 7919) % 20000;
+        if (i + 20000 < 50000) continue;
+        const int* value = trie.Get<int>("user:" + std::to_string(k));
+        if (!value || *value != i) {
+            std::cout << "Test failed: user:" << k << " is not its last row " << i << std::endl;
+            return 1;
+        }
+    }
+
+    // String values keep everything after the first tab; a last line without
+    // a newline still counts
+    std::istringstream strings("a\tone\ttwo\nb\t\nc\tlast");
+    trie = sjtu::ImportTsv<std::string>(strings);
+    if (*trie.Get<std::string>("a") != "one\ttwo" || *trie.Get<std::string>("b") != "" ||
+        *trie.Get<std::string>("c") != "last") {
+        std::cout << "Test failed: string values were not split at the first tab" << std::endl;
+        return 1;
+    }
+
+    // Malformed rows fail the import, or are skipped and counted
+    std::string bad = "a\t1\nno tab here\nb\tx\nc\t3\n";
+    try {
+        sjtu::ImportTsv<int>(sjtu::StringSource(bad));
+        std::cout << "Test failed: malformed rows were accepted" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+    options.skip_malformed = true;
+    trie = sjtu::ImportTsv<int>(sjtu::StringSource(bad), options, &stats);
+    if (stats.rows != 2 || stats.malformed != 2 || *trie.Get<int>("c") != 3 || trie.Get<int>("b")) {
+        std::cout << "Test failed: malformed rows were not skipped" << std::endl;
+        return 1;
+    }
+
+    // An error from the source stops every stage
+    size_t calls = 0;
+    try {
+        sjtu::ImportTsv<int>([&calls](char* data, size_t size) -> size_t {
+            if (++calls > 3) throw std::runtime_error("disk error");
+            std::string rows;
+            while (rows.size() + 8 < size) rows += "k\t1\n";
+            std::copy(rows.begin(), rows.end(), data);
+            return rows.size();
+        }, options);
+        std::cout << "Test failed: source error was swallowed" << std::endl;
+        return 1;
+    } catch (const std::runtime_error&) {
+    }
+
+    // A slow batch holds back the reader instead of letting the batches after
+    // it pile up
+    options.skip_malformed = false;
+    sjtu::ImportTsv<Slow>([](char* data, size_t size) -> size_t {
+        if (source_calls == 1000) return 0;
+        std::string rows = source_calls++ == 0 ? "s\tslow\n" : "";
+        while (rows.size() + 8 < size) rows += "k\t1\n";
+        std::copy(rows.begin(), rows.end(), data);
+        return rows.size();
+    }, options);
+    if (calls_after_slow > 2 * options.queue_capacity + options.parse_threads + 2) {
+        std::cout << "Test failed: the reader ran " << calls_after_slow << " chunks ahead of a slow batch"
+                  << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "../trie/wal.hpp"
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+int Compare(sjtu::TrieStore& expected, sjtu::TrieStore& actual, int keys) {
+    if (expected.get_version() != actual.get_version()) {
+        std::cout << "Test failed: replayed version " << actual.get_version() << ", expected "
+                  << expected.get_version() << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        auto a = expected.Get<std::string>(key);
+        auto b = actual.Get<std::string>(key);
+        if (a.has_value() != b.has_value() || (a && **a != **b)) {
+            std::cout << "Test failed: replayed store differs at " << key << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Refuses commits while `refuse` is set.
+struct Refuser : sjtu::CommitListener {
+    bool refuse{false};
+    void OnCommit(const sjtu::Commit&) override {
+        if (refuse) throw std::runtime_error("refused");
+    }
+};
+
+int main() {
+    std::string dir = "/tmp/trie_wal_test." + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+
+    // Concurrent writers with group commit and small segments
+    sjtu::TrieStore store;
+    auto wal = std::make_shared<sjtu::WriteAheadLog<std::string>>(
+        dir, sjtu::WalOptions{sjtu::WalSyncMode::kEveryCommit, std::chrono::milliseconds(10), 4096});
+    store.AddListener(wal);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&store, t] {
+            for (int i = 0; i < 200; i++) {
+                std::string key = "key" + std::to_string(i * 8 + t);
+                store.Put<std::string>(key, "value" + std::to_string(i));
+                if (i % 5 == 0) store.Remove("key" + std::to_string((i / 2) * 8 + t));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    store.RemovePrefix("key15");
+    store.RemoveRange("key3", "key4");
+    if (wal->SyncedVersion() != store.get_version()) {
+        std::cout << "Test failed: a commit returned before it was synced" << std::endl;
+        return 1;
+    }
+    if (wal->SyncCount() > store.get_version()) {
+        std::cout << "Test failed: more syncs than commits" << std::endl;
+        return 1;
+    }
+    if (sjtu::WalSegments(dir).size() < 2) {
+        std::cout << "Test failed: the log was not split into segments" << std::endl;
+        return 1;
+    }
+
+    sjtu::TrieStore replayed;
+    size_t applied = sjtu::WriteAheadLog<std::string>::Replay(dir, replayed);
+    if (applied != store.get_version() || Compare(store, replayed, 1600)) return 1;
+
+    // A torn record at the tail is dropped, and new commits go after it
+    auto last = sjtu::WalSegments(dir).back();
+    {
+        std::ofstream out(last, std::ios::binary | std::ios::app);
+        out << "\x20\x00\x00\x00torn";
+    }
+    sjtu::TrieStore recovered;
+    sjtu::WriteAheadLog<std::string>::Replay(dir, recovered);
+    if (Compare(store, recovered, 1600)) return 1;
+    // Only the reopened log may write to the directory from now on
+    store.RemoveListener(wal);
+    wal.reset();
+    {
+        auto reopened = std::make_shared<sjtu::WriteAheadLog<std::string>>(
+            dir, sjtu::WalOptions{sjtu::WalSyncMode::kInterval, std::chrono::milliseconds(5), 1 << 20});
+        recovered.AddListener(reopened);
+        recovered.Put<std::string>("key0", "after recovery");
+        store.Put<std::string>("key0", "after recovery");
+        reopened->Sync();
+        recovered.RemoveListener(reopened);
+    }
+    sjtu::TrieStore again;
+    sjtu::WriteAheadLog<std::string>::Replay(dir, again);
+    if (Compare(store, again, 1600)) return 1;
+
+    // Values of another type cannot be logged, and the commit is abandoned
+    size_t version = recovered.get_version();
+    auto strict = std::make_shared<sjtu::WriteAheadLog<std::string>>(dir + "/strict");
+    recovered.AddListener(strict);
+    try {
+        recovered.Put<int>("int", 1);
+        std::cout << "Test failed: value of another type was logged" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {
+    }
+    if (recovered.get_version() != version || recovered.Get<int>("int")) {
+        std::cout << "Test failed: failed commit became visible" << std::endl;
+        return 1;
+    }
+
+    // A commit abandoned by a later listener is not logged, and the next
+    // commit takes its version
+    {
+        sjtu::TrieStore aborting;
+        auto log = std::make_shared<sjtu::WriteAheadLog<std::string>>(dir + "/abort");
+        auto refuser = std::make_shared<Refuser>();
+        aborting.AddListener(log);
+        aborting.AddListener(refuser);
+        aborting.Put<std::string>("a", "1");
+        refuser->refuse = true;
+        try {
+            aborting.Put<std::string>("b", "2");
+            std::cout << "Test failed: refused commit was published" << std::endl;
+            return 1;
+        } catch (const std::runtime_error&) {
+        }
+        refuser->refuse = false;
+        aborting.Put<std::string>("c", "3");
+    }
+    sjtu::TrieStore replayed_abort;
+    sjtu::WriteAheadLog<std::string>::Replay(dir + "/abort", replayed_abort);
+    if (replayed_abort.get_version() != 2 || replayed_abort.Get<std::string>("b") ||
+        !replayed_abort.Get<std::string>("c")) {
+        std::cout << "Test failed: abandoned commit was logged" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
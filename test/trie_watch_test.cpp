@@ -0,0 +1,118 @@
+#include "../trie/watch.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main() {
+    sjtu::TrieStore store;
+    auto feed = std::make_shared<sjtu::ChangeFeed>();
+    store.AddListener(feed);
+    auto users = feed->Watch("user/");
+    auto all = feed->Watch("");
+    auto other = feed->Watch("zzz");
+
+    // Only matching prefixes see a commit, tagged with its version and trie
+    size_t version = store.Put<std::string>("user/1", "alice");
+    store.Put<std::string>("group/1", "admins");
+    sjtu::WatchEvent event;
+    if (!users->Next(event, std::chrono::seconds(1)) || event.version != version || event.key != "user/1" ||
+        event.coalesced || !event.trie.Get<std::string>("user/1") || *event.trie.Get<std::string>("user/1") != "alice") {
+        std::cout << "Test failed: wrong event for user/1" << std::endl;
+        return 1;
+    }
+    if (users->TryNext(event) || other->TryNext(event)) {
+        std::cout << "Test failed: event for an unrelated key" << std::endl;
+        return 1;
+    }
+    int seen = 0;
+    while (all->TryNext(event)) seen++;
+    if (seen != 2) {
+        std::cout << "Test failed: the empty prefix saw " << seen << " events" << std::endl;
+        return 1;
+    }
+
+    // Prefix and range removals reach watchers above and below them
+    auto user1 = feed->Watch("user/1");
+    store.Put<std::string>("user/10", "bob");
+    users->TryNext(event);
+    user1->TryNext(event);
+    store.RemovePrefix("user/");
+    if (!users->TryNext(event) || event.op != sjtu::Commit::Op::kRemovePrefix || !user1->TryNext(event)) {
+        std::cout << "Test failed: prefix removal not delivered" << std::endl;
+        return 1;
+    }
+    store.Put<std::string>("user/2", "carol");
+    users->TryNext(event);
+    store.RemoveRange("user/", "user/3");
+    if (!users->TryNext(event) || event.op != sjtu::Commit::Op::kRemoveRange || !user1->TryNext(event) ||
+        other->TryNext(event)) {
+        std::cout << "Test failed: range removal delivered wrongly" << std::endl;
+        return 1;
+    }
+
+    // A slow consumer gets its queued events, then one coalesced event
+    auto slow = feed->Watch("slow/", 4);
+    size_t last = 0;
+    for (int i = 0; i < 100; i++) last = store.Put<std::string>("slow/" + std::to_string(i), "x");
+    std::vector<sjtu::WatchEvent> events;
+    while (slow->TryNext(event)) events.push_back(event);
+    if (events.size() != 5 || !events.back().coalesced || events.back().version != last || slow->Dropped() != 96) {
+        std::cout << "Test failed: slow consumer was not coalesced" << std::endl;
+        return 1;
+    }
+    for (size_t i = 1; i < events.size(); i++)
+        if (events[i].version <= events[i - 1].version) {
+            std::cout << "Test failed: events out of order" << std::endl;
+            return 1;
+        }
+
+    // A blocked consumer is woken by a concurrent writer
+    auto wake = feed->Watch("wake");
+    std::thread writer([&store] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        store.Put<std::string>("wake", "up");
+    });
+    bool woken = wake->Next(event, std::chrono::seconds(5));
+    writer.join();
+    if (!woken || event.key != "wake") {
+        std::cout << "Test failed: waiting consumer was not woken" << std::endl;
+        return 1;
+    }
+
+    // Callbacks see every commit in order, from many writers
+    std::atomic<size_t> delivered{0};
+    std::atomic<size_t> newest{0};
+    std::atomic<bool> ordered{true};
+    auto callback = feed->Watch("cb/", [&](const sjtu::WatchEvent& e) {
+        if (e.version <= newest.load()) ordered = false;
+        newest = e.version;
+        delivered++;
+    }, 1 << 16);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++)
+        writers.emplace_back([&store, t] {
+            for (int i = 0; i < 500; i++) store.Put<int>("cb/" + std::to_string(t) + "/" + std::to_string(i), i);
+        });
+    for (auto& thread : writers) thread.join();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (delivered < 2000 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (delivered != 2000 || !ordered || newest != store.get_version()) {
+        std::cout << "Test failed: callback saw " << delivered << " events" << std::endl;
+        return 1;
+    }
+
+    // An unwatched prefix receives nothing more
+    feed->Unwatch(users);
+    store.Put<std::string>("user/3", "dave");
+    if (users->TryNext(event)) {
+        std::cout << "Test failed: event after Unwatch" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
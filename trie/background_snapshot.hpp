@@ -0,0 +1,181 @@
+#ifndef SJTU_BACKGROUND_SNAPSHOT_HPP
+#define SJTU_BACKGROUND_SNAPSHOT_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "serialize.hpp"
+#include "src.hpp"
+
+namespace sjtu {
+
+struct SnapshotProgress {
+    size_t version{0};
+    size_t bytes_written{0};
+    bool done{false};
+};
+
+struct SnapshotOptions {
+    // Write at most this many bytes per second; 0 means no limit.
+    size_t bytes_per_second{0};
+    // Called on the snapshot thread after every chunk written and once more
+    // when the file is complete.
+    std::function<void(const SnapshotProgress&)> on_progress;
+};
+
+class SnapshotJob;
+
+// Start writing `version` of `store` (default: newest version), whose values
+// must all be of type T, to `path` in the Serialize<T> format. Returns at
+// once; the job runs on its own thread. Throws std::invalid_argument if the
+// version does not exist.
+template <class T>
+auto SnapshotToFile(TrieStore& store, size_t version, const std::string& path, SnapshotOptions options = {})
+    -> std::shared_ptr<SnapshotJob>;
+
+// A SnapshotJob writes one pinned version of a TrieStore to a file on its own
+// thread. The version's root is immutable, so the job needs no lock after
+// fetching it: writers keep committing at full speed while it runs.
+//
+// The snapshot is written to `path + ".tmp"`, synced and renamed over `path`,
+// so `path` never holds a partial snapshot. Destroying the job waits for it.
+class SnapshotJob {
+   public:
+    SnapshotJob(const SnapshotJob&) = delete;
+    auto operator=(const SnapshotJob&) -> SnapshotJob& = delete;
+
+    ~SnapshotJob() {
+        if (thread_.joinable()) thread_.join();
+    }
+
+    auto Version() const -> size_t { return version_; }
+    auto BytesWritten() const -> size_t { return bytes_.load(std::memory_order_relaxed); }
+
+    auto Done() const -> bool {
+        std::lock_guard<std::mutex> lock(lock_);
+        return done_;
+    }
+
+    // Ask the job to stop; it removes its temporary file and Wait() throws.
+    // A rate-limited job wakes up at once.
+    void Cancel() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            cancelled_.store(true, std::memory_order_relaxed);
+        }
+        wake_.notify_all();
+    }
+
+    // Wait for the snapshot to be complete. Rethrows the error that stopped
+    // it, if any.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(lock_);
+        finished_.wait(lock, [this] { return done_; });
+        if (error_) std::rethrow_exception(error_);
+    }
+
+   private:
+    template <class T>
+    friend auto SnapshotToFile(TrieStore& store, size_t version, const std::string& path, SnapshotOptions options)
+        -> std::shared_ptr<SnapshotJob>;
+
+    static constexpr size_t kChunkSize = 64 << 10;
+
+    SnapshotJob(size_t version, std::string path, SnapshotOptions options)
+        : version_(version), path_(std::move(path)), options_(std::move(options)) {}
+
+    template <class T>
+    void Run(Trie trie) {
+        const std::string tmp = path_ + ".tmp";
+        int fd = -1;
+        try {
+            fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) throw std::runtime_error("SnapshotToFile: cannot create " + tmp);
+            const auto start = std::chrono::steady_clock::now();
+            Serialize<T>(trie, [&](const char* data, size_t size) {
+                while (size > 0) {
+                    if (cancelled_.load(std::memory_order_relaxed))
+                        throw std::runtime_error("SnapshotToFile: cancelled");
+                    size_t chunk = std::min(size, kChunkSize);
+                    detail::WriteAll(fd, data, chunk, tmp);
+                    data += chunk;
+                    size -= chunk;
+                    size_t bytes = bytes_.fetch_add(chunk, std::memory_order_relaxed) + chunk;
+                    Report(false);
+                    // Pace the writes: wait until the bytes written so far
+                    // are due at the configured rate, or the job is
+                    // cancelled.
+                    if (options_.bytes_per_second > 0) {
+                        std::unique_lock<std::mutex> lock(lock_);
+                        wake_.wait_until(lock,
+                                         start + std::chrono::microseconds(bytes * 1000000 / options_.bytes_per_second),
+                                         [this] { return cancelled_.load(std::memory_order_relaxed); });
+                    }
+                }
+            });
+            if (::fdatasync(fd) != 0) throw std::runtime_error("SnapshotToFile: cannot sync " + tmp);
+            ::close(fd);
+            fd = -1;
+            detail::CommitFile(tmp, path_);
+            Report(true);
+        } catch (...) {
+            if (fd >= 0) ::close(fd);
+            std::remove(tmp.c_str());
+            std::lock_guard<std::mutex> lock(lock_);
+            error_ = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            done_ = true;
+        }
+        finished_.notify_all();
+    }
+
+    void Report(bool done) {
+        if (options_.on_progress) options_.on_progress(SnapshotProgress{version_, BytesWritten(), done});
+    }
+
+    const size_t version_;
+    const std::string path_;
+    const SnapshotOptions options_;
+    std::atomic<size_t> bytes_{0};
+    std::atomic<bool> cancelled_{false};
+
+    mutable std::mutex lock_;
+    std::condition_variable finished_;
+    std::condition_variable wake_;
+    bool done_{false};
+    std::exception_ptr error_;
+    std::thread thread_;
+};
+
+template <class T>
+auto SnapshotToFile(TrieStore& store, size_t version, const std::string& path, SnapshotOptions options)
+    -> std::shared_ptr<SnapshotJob> {
+    auto snapshot = store.GetSnapshot(version);
+    if (!snapshot) throw std::invalid_argument("SnapshotToFile: no such version");
+    std::shared_ptr<SnapshotJob> job(new SnapshotJob(snapshot->first, path, std::move(options)));
+    job->thread_ = std::thread([job = job.get(), trie = std::move(snapshot->second)]() mutable {
+        job->template Run<T>(std::move(trie));
+    });
+    return job;
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_BACKGROUND_SNAPSHOT_HPP
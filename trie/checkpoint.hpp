@@ -0,0 +1,488 @@
+#ifndef SJTU_CHECKPOINT_HPP
+#define SJTU_CHECKPOINT_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+#include "wal.hpp"
+
+namespace sjtu {
+
+struct CheckpointerOptions {
+    // A checkpoint compacts the node file once it is this many times the
+    // size of the latest checkpoint's nodes...
+    double compact_ratio{2};
+    // ...and at least this large; 0 disables compaction.
+    uint64_t compact_min_bytes{64 << 20};
+};
+
+struct CheckpointStats {
+    // The version that was checkpointed.
+    size_t version{0};
+    // Nodes appended by this checkpoint; every other node was already on disk.
+    size_t nodes_written{0};
+    size_t bytes_written{0};
+    // Whether the node file was compacted afterwards.
+    bool compacted{false};
+};
+
+// A Checkpointer persists versions of a trie whose values are of type T to
+// an append-only node file, writing only the nodes that are not on disk yet.
+//
+// Copy-on-write means that a node shared with an earlier checkpointed root is
+// unchanged and already on disk. The checkpointer remembers the file offset
+// of every node it has written or loaded, keyed by node identity, and a
+// checkpoint walks the new root post-order, stopping at every known node. New
+// nodes reference their children by offset, old or new. Checkpoint cost is
+// therefore proportional to the writes since the last checkpoint, not to the
+// size of the trie.
+//
+// The nodes replaced by later checkpoints stay in the file, so once it
+// outgrows CheckpointerOptions the checkpointer compacts it: the nodes of the
+// latest checkpoint are copied to a new file of the next generation, and the
+// old file is deleted. The node file is thus at most about compact_ratio
+// times the latest checkpoint's nodes, or compact_min_bytes.
+//
+// The directory holds two files:
+//
+//   nodes-<generation>.dat: "SJTUCKPT", then appended nodes. A node at
+//              offset o is flags (bit 0: has value), varint fanout, `fanout`
+//              labels, `fanout` varint (o - child offset), [varint length,
+//              value].
+//   CURRENT:   "SJTUCKPT", u64 valid length of the node file, u64 root
+//              offset (0: empty trie), u64 version, u64 generation, u32
+//              CRC-32 of the preceding bytes. Replaced atomically after the
+//              node file is synced.
+//
+// A crash in the middle of a checkpoint leaves CURRENT pointing at the
+// previous one; the partial nodes past its length are cut off on open. A
+// checkpoint that fails cuts its nodes off right away. A crash in the middle
+// of a compaction leaves a node file of another generation than CURRENT's,
+// which open deletes.
+template <class T>
+class Checkpointer {
+   public:
+    // Open or create the checkpoint directory `dir` and load its latest
+    // checkpoint, if any.
+    explicit Checkpointer(std::string dir, CheckpointerOptions options = {})
+        : dir_(std::move(dir)), options_(options) {
+        std::filesystem::create_directories(dir_);
+        uint64_t length = kMagic.size();
+        uint64_t root = 0;
+        const auto manifest = ReadManifest();
+        const bool exists = manifest.has_value();
+        if (exists) {
+            length = manifest->length;
+            root = manifest->root;
+            version_ = manifest->version;
+            generation_ = manifest->generation;
+        }
+        // Node files of other generations are left by a crashed compaction
+        // or, without CURRENT, by a crashed first checkpoint.
+        const std::string nodes = NodesPath();
+        for (const auto& entry : std::filesystem::directory_iterator(dir_)) {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind("nodes-", 0) == 0 && (!exists || entry.path().string() != nodes))
+                std::filesystem::remove(entry.path());
+        }
+        if (exists) {
+            if (!std::filesystem::exists(nodes) || std::filesystem::file_size(nodes) < length)
+                throw std::runtime_error("Checkpointer: " + nodes + " is shorter than " + dir_ + "/CURRENT says");
+            std::filesystem::resize_file(nodes, length);
+            latest_ = Load(nodes, root);
+        }
+
+        fd_ = ::open(nodes.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw std::runtime_error("Checkpointer: cannot open " + nodes);
+        if (!exists) detail::WriteAll(fd_, kMagic.data(), kMagic.size(), nodes);
+        size_ = std::filesystem::file_size(nodes);
+    }
+
+    Checkpointer(const Checkpointer&) = delete;
+    auto operator=(const Checkpointer&) -> Checkpointer& = delete;
+
+    ~Checkpointer() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    // The version and trie of the latest checkpoint, if any. Its nodes are
+    // known to be on disk, so a store restored from it only writes what
+    // changed since.
+    auto Latest() const -> std::optional<std::pair<size_t, Trie>> {
+        if (!latest_) return std::nullopt;
+        return std::make_pair(version_, *latest_);
+    }
+
+    // Checkpoint the newest version of `store`.
+    auto Checkpoint(TrieStore& store) -> CheckpointStats {
+        auto snapshot = store.GetSnapshot();
+        return Checkpoint(snapshot->second, snapshot->first);
+    }
+
+    // Checkpoint `trie` as `version`.
+    auto Checkpoint(const Trie& trie, size_t version) -> CheckpointStats {
+        CheckpointStats stats;
+        stats.version = version;
+        const std::string nodes = NodesPath();
+        TrieWriter writer([this, &nodes](const char* data, size_t size) {
+            detail::WriteAll(fd_, data, size, nodes);
+        });
+        const uint64_t base = size_;
+        uint64_t root = 0;
+        added_.clear();
+        try {
+            if (const auto& node = TrieAccess::Root(trie)) root = WriteTree(node, writer, base, stats);
+            writer.Flush();
+            if (::fdatasync(fd_) != 0) throw std::runtime_error("Checkpointer: cannot sync " + nodes);
+        } catch (...) {
+            // Forget the nodes of this attempt and cut them off, so the next
+            // checkpoint's offsets match the file.
+            for (const TrieNode* node : added_) known_.erase(node);
+            struct stat st;
+            if (::ftruncate(fd_, static_cast<off_t>(base)) != 0 && ::fstat(fd_, &st) == 0)
+                size_ = static_cast<uint64_t>(st.st_size);
+            throw;
+        }
+        stats.bytes_written = writer.BytesWritten();
+        size_ = base + stats.bytes_written;
+        WriteManifest(size_, root, version, generation_);
+
+        live_bytes_ = kMagic.size();
+        if (const auto& node = TrieAccess::Root(trie)) live_bytes_ = Add(live_bytes_, Lookup(node)->bytes);
+        version_ = version;
+        latest_ = trie;
+        Prune();
+        if (options_.compact_min_bytes > 0 && size_ >= options_.compact_min_bytes &&
+            static_cast<double>(size_) >= options_.compact_ratio * static_cast<double>(live_bytes_)) {
+            Compact();
+            stats.compacted = true;
+        }
+        return stats;
+    }
+
+    // Copy the nodes of the latest checkpoint to a node file of the next
+    // generation and delete the current one. Checkpoint calls this on its own
+    // as set by CheckpointerOptions.
+    void Compact() {
+        const uint64_t generation = generation_ + 1;
+        const std::string nodes = NodesPath(generation);
+        int fd = ::open(nodes.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("Checkpointer: cannot create " + nodes);
+        // WriteNode records the new offsets; the old ones stay valid until
+        // CURRENT names the new file.
+        auto known = std::move(known_);
+        known_.clear();
+        uint64_t root = 0;
+        uint64_t size = kMagic.size();
+        try {
+            detail::WriteAll(fd, kMagic.data(), kMagic.size(), nodes);
+            TrieWriter writer([fd, &nodes](const char* data, size_t n) { detail::WriteAll(fd, data, n, nodes); });
+            CheckpointStats stats;
+            if (latest_) {
+                if (const auto& node = TrieAccess::Root(*latest_)) root = WriteTree(node, writer, size, stats);
+            }
+            writer.Flush();
+            size += writer.BytesWritten();
+            if (::fdatasync(fd) != 0) throw std::runtime_error("Checkpointer: cannot sync " + nodes);
+            WriteManifest(size, root, version_, generation);
+        } catch (...) {
+            // WriteManifest also throws after the rename, when only the
+            // directory sync fails. CURRENT names the new file then, so it is
+            // kept and used. The new file is deleted only if CURRENT surely
+            // still names the old one; if CURRENT cannot be read, the next
+            // open deletes whichever file it does not name.
+            std::optional<uint64_t> named;
+            try {
+                if (const auto manifest = ReadManifest()) named = manifest->generation;
+            } catch (const std::exception&) {
+            }
+            if (named == generation) {
+                Adopt(fd, generation, size);
+                throw;
+            }
+            ::close(fd);
+            if (named == generation_) std::filesystem::remove(nodes);
+            known_ = std::move(known);
+            throw;
+        }
+        Adopt(fd, generation, size);
+    }
+
+    // The node file in use.
+    auto NodesPath() const -> std::string { return NodesPath(generation_); }
+
+   private:
+    static constexpr std::string_view kMagic{"SJTUCKPT", 8};
+    static constexpr size_t kManifestSize = 44;
+
+    auto NodesPath(uint64_t generation) const -> std::string {
+        char name[40];
+        std::snprintf(name, sizeof(name), "nodes-%010llu.dat", static_cast<unsigned long long>(generation));
+        return dir_ + "/" + name;
+    }
+
+    struct Manifest {
+        uint64_t length;
+        uint64_t root;
+        uint64_t version;
+        uint64_t generation;
+    };
+
+    // Parse CURRENT, or return nullopt if there is none yet. Throws if it is
+    // corrupt.
+    auto ReadManifest() const -> std::optional<Manifest> {
+        const std::string current = dir_ + "/CURRENT";
+        if (!std::filesystem::exists(current)) return std::nullopt;
+        std::ifstream in(current, std::ios::binary);
+        std::string manifest((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (manifest.size() != kManifestSize || manifest.compare(0, kMagic.size(), kMagic) != 0 ||
+            detail::Crc32(std::string_view(manifest).substr(0, kManifestSize - 4)) !=
+                detail::LoadFixed32(manifest.data() + kManifestSize - 4))
+            throw std::runtime_error("Checkpointer: corrupt " + current);
+        Manifest parsed;
+        std::memcpy(&parsed.length, manifest.data() + 8, 8);
+        std::memcpy(&parsed.root, manifest.data() + 16, 8);
+        std::memcpy(&parsed.version, manifest.data() + 24, 8);
+        std::memcpy(&parsed.generation, manifest.data() + 32, 8);
+        return parsed;
+    }
+
+    void WriteManifest(uint64_t length, uint64_t root, uint64_t version, uint64_t generation) {
+        std::string manifest(kMagic);
+        manifest.append(reinterpret_cast<const char*>(&length), 8);
+        manifest.append(reinterpret_cast<const char*>(&root), 8);
+        manifest.append(reinterpret_cast<const char*>(&version), 8);
+        manifest.append(reinterpret_cast<const char*>(&generation), 8);
+        detail::AppendFixed32(manifest, detail::Crc32(manifest));
+        detail::ReplaceFile(dir_ + "/CURRENT", manifest);
+    }
+
+    // Switch to the compacted node file `fd` of `generation`, which CURRENT
+    // names, and delete the old one.
+    void Adopt(int fd, uint64_t generation, uint64_t size) {
+        ::close(fd_);
+        std::filesystem::remove(NodesPath());
+        fd_ = fd;
+        size_ = size;
+        generation_ = generation;
+        live_bytes_ = size;
+        prune_at_ = std::max<size_t>(1024, known_.size() * 2);
+    }
+
+    struct Known {
+        std::weak_ptr<TrieNode> node;
+        uint64_t offset;
+        // The bytes of the node and the nodes below it. A subtree shared by
+        // several parents counts once per parent.
+        uint64_t bytes;
+    };
+
+    // An entry is only trusted while its node is alive: a dead node's address
+    // may have been reused by a new node.
+    auto Lookup(const std::shared_ptr<TrieNode>& node) const -> const Known* {
+        auto it = known_.find(node.get());
+        if (it == known_.end() || it->second.node.expired()) return nullptr;
+        return &it->second;
+    }
+
+    // Shared subtrees can make byte counts grow exponentially with depth, so
+    // they saturate.
+    static auto Add(uint64_t a, uint64_t b) -> uint64_t { return b > UINT64_MAX - a ? UINT64_MAX : a + b; }
+
+    // Post-order, stopping at every known node.
+    template <class Writer>
+    auto WriteTree(const std::shared_ptr<TrieNode>& root, Writer& writer, uint64_t base, CheckpointStats& stats)
+        -> uint64_t {
+        if (const Known* known = Lookup(root)) return known->offset;
+        struct Frame {
+            const std::shared_ptr<TrieNode>* node;
+            std::map<char, std::shared_ptr<TrieNode>>::const_iterator next;
+            std::vector<uint64_t> children;
+            uint64_t bytes;
+        };
+        // The nodes on the current path, each with its next child and the
+        // offsets and bytes of the children before it.
+        std::vector<Frame> path;
+        path.push_back(Frame{&root, root->children_.begin(), {}, 0});
+        uint64_t offset = 0;
+        while (!path.empty()) {
+            Frame& top = path.back();
+            if (top.next != (*top.node)->children_.end()) {
+                const std::shared_ptr<TrieNode>& child = (top.next++)->second;
+                if (const Known* known = Lookup(child)) {
+                    top.children.push_back(known->offset);
+                    top.bytes = Add(top.bytes, known->bytes);
+                } else {
+                    path.push_back(Frame{&child, child->children_.begin(), {}, 0});
+                }
+                continue;
+            }
+            uint64_t bytes = top.bytes;
+            offset = WriteNode(*top.node, top.children, bytes, writer, base, stats);
+            path.pop_back();
+            if (!path.empty()) {
+                path.back().children.push_back(offset);
+                path.back().bytes = Add(path.back().bytes, bytes);
+            }
+        }
+        return offset;
+    }
+
+    // Append one node whose children are at `children` and hold `bytes`,
+    // which becomes the bytes of the whole subtree.
+    template <class Writer>
+    auto WriteNode(const std::shared_ptr<TrieNode>& node, const std::vector<uint64_t>& children, uint64_t& bytes,
+                   Writer& writer, uint64_t base, CheckpointStats& stats) -> uint64_t {
+        const uint64_t offset = base + writer.BytesWritten();
+        std::string& out = writer.Buffer();
+        out.push_back(static_cast<char>(node->is_value_node_ ? 1 : 0));
+        PutVarint(out, node->children_.size());
+        for (const auto& child : node->children_) out.push_back(child.first);
+        for (uint64_t child : children) PutVarint(out, offset - child);
+        if (node->is_value_node_) {
+            const T* value = TrieAccess::ValueOf<T>(node.get());
+            if (!value) throw std::invalid_argument("Checkpointer: trie holds a value of another type");
+            value_.clear();
+            ValueCodec<T>::Encode(*value, value_);
+            PutVarint(out, value_.size());
+            out += value_;
+        }
+        bytes = Add(bytes, base + writer.BytesWritten() - offset);
+        writer.MaybeFlush();
+        known_[node.get()] = Known{node, offset, bytes};
+        added_.push_back(node.get());
+        ++stats.nodes_written;
+        return offset;
+    }
+
+    // Compaction bounds the file, so it is read whole. A node shared by
+    // several parents is loaded once.
+    auto Load(const std::string& path, uint64_t root) -> std::optional<Trie> {
+        if (root == 0) return Trie();
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        auto node = LoadTree(bytes, root);
+        live_bytes_ = Add(kMagic.size(), known_[node.get()].bytes);
+        return TrieAccess::Make(std::move(node));
+    }
+
+    // A decoded node whose children are still being loaded.
+    struct LoadFrame {
+        uint64_t offset;
+        std::shared_ptr<TrieNode> node;
+        std::string_view labels;
+        std::vector<uint64_t> children;
+        size_t next;
+        // The bytes of the node and of its children loaded so far.
+        uint64_t bytes;
+    };
+
+    // Load the subtree at `root`.
+    auto LoadTree(std::string_view bytes, uint64_t root) -> std::shared_ptr<TrieNode> {
+        std::unordered_map<uint64_t, std::shared_ptr<TrieNode>> loaded;
+        std::vector<LoadFrame> path;
+        path.push_back(DecodeNode(bytes, root));
+        for (;;) {
+            LoadFrame& top = path.back();
+            if (top.next < top.children.size()) {
+                // A child is attached once it is loaded, which is right away
+                // if another parent has loaded it already.
+                auto it = loaded.find(top.children[top.next]);
+                if (it == loaded.end()) {
+                    path.push_back(DecodeNode(bytes, top.children[top.next]));
+                } else {
+                    top.node->children_.emplace_hint(top.node->children_.end(), top.labels[top.next], it->second);
+                    top.bytes = Add(top.bytes, known_[it->second.get()].bytes);
+                    ++top.next;
+                }
+                continue;
+            }
+            known_[top.node.get()] = Known{top.node, top.offset, top.bytes};
+            loaded.emplace(top.offset, top.node);
+            if (path.size() == 1) return top.node;
+            path.pop_back();
+        }
+    }
+
+    // Decode the node at `offset` without its children. Children are written
+    // before their parent, so every child offset is smaller than the
+    // parent's; anything else is corruption (and could loop).
+    auto DecodeNode(std::string_view bytes, uint64_t offset) -> LoadFrame {
+        if (offset < kMagic.size() || offset >= bytes.size())
+            throw std::runtime_error("Checkpointer: corrupt node offset");
+        std::string_view in = bytes.substr(offset);
+        const bool has_value = in.front() & 1;
+        in.remove_prefix(1);
+        const uint64_t fanout = GetVarint(in);
+        if (fanout > 256 || in.size() < fanout) throw std::runtime_error("Checkpointer: corrupt node");
+        LoadFrame frame{offset, nullptr, in.substr(0, fanout), std::vector<uint64_t>(fanout), 0, 0};
+        in.remove_prefix(fanout);
+        for (auto& child : frame.children) {
+            const uint64_t distance = GetVarint(in);
+            if (distance == 0 || distance > offset) throw std::runtime_error("Checkpointer: corrupt child offset");
+            child = offset - distance;
+        }
+        if (has_value) {
+            const uint64_t size = GetVarint(in);
+            if (in.size() < size) throw std::runtime_error("Checkpointer: corrupt value");
+            frame.node = std::make_shared<TrieNodeWithValue<T>>(
+                std::make_shared<T>(ValueCodec<T>::Decode(in.substr(0, size))));
+            in.remove_prefix(size);
+        } else {
+            frame.node = std::make_shared<TrieNode>();
+        }
+        frame.bytes = bytes.size() - offset - in.size();
+        return frame;
+    }
+
+    // Drop entries of dead nodes once the map has doubled since the last
+    // sweep.
+    void Prune() {
+        if (known_.size() < prune_at_) return;
+        for (auto it = known_.begin(); it != known_.end();) {
+            if (it->second.node.expired()) it = known_.erase(it);
+            else ++it;
+        }
+        prune_at_ = std::max<size_t>(1024, known_.size() * 2);
+    }
+
+    const std::string dir_;
+    const CheckpointerOptions options_;
+    int fd_{-1};
+    uint64_t size_{0};
+    uint64_t generation_{0};
+    // The bytes of the latest checkpoint's nodes, as counted by Known.
+    uint64_t live_bytes_{kMagic.size()};
+    size_t version_{0};
+    std::optional<Trie> latest_;
+    std::unordered_map<const TrieNode*, Known> known_;
+    // The nodes written by the checkpoint in progress.
+    std::vector<const TrieNode*> added_;
+    size_t prune_at_{1024};
+    std::string value_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_CHECKPOINT_HPP
@@ -0,0 +1,453 @@
+#ifndef SJTU_FRONT_CODED_HPP
+#define SJTU_FRONT_CODED_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+
+namespace sjtu {
+
+// Block codecs compress the value section of a front-coded block. A codec is
+// a type with
+//
+//   static constexpr uint8_t kId;  // stored in the header, unique per codec
+//   static void Compress(std::string_view in, std::string& out);  // append
+//   static void Decompress(std::string_view in, size_t size, std::string& out);
+//
+// where Decompress appends exactly the `size` bytes given to Compress.
+struct NoCompression {
+    static constexpr uint8_t kId = 0;
+    static void Compress(std::string_view in, std::string& out) { out += in; }
+    static void Decompress(std::string_view in, size_t size, std::string& out) {
+        if (in.size() != size) throw std::runtime_error("NoCompression: bad block size");
+        out += in;
+    }
+};
+
+// A small LZ77 codec: a token byte below 0x80 starts a run of token + 1
+// literal bytes, one at or above 0x80 copies (token & 0x7f) + 4 bytes from a
+// varint distance back. Matches are found with a hash of the next 4 bytes.
+struct LzCompression {
+    static constexpr uint8_t kId = 1;
+
+    static void Compress(std::string_view in, std::string& out) {
+        constexpr size_t kMinMatch = 4, kMaxMatch = 0x7f + kMinMatch;
+        std::vector<uint32_t> table(1 << 14, UINT32_MAX);
+        size_t literals = 0;
+        auto flush = [&](size_t end) {
+            while (literals > 0) {
+                size_t run = std::min<size_t>(literals, 0x80);
+                out.push_back(static_cast<char>(run - 1));
+                out.append(in.data() + end - literals, run);
+                literals -= run;
+            }
+        };
+        size_t i = 0;
+        while (i + kMinMatch <= in.size()) {
+            uint32_t word;
+            std::memcpy(&word, in.data() + i, 4);
+            uint32_t& slot = table[(word * 2654435761u) >> 18];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(i);
+            if (candidate != UINT32_MAX && std::memcmp(in.data() + candidate, in.data() + i, 4) == 0) {
+                size_t length = kMinMatch;
+                while (i + length < in.size() && length < kMaxMatch && in[candidate + length] == in[i + length])
+                    ++length;
+                flush(i);
+                out.push_back(static_cast<char>(0x80 | (length - kMinMatch)));
+                PutVarint(out, i - candidate);
+                i += length;
+            } else {
+                ++literals;
+                ++i;
+            }
+        }
+        literals += in.size() - i;
+        flush(in.size());
+    }
+
+    static void Decompress(std::string_view in, size_t size, std::string& out) {
+        const size_t start = out.size();
+        while (!in.empty()) {
+            auto token = static_cast<unsigned char>(in.front());
+            in.remove_prefix(1);
+            if (token < 0x80) {
+                size_t run = token + 1u;
+                if (in.size() < run) throw std::runtime_error("LzCompression: truncated literals");
+                out.append(in.data(), run);
+                in.remove_prefix(run);
+            } else {
+                size_t length = (token & 0x7f) + 4u;
+                uint64_t distance = GetVarint(in);
+                if (distance == 0 || distance > out.size() - start)
+                    throw std::runtime_error("LzCompression: bad match distance");
+                // Byte by byte: a match may overlap the bytes it produces.
+                for (size_t k = 0; k < length; ++k) out.push_back(out[out.size() - distance]);
+            }
+        }
+        if (out.size() - start != size) throw std::runtime_error("LzCompression: bad block size");
+    }
+};
+
+struct FrontCodingOptions {
+    // A block is closed once its keys and values reach this many bytes.
+    size_t block_bytes{16 << 10};
+    // Every this many keys is stored whole, so a block can be binary
+    // searched.
+    size_t restart_interval{16};
+};
+
+// The front-coded format stores the keys of a trie in std::string order,
+// each as the length of the prefix it shares with the previous key and the
+// rest, in blocks. Values are kept apart from keys in each block and
+// compressed together by a block codec.
+//
+//   header: "SJTUFCT\x01", u8 codec id, varint restart interval
+//   block:  0x01, varint entries, varint keys length, keys,
+//           varint values length, varint compressed length, compressed values
+//   keys:   per entry varint shared, varint suffix length, suffix; then
+//           u32 offsets of the restart entries (shared = 0), u32 count
+//   values: per entry varint length, ValueCodec<T> bytes
+//   index:  0x00, per block varint first key length, first key,
+//           varint block offset, varint entries
+//   footer: u64 index offset, u64 blocks, u64 entries, "SJTUFCT\x01"
+//
+// Export and import stream: one block is held in memory at a time. The index
+// and footer let FrontCodedReader look up keys without reading the rest.
+inline constexpr std::string_view kFrontCodedMagic{"SJTUFCT\x01", 8};
+inline constexpr size_t kFrontCodedFooterSize = 32;
+
+namespace detail {
+
+template <class T, class Codec, class Sink>
+class FrontCodedWriter {
+   public:
+    FrontCodedWriter(Sink sink, FrontCodingOptions options) : writer_(std::move(sink)), options_(options) {
+        if (options_.restart_interval == 0) throw std::invalid_argument("ExportFrontCoded: zero restart interval");
+    }
+
+    auto Write(const Trie& trie) -> size_t {
+        writer_.Buffer() += kFrontCodedMagic;
+        writer_.Buffer().push_back(static_cast<char>(Codec::kId));
+        PutVarint(writer_.Buffer(), options_.restart_interval);
+        std::string key;
+        if (const auto& root = TrieAccess::Root(trie)) Visit(root.get(), key);
+        FinishBlock();
+
+        const uint64_t index_offset = writer_.BytesWritten();
+        std::string& out = writer_.Buffer();
+        out.push_back(0);
+        for (const auto& block : index_) {
+            PutVarint(out, block.first_key.size());
+            out += block.first_key;
+            PutVarint(out, block.offset);
+            PutVarint(out, block.entries);
+            writer_.MaybeFlush();
+        }
+        const uint64_t blocks = index_.size();
+        out.append(reinterpret_cast<const char*>(&index_offset), 8);
+        out.append(reinterpret_cast<const char*>(&blocks), 8);
+        out.append(reinterpret_cast<const char*>(&entries_), 8);
+        out += kFrontCodedMagic;
+        writer_.Flush();
+        return writer_.BytesWritten();
+    }
+
+   private:
+    struct BlockIndex {
+        std::string first_key;
+        uint64_t offset;
+        uint64_t entries;
+    };
+
+    // Pre-order over ChildCursor, so keys come out in std::string order.
+    // `key` holds the labels along the path.
+    void Visit(const TrieNode* root, std::string& key) {
+        if (root->is_value_node_) Add(key, root);
+        std::vector<ChildCursor> path;
+        path.emplace_back(root->children_);
+        while (!path.empty()) {
+            ChildCursor& top = path.back();
+            if (top.Done()) {
+                path.pop_back();
+                if (!path.empty()) key.pop_back();
+                continue;
+            }
+            const TrieNode* child = top.Child().get();
+            key.push_back(top.Byte());
+            top.Next();
+            if (child->is_value_node_) Add(key, child);
+            path.emplace_back(child->children_);
+        }
+    }
+
+    void Add(const std::string& key, const TrieNode* node) {
+        const T* value = TrieAccess::ValueOf<T>(node);
+        if (!value) throw std::invalid_argument("ExportFrontCoded: trie holds a value of another type");
+        if (count_ == 0) first_key_ = key;
+        size_t shared = 0;
+        if (count_ % options_.restart_interval == 0) {
+            restarts_.push_back(static_cast<uint32_t>(keys_.size()));
+        } else {
+            const size_t limit = std::min(key.size(), last_key_.size());
+            while (shared < limit && key[shared] == last_key_[shared]) ++shared;
+        }
+        PutVarint(keys_, shared);
+        PutVarint(keys_, key.size() - shared);
+        keys_.append(key, shared);
+        value_.clear();
+        ValueCodec<T>::Encode(*value, value_);
+        PutVarint(values_, value_.size());
+        values_ += value_;
+        last_key_ = key;
+        ++count_;
+        if (keys_.size() + values_.size() >= options_.block_bytes) FinishBlock();
+    }
+
+    void FinishBlock() {
+        if (count_ == 0) return;
+        for (uint32_t restart : restarts_) keys_.append(reinterpret_cast<const char*>(&restart), 4);
+        const auto restarts = static_cast<uint32_t>(restarts_.size());
+        keys_.append(reinterpret_cast<const char*>(&restarts), 4);
+        compressed_.clear();
+        Codec::Compress(values_, compressed_);
+
+        index_.push_back(BlockIndex{first_key_, writer_.BytesWritten(), count_});
+        std::string& out = writer_.Buffer();
+        out.push_back(1);
+        PutVarint(out, count_);
+        PutVarint(out, keys_.size());
+        out += keys_;
+        PutVarint(out, values_.size());
+        PutVarint(out, compressed_.size());
+        out += compressed_;
+        writer_.MaybeFlush();
+
+        entries_ += count_;
+        count_ = 0;
+        keys_.clear();
+        values_.clear();
+        restarts_.clear();
+    }
+
+    TrieWriter<Sink> writer_;
+    const FrontCodingOptions options_;
+    std::vector<BlockIndex> index_;
+    uint64_t entries_{0};
+
+    // The open block.
+    uint64_t count_{0};
+    std::string first_key_;
+    std::string last_key_;
+    std::string keys_;
+    std::string values_;
+    std::vector<uint32_t> restarts_;
+    std::string value_;
+    std::string compressed_;
+};
+
+inline auto LoadFixed64(const char* at) -> uint64_t {
+    uint64_t value;
+    std::memcpy(&value, at, 8);
+    return value;
+}
+
+// Decode the entry at the front of `in` into `key`, which holds the previous
+// key of the block.
+inline void NextFrontCodedKey(std::string_view& in, std::string& key) {
+    const uint64_t shared = GetVarint(in);
+    const uint64_t suffix = GetVarint(in);
+    if (shared > key.size() || in.size() < suffix) throw std::runtime_error("front-coded block: corrupt key");
+    key.resize(shared);
+    key.append(in.data(), suffix);
+    in.remove_prefix(suffix);
+}
+
+}  // namespace detail
+
+// Write `trie`, whose values must all be of type T, in the front-coded format
+// to `sink` (a callable taking (const char* data, size_t size)), compressing
+// values with `Codec`. Returns the number of bytes written.
+template <class T, class Codec = LzCompression, class Sink,
+          class = std::enable_if_t<!std::is_base_of_v<std::ios_base, Sink>>>
+auto ExportFrontCoded(const Trie& trie, Sink sink, FrontCodingOptions options = {}) -> size_t {
+    detail::FrontCodedWriter<T, Codec, Sink> writer(std::move(sink), options);
+    return writer.Write(trie);
+}
+
+template <class T, class Codec = LzCompression>
+auto ExportFrontCoded(const Trie& trie, std::ostream& out, FrontCodingOptions options = {}) -> size_t {
+    return ExportFrontCoded<T, Codec>(trie, OstreamSink(out), options);
+}
+
+// Read a trie written by ExportFrontCoded<T, Codec> from `source` (a callable
+// taking (char* data, size_t size) and returning the bytes read), one block
+// at a time. Keys arrive sorted, so they are inserted through a TrieBuilder.
+// Throws std::runtime_error on malformed input or another codec.
+template <class T, class Codec = LzCompression, class Source,
+          class = std::enable_if_t<!std::is_base_of_v<std::ios_base, Source>>>
+auto ImportFrontCoded(Source source) -> Trie {
+    TrieReader<Source> reader(std::move(source));
+    if (reader.Read(kFrontCodedMagic.size()) != kFrontCodedMagic)
+        throw std::runtime_error("ImportFrontCoded: not a front-coded trie");
+    if (reader.ReadByte() != Codec::kId) throw std::runtime_error("ImportFrontCoded: written with another codec");
+    reader.ReadVarint();
+    TrieBuilder builder;
+    std::string keys, values, key;
+    while (reader.ReadByte() == 1) {
+        const uint64_t entries = reader.ReadVarint();
+        keys.assign(reader.Read(reader.ReadVarint()));
+        const uint64_t size = reader.ReadVarint();
+        const uint64_t compressed = reader.ReadVarint();
+        values.clear();
+        Codec::Decompress(reader.Read(compressed), size, values);
+        std::string_view key_in = keys, value_in = values;
+        key.clear();
+        for (uint64_t i = 0; i < entries; ++i) {
+            detail::NextFrontCodedKey(key_in, key);
+            const uint64_t length = GetVarint(value_in);
+            if (value_in.size() < length) throw std::runtime_error("ImportFrontCoded: corrupt value");
+            builder.Put<T>(key, ValueCodec<T>::Decode(value_in.substr(0, length)));
+            value_in.remove_prefix(length);
+        }
+    }
+    // The index and footer are only needed for random access.
+    while (!reader.AtEnd()) reader.Read(1);
+    return builder.Build();
+}
+
+template <class T, class Codec = LzCompression>
+auto ImportFrontCoded(std::istream& in) -> Trie {
+    return ImportFrontCoded<T, Codec>(IstreamSource(in));
+}
+
+// A FrontCodedReader looks keys up in a front-coded image held in memory (a
+// string, a MappedTrie-style file mapping, ...) without importing it: the
+// block index narrows a lookup to one block, the restart points to a few
+// keys, and only that block's values are decompressed.
+template <class Codec = LzCompression>
+class FrontCodedReader {
+   public:
+    explicit FrontCodedReader(std::string_view image) : image_(image) {
+        if (image_.size() < kFrontCodedMagic.size() + 1 + kFrontCodedFooterSize ||
+            image_.substr(0, kFrontCodedMagic.size()) != kFrontCodedMagic ||
+            image_.substr(image_.size() - kFrontCodedMagic.size()) != kFrontCodedMagic)
+            throw std::runtime_error("FrontCodedReader: not a front-coded trie");
+        if (static_cast<uint8_t>(image_[kFrontCodedMagic.size()]) != Codec::kId)
+            throw std::runtime_error("FrontCodedReader: written with another codec");
+        std::string_view header = image_.substr(kFrontCodedMagic.size() + 1);
+        restart_interval_ = GetVarint(header);
+        const char* footer = image_.data() + image_.size() - kFrontCodedFooterSize;
+        const uint64_t index_offset = detail::LoadFixed64(footer);
+        const uint64_t blocks = detail::LoadFixed64(footer + 8);
+        entries_ = detail::LoadFixed64(footer + 16);
+        if (index_offset >= image_.size() - kFrontCodedFooterSize || image_[index_offset] != 0)
+            throw std::runtime_error("FrontCodedReader: corrupt index");
+        std::string_view in = image_.substr(index_offset + 1, image_.size() - kFrontCodedFooterSize - index_offset - 1);
+        for (uint64_t i = 0; i < blocks; ++i) {
+            const uint64_t length = GetVarint(in);
+            if (in.size() < length) throw std::runtime_error("FrontCodedReader: corrupt index");
+            first_keys_.emplace_back(in.substr(0, length));
+            in.remove_prefix(length);
+            offsets_.push_back(GetVarint(in));
+            GetVarint(in);
+        }
+    }
+
+    // The encoded value of `key`, if any.
+    auto Get(std::string_view key) const -> std::optional<std::string> {
+        auto block = std::upper_bound(first_keys_.begin(), first_keys_.end(), key);
+        if (block == first_keys_.begin()) return std::nullopt;
+        std::string_view in = image_.substr(offsets_[block - first_keys_.begin() - 1]);
+        if (in.empty() || in.front() != 1) throw std::runtime_error("FrontCodedReader: corrupt block");
+        in.remove_prefix(1);
+        const uint64_t entries = GetVarint(in);
+        const uint64_t keys_size = GetVarint(in);
+        if (in.size() < keys_size || keys_size < 4) throw std::runtime_error("FrontCodedReader: corrupt block");
+        std::string_view keys = in.substr(0, keys_size);
+        in.remove_prefix(keys_size);
+
+        // Binary search the restart keys, then scan forward from the last one
+        // not above `key`.
+        const uint32_t restarts = Load32(keys.data() + keys.size() - 4);
+        const char* restart_offsets = keys.data() + keys.size() - 4 - 4 * size_t{restarts};
+        std::string_view entries_in = keys.substr(0, keys.size() - 4 - 4 * size_t{restarts});
+        uint32_t lo = 0, hi = restarts;
+        std::string current;
+        while (hi - lo > 1) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            std::string_view at = entries_in.substr(Load32(restart_offsets + 4 * size_t{mid}));
+            current.clear();
+            detail::NextFrontCodedKey(at, current);
+            if (std::string_view(current) <= key) lo = mid;
+            else hi = mid;
+        }
+        if (restarts == 0) return std::nullopt;
+        std::string_view at = entries_in.substr(Load32(restart_offsets + 4 * size_t{lo}));
+        current.clear();
+        for (uint64_t index = lo * restart_interval_; index < entries; ++index) {
+            detail::NextFrontCodedKey(at, current);
+            if (std::string_view(current) < key) continue;
+            if (std::string_view(current) != key) return std::nullopt;
+            return Value(in, index);
+        }
+        return std::nullopt;
+    }
+
+    // The value of `key` decoded with ValueCodec<T>, if any.
+    template <class T>
+    auto GetAs(std::string_view key) const -> std::optional<T> {
+        auto bytes = Get(key);
+        if (!bytes) return std::nullopt;
+        return ValueCodec<T>::Decode(*bytes);
+    }
+
+    auto Size() const -> size_t { return entries_; }
+    auto Blocks() const -> size_t { return first_keys_.size(); }
+
+   private:
+    static auto Load32(const char* at) -> uint32_t {
+        uint32_t value;
+        std::memcpy(&value, at, 4);
+        return value;
+    }
+
+    // The `index`th value of the block whose value section starts `in`.
+    static auto Value(std::string_view in, uint64_t index) -> std::string {
+        const uint64_t size = GetVarint(in);
+        const uint64_t compressed = GetVarint(in);
+        if (in.size() < compressed) throw std::runtime_error("FrontCodedReader: corrupt block");
+        std::string values;
+        Codec::Decompress(in.substr(0, compressed), size, values);
+        std::string_view value_in = values;
+        for (uint64_t i = 0;; ++i) {
+            const uint64_t length = GetVarint(value_in);
+            if (value_in.size() < length) throw std::runtime_error("FrontCodedReader: corrupt value");
+            if (i == index) return std::string(value_in.substr(0, length));
+            value_in.remove_prefix(length);
+        }
+    }
+
+    std::string_view image_;
+    uint64_t restart_interval_{0};
+    uint64_t entries_{0};
+    std::vector<std::string> first_keys_;
+    std::vector<uint64_t> offsets_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_FRONT_CODED_HPP
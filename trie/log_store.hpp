@@ -0,0 +1,862 @@
+#ifndef SJTU_LOG_STORE_HPP
+#define SJTU_LOG_STORE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+#include "wal.hpp"
+
+namespace sjtu {
+
+struct LogStoreOptions {
+    // A new segment file is started once the active one reaches this size.
+    size_t segment_bytes{64 << 20};
+    // Decoded nodes kept in memory for reads; older ones are evicted.
+    size_t cache_nodes{1 << 16};
+    // Compaction keeps this many newest versions and drops the rest; 0 keeps
+    // every version.
+    size_t retain_versions{0};
+    // fdatasync every commit before it becomes visible.
+    bool sync{false};
+    // How often the background compactor looks at the log; 0 disables it.
+    std::chrono::milliseconds compact_interval{0};
+    // The compactor runs once there are at least this many sealed segments.
+    size_t compact_segments{4};
+};
+
+// A LogStore keeps the version history of a TrieStore whose values are of
+// type T in append-only segment files, in the style of an append-only
+// B-tree. Attach it with TrieStore::AddListener: every commit appends the
+// nodes its copy-on-write path created, followed by the new root. Nodes
+// shared with earlier versions are referenced by their address on disk, so
+// a commit writes at most one node per byte of its key.
+//
+// Reads walk the on-disk nodes through a bounded cache of decoded nodes, so
+// any retained version can be queried without holding it in memory, and
+// Load() materializes a version to restart a TrieStore from.
+//
+// For data larger than RAM, skip the TrieStore and write through Put and
+// Remove instead: they copy the key's path from disk (through the cache),
+// append the copy and a new root, and never hold more than one path and the
+// cache in memory. A log is written either this way or by a TrieStore, not
+// both.
+//
+// Compact() (or the background compactor) copies the nodes reachable from
+// the retained versions into a fresh segment and deletes the old ones;
+// commits continue while the bulk of the copy runs and only wait for the
+// final catch-up.
+//
+// Segment "seg-<id>.log" starts with "SJTULOGS" and holds frames of
+//   u32 payload length, u32 CRC-32 of the payload,
+//   payload: nodes, u64 version, u64 root address
+// where a frame with version 2^64 - 1 only carries nodes and a frame with
+// root address 2^64 - 1 withdraws its version (the commit was abandoned after
+// it was logged, see OnAbort). A node is
+//   varint body length, flags (bit 0: has value), varint fanout,
+//   `fanout` labels, `fanout` varint child addresses, [varint length, value]
+// and its address is (segment id << 40) | offset of the node in the segment.
+// Root address 0 is the empty trie. A torn frame at the end of the newest
+// segment is cut off on open. A commit whose write or sync fails is cut off
+// right away; if that fails too, every later write throws.
+template <class T>
+class LogStore : public CommitListener {
+   public:
+    explicit LogStore(std::string dir, LogStoreOptions options = {})
+        : dir_(std::move(dir)), options_(options) {
+        std::filesystem::create_directories(dir_);
+        Open();
+        if (options_.compact_interval.count() > 0) compactor_ = std::thread([this] { CompactLoop(); });
+    }
+
+    LogStore(const LogStore&) = delete;
+    auto operator=(const LogStore&) -> LogStore& = delete;
+
+    ~LogStore() override {
+        {
+            std::lock_guard<std::mutex> lock(stop_lock_);
+            stopping_ = true;
+        }
+        stop_.notify_all();
+        if (compactor_.joinable()) compactor_.join();
+        for (const auto& segment : segments_) ::close(segment.second.fd);
+        if (active_fd_ >= 0) ::close(active_fd_);
+    }
+
+    // Throws, and so abandons the commit, if the log has been written
+    // through Put and Remove, or if `commit` is not newer than the newest
+    // version in the log, e.g. when a reopened log is attached to a store
+    // that was not restored from it.
+    void OnCommit(const Commit& commit) override {
+        std::lock_guard<std::mutex> writer(writer_lock_);
+        if (!error_.empty()) throw std::runtime_error(error_);
+        if (direct_) throw std::runtime_error("LogStore: a log written through Put and Remove cannot take commits");
+        // writer_lock_ keeps index_ as it is.
+        if (!index_.empty() && commit.version <= index_.back().first)
+            throw std::runtime_error("LogStore: commit of version " + std::to_string(commit.version) +
+                                     " does not follow version " + std::to_string(index_.back().first));
+        listening_ = true;
+        if (active_size_ >= options_.segment_bytes) Roll();
+        Batch batch(this, active_, active_size_);
+        Written written;
+        uint64_t root = 0;
+        Append(batch, [&] {
+            if (const auto& node = TrieAccess::Root(commit.trie)) root = WriteTree(node, batch, written);
+            batch.Finish(commit.version, root);
+        });
+        for (const auto& [node, address] : written) known_[node->get()] = Known{*node, address};
+        nodes_written_ += written.size();
+        Prune();
+        std::unique_lock<std::shared_mutex> lock(lock_);
+        segments_[active_].size = active_size_;
+        index_.emplace_back(commit.version, root);
+    }
+
+    // The nodes already written stay in the log unreferenced; the version is
+    // withdrawn on disk so that reopening does not resurrect it, and the next
+    // commit reuses its number.
+    void OnAbort(size_t version) override {
+        std::lock_guard<std::mutex> writer(writer_lock_);
+        {
+            std::unique_lock<std::shared_mutex> lock(lock_);
+            if (index_.empty() || index_.back().first != version) return;
+            index_.pop_back();
+        }
+        if (!error_.empty()) return;
+        try {
+            Batch batch(this, active_, active_size_);
+            Append(batch, [&] { batch.Finish(version, kWithdrawn); });
+        } catch (const std::exception&) {
+            // The version stays in the log until the next commit, which gets
+            // the same number and replaces it on open.
+        }
+        std::unique_lock<std::shared_mutex> lock(lock_);
+        segments_[active_].size = active_size_;
+    }
+
+    // Set `key` to `value` in a new version built on the newest one. Returns
+    // the new version number. Throws std::runtime_error if the log has taken
+    // commits as a listener.
+    auto Put(std::string_view key, const T& value) -> size_t {
+        std::string encoded;
+        ValueCodec<T>::Encode(value, encoded);
+        return Write(key, &encoded);
+    }
+
+    // Remove `key` in a new version built on the newest one. Returns the
+    // version number after the operation, which is unchanged if the key does
+    // not exist. Throws as Put does.
+    auto Remove(std::string_view key) -> size_t { return Write(key, nullptr); }
+
+    // The value of `key` in `version` (default: newest version), read from
+    // disk. Returns std::nullopt if the key or the version does not exist.
+    auto Get(std::string_view key, size_t version = -1) -> std::optional<T> {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        auto root = FindRoot(version);
+        if (!root || *root == 0) return std::nullopt;
+        uint64_t address = *root;
+        for (char c : key) {
+            auto node = CachedNode(address);
+            size_t i = node->labels.find(c);
+            if (i == std::string::npos) return std::nullopt;
+            address = node->children[i];
+        }
+        auto node = CachedNode(address);
+        if (!node->has_value) return std::nullopt;
+        return ValueCodec<T>::Decode(node->value);
+    }
+
+    // Materialize `version` (default: newest version) as a Trie, e.g. to
+    // restart a TrieStore with TrieStore::Restore. Later commits on top of it
+    // only append what they change.
+    auto Load(size_t version = -1) -> std::optional<std::pair<size_t, Trie>> {
+        std::lock_guard<std::mutex> writer(writer_lock_);
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        if (version == static_cast<size_t>(-1)) {
+            if (index_.empty()) return std::nullopt;
+            version = index_.back().first;
+        }
+        auto root = FindRoot(version);
+        if (!root) return std::nullopt;
+        if (*root == 0) return std::make_pair(version, Trie());
+        return std::make_pair(version, TrieAccess::Make(LoadTree(*root)));
+    }
+
+    // The newest version in the log, if any.
+    auto NewestVersion() -> std::optional<size_t> {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        if (index_.empty()) return std::nullopt;
+        return index_.back().first;
+    }
+
+    // The oldest version that can still be read, if any.
+    auto OldestVersion() -> std::optional<size_t> {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        if (index_.empty()) return std::nullopt;
+        return index_.front().first;
+    }
+
+    auto SegmentCount() -> size_t {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        return segments_.size();
+    }
+
+    auto DiskBytes() -> size_t {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        size_t bytes = 0;
+        for (const auto& segment : segments_) bytes += segment.second.size;
+        return bytes;
+    }
+
+    // Nodes appended by commits since the store was opened.
+    auto NodesWritten() -> size_t {
+        std::lock_guard<std::mutex> writer(writer_lock_);
+        return nodes_written_;
+    }
+
+    // Copy the nodes reachable from the retained versions into a new segment
+    // and delete every other segment.
+    void Compact() {
+        std::lock_guard<std::mutex> compacting(compact_lock_);
+        std::vector<std::pair<size_t, uint64_t>> roots;
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> writer(writer_lock_);
+            std::shared_lock<std::shared_mutex> lock(lock_);
+            size_t keep = options_.retain_versions ? std::min(options_.retain_versions, index_.size()) : index_.size();
+            roots.assign(index_.end() - keep, index_.end());
+            id = next_id_++;
+        }
+        const std::string tmp = SegmentPath(id) + ".compact";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("LogStore: cannot create " + tmp);
+        uint64_t size = kMagic.size();
+        std::unordered_map<uint64_t, uint64_t> moved;
+        std::vector<std::pair<size_t, uint64_t>> copied;
+
+        // Copy the bulk while commits go on, then catch up with the versions
+        // committed in the meantime while commits wait.
+        auto copy = [&](const std::vector<std::pair<size_t, uint64_t>>& versions) {
+            Batch batch(fd, id, size, tmp);
+            for (const auto& [version, root] : versions) {
+                copied.emplace_back(version, root ? CopyTree(root, batch, moved) : 0);
+                batch.Finish(version, copied.back().second);
+            }
+        };
+        std::unique_lock<std::mutex> writer(writer_lock_, std::defer_lock);
+        try {
+            detail::WriteAll(fd, kMagic.data(), kMagic.size(), tmp);
+            copy(roots);
+            writer.lock();
+            // writer_lock_ keeps index_ as it is; CopyTree takes lock_ itself.
+            std::vector<std::pair<size_t, uint64_t>> rest;
+            {
+                std::shared_lock<std::shared_mutex> lock(lock_);
+                for (const auto& entry : index_)
+                    if (roots.empty() || entry.first > roots.back().first) rest.push_back(entry);
+            }
+            copy(rest);
+            if (::fdatasync(fd) != 0) throw std::runtime_error("LogStore: cannot sync " + tmp);
+            detail::CommitFile(tmp, SegmentPath(id));
+        } catch (...) {
+            // The rename may have happened before the directory sync failed.
+            ::close(fd);
+            std::filesystem::remove(tmp);
+            std::filesystem::remove(SegmentPath(id));
+            throw;
+        }
+
+        std::vector<uint32_t> old;
+        {
+            std::unique_lock<std::shared_mutex> lock(lock_);
+            for (const auto& segment : segments_) {
+                ::close(segment.second.fd);
+                old.push_back(segment.first);
+            }
+            segments_.clear();
+            segments_[id] = Segment{fd, size};
+            index_ = std::move(copied);
+            std::lock_guard<std::mutex> cache(cache_lock_);
+            cache_.clear();
+            lru_.clear();
+        }
+        for (auto it = known_.begin(); it != known_.end();) {
+            auto address = moved.find(it->second.address);
+            if (address == moved.end() || it->second.node.expired()) {
+                it = known_.erase(it);
+            } else {
+                it->second.address = address->second;
+                ++it;
+            }
+        }
+        ::close(active_fd_);
+        active_fd_ = -1;
+        try {
+            Roll();
+        } catch (const std::exception& e) {
+            // The compacted segment is in place, but there is no active
+            // segment left to append to.
+            error_ = std::string("LogStore: no active segment after compaction: ") + e.what();
+            throw;
+        }
+        // Newest first: a segment only references itself and older ones, so
+        // the survivors of a crash here are still readable.
+        std::sort(old.rbegin(), old.rend());
+        for (uint32_t segment : old) std::filesystem::remove(SegmentPath(segment));
+    }
+
+   private:
+    static constexpr std::string_view kMagic{"SJTULOGS", 8};
+    static constexpr int kOffsetBits = 40;
+    static constexpr uint64_t kNoVersion = static_cast<uint64_t>(-1);
+    static constexpr uint64_t kWithdrawn = static_cast<uint64_t>(-1);
+    static constexpr size_t kFrameHeader = 8;
+    static constexpr size_t kBatchBytes = 1 << 20;
+
+    struct Segment {
+        int fd;
+        uint64_t size;
+    };
+
+    struct Known {
+        std::weak_ptr<TrieNode> node;
+        uint64_t address;
+    };
+
+    struct DiskNode {
+        bool has_value{false};
+        std::string labels;
+        std::vector<uint64_t> children;
+        std::string value;
+    };
+
+    // A Batch collects nodes into a frame. Node addresses are assigned as
+    // they are added; Finish (or a full payload) writes the frame.
+    class Batch {
+       public:
+        Batch(LogStore* store, uint32_t id, uint64_t& size)
+            : Batch(store->active_fd_, id, size, store->SegmentPath(id)) {}
+        Batch(int fd, uint32_t id, uint64_t& size, std::string path)
+            : fd_(fd), id_(id), size_(size), start_(size), path_(std::move(path)) {}
+
+        // The address the next node will get.
+        auto NextAddress() const -> uint64_t {
+            return (uint64_t{id_} << kOffsetBits) | (size_ + kFrameHeader + payload_.size());
+        }
+
+        auto Payload() -> std::string& { return payload_; }
+
+        // Write the nodes so far as a frame of their own if the payload is
+        // large.
+        void MaybeFlush() {
+            if (payload_.size() >= kBatchBytes) Flush(kNoVersion, 0);
+        }
+
+        void Finish(size_t version, uint64_t root) { Flush(version, root); }
+
+        // Cut the file back to where the batch started, dropping whatever
+        // part of its frames reached it. Returns false if that fails.
+        auto Rollback() -> bool {
+            payload_.clear();
+            if (::ftruncate(fd_, static_cast<off_t>(start_)) != 0) return false;
+            size_ = start_;
+            return true;
+        }
+
+       private:
+        void Flush(uint64_t version, uint64_t root) {
+            payload_.append(reinterpret_cast<const char*>(&version), 8);
+            payload_.append(reinterpret_cast<const char*>(&root), 8);
+            std::string frame;
+            detail::AppendFixed32(frame, static_cast<uint32_t>(payload_.size()));
+            detail::AppendFixed32(frame, detail::Crc32(payload_));
+            frame += payload_;
+            detail::WriteAll(fd_, frame.data(), frame.size(), path_);
+            size_ += frame.size();
+            payload_.clear();
+        }
+
+        int fd_;
+        uint32_t id_;
+        uint64_t& size_;
+        const uint64_t start_;
+        std::string path_;
+        std::string payload_;
+    };
+
+    auto SegmentPath(uint32_t id) const -> std::string {
+        char name[32];
+        std::snprintf(name, sizeof(name), "seg-%010u.log", id);
+        return dir_ + "/" + name;
+    }
+
+    // Scan the segments into the version index, cut off a torn tail and start
+    // a new active segment.
+    void Open() {
+        std::vector<uint32_t> ids;
+        for (const auto& entry : std::filesystem::directory_iterator(dir_)) {
+            const std::string name = entry.path().filename().string();
+            if (name.size() > 8 && name.compare(name.size() - 8, 8, ".compact") == 0)
+                std::filesystem::remove(entry.path());
+            else if (name.size() == 18 && name.compare(0, 4, "seg-") == 0 && name.compare(14, 4, ".log") == 0)
+                ids.push_back(static_cast<uint32_t>(std::stoul(name.substr(4, 10))));
+        }
+        std::sort(ids.begin(), ids.end());
+        // A later segment's root for a version (a compacted copy) wins.
+        std::map<size_t, uint64_t> roots;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const std::string path = SegmentPath(ids[i]);
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) throw std::runtime_error("LogStore: cannot open " + path);
+            uint64_t size = ScanSegment(fd, path, roots, i + 1 == ids.size());
+            segments_[ids[i]] = Segment{fd, size};
+        }
+        for (const auto& entry : roots) index_.push_back(entry);
+        next_id_ = ids.empty() ? 1 : ids.back() + 1;
+        Roll();
+    }
+
+    auto ScanSegment(int fd, const std::string& path, std::map<size_t, uint64_t>& roots, bool newest) -> uint64_t {
+        const uint64_t file_size = std::filesystem::file_size(path);
+        char magic[8];
+        if (file_size < kMagic.size() || ::pread(fd, magic, 8, 0) != 8 || std::string_view(magic, 8) != kMagic)
+            throw std::runtime_error("LogStore: not a log segment: " + path);
+        uint64_t offset = kMagic.size();
+        std::string payload;
+        while (offset + kFrameHeader <= file_size) {
+            char header[kFrameHeader];
+            if (::pread(fd, header, kFrameHeader, static_cast<off_t>(offset)) != kFrameHeader) break;
+            const uint32_t length = detail::LoadFixed32(header);
+            if (length < 16 || offset + kFrameHeader + length > file_size) break;
+            payload.resize(length);
+            if (::pread(fd, payload.data(), length, static_cast<off_t>(offset + kFrameHeader)) != length ||
+                detail::Crc32(payload) != detail::LoadFixed32(header + 4))
+                break;
+            uint64_t version, root;
+            std::memcpy(&version, payload.data() + length - 16, 8);
+            std::memcpy(&root, payload.data() + length - 8, 8);
+            if (version != kNoVersion && root == kWithdrawn) roots.erase(version);
+            else if (version != kNoVersion) roots[version] = root;
+            offset += kFrameHeader + length;
+        }
+        if (offset != file_size) {
+            if (!newest) throw std::runtime_error("LogStore: corrupt segment " + path);
+            std::filesystem::resize_file(path, offset);
+        }
+        return offset;
+    }
+
+    // Start a new active segment. The caller must hold writer_lock_ or be
+    // opening the store.
+    void Roll() {
+        if (active_fd_ >= 0) {
+            const bool synced = ::fdatasync(active_fd_) == 0;
+            const bool closed = ::close(active_fd_) == 0;
+            active_fd_ = -1;
+            if (!synced || !closed) throw std::runtime_error("LogStore: cannot seal " + SegmentPath(active_));
+        }
+        active_ = next_id_++;
+        const std::string path = SegmentPath(active_);
+        active_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        int read_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (active_fd_ < 0 || read_fd < 0) throw std::runtime_error("LogStore: cannot create " + path);
+        detail::WriteAll(active_fd_, kMagic.data(), kMagic.size(), path);
+        active_size_ = kMagic.size();
+        std::unique_lock<std::shared_mutex> lock(lock_);
+        segments_[active_] = Segment{read_fd, active_size_};
+    }
+
+    // Run `write`, which appends a commit to the active segment through
+    // `batch`, and sync it if configured. If a write or sync fails, part of a
+    // frame may be on disk, so the segment is cut back to where the batch
+    // started; if even that fails, the addresses of later commits would not
+    // match the file and the store stops taking writes. The caller must hold
+    // writer_lock_.
+    template <class F>
+    void Append(Batch& batch, F&& write) {
+        try {
+            write();
+            if (options_.sync && ::fdatasync(active_fd_) != 0) throw std::runtime_error("LogStore: cannot sync");
+        } catch (...) {
+            if (!batch.Rollback())
+                error_ = "LogStore: cannot cut back " + SegmentPath(active_) + " after a failed write";
+            throw;
+        }
+    }
+
+    // The root address of `version`. The caller must hold lock_.
+    auto FindRoot(size_t version) const -> std::optional<uint64_t> {
+        if (index_.empty()) return std::nullopt;
+        if (version == static_cast<size_t>(-1)) return index_.back().second;
+        auto it = std::lower_bound(index_.begin(), index_.end(), std::make_pair(version, uint64_t{0}));
+        if (it == index_.end() || it->first != version) return std::nullopt;
+        return it->second;
+    }
+
+    // Path-copy `key` in the newest version, setting its value to `*value`
+    // or removing it, and append the result as the next version.
+    auto Write(std::string_view key, const std::string* value) -> size_t {
+        std::lock_guard<std::mutex> writer(writer_lock_);
+        if (!error_.empty()) throw std::runtime_error(error_);
+        if (listening_) throw std::runtime_error("LogStore: a log that takes commits cannot be written through Put");
+        direct_ = true;
+        // path[i] is the node at depth i, or an empty node where the key
+        // leaves the trie.
+        std::vector<DiskNode> path;
+        size_t version;
+        {
+            std::shared_lock<std::shared_mutex> lock(lock_);
+            version = index_.empty() ? 0 : index_.back().first;
+            uint64_t address = index_.empty() ? 0 : index_.back().second;
+            for (size_t depth = 0;; ++depth) {
+                if (address == 0 && !value) return version;
+                path.push_back(address ? *CachedNode(address) : DiskNode());
+                if (depth == key.size()) break;
+                const size_t i = path.back().labels.find(key[depth]);
+                address = i == std::string::npos ? 0 : path.back().children[i];
+            }
+        }
+        if (!value && !path.back().has_value) return version;
+        path.back().has_value = value != nullptr;
+        path.back().value = value ? *value : std::string();
+
+        if (active_size_ >= options_.segment_bytes) Roll();
+        Batch batch(this, active_, active_size_);
+        uint64_t child = 0;
+        size_t written = 0;
+        Append(batch, [&] {
+            for (size_t depth = path.size(); depth-- > 0;) {
+                DiskNode& node = path[depth];
+                if (depth < key.size()) {
+                    // Labels are kept in the order of TrieNode's children.
+                    auto label = std::lower_bound(node.labels.begin(), node.labels.end(), key[depth]);
+                    const size_t i = label - node.labels.begin();
+                    const bool present = label != node.labels.end() && *label == key[depth];
+                    if (child == 0 && present) {
+                        node.labels.erase(i, 1);
+                        node.children.erase(node.children.begin() + i);
+                    } else if (child != 0 && present) {
+                        node.children[i] = child;
+                    } else if (child != 0) {
+                        node.labels.insert(i, 1, key[depth]);
+                        node.children.insert(node.children.begin() + i, child);
+                    }
+                }
+                // A node left without value or children is dropped.
+                if (!node.has_value && node.labels.empty()) {
+                    child = 0;
+                    continue;
+                }
+                child = batch.NextAddress();
+                AppendNode(batch.Payload(), node.has_value, node.labels, node.children, node.value);
+                batch.MaybeFlush();
+                ++written;
+            }
+            batch.Finish(version + 1, child);
+        });
+        nodes_written_ += written;
+        std::unique_lock<std::shared_mutex> lock(lock_);
+        segments_[active_].size = active_size_;
+        index_.emplace_back(version + 1, child);
+        return version + 1;
+    }
+
+    using Written = std::vector<std::pair<const std::shared_ptr<TrieNode>*, uint64_t>>;
+
+    // Post-order, stopping at nodes already on disk.
+    auto WriteTree(const std::shared_ptr<TrieNode>& root, Batch& batch, Written& written) -> uint64_t {
+        if (auto address = Lookup(root)) return *address;
+        struct Frame {
+            const std::shared_ptr<TrieNode>* node;
+            std::map<char, std::shared_ptr<TrieNode>>::const_iterator next;
+            std::vector<uint64_t> children;
+        };
+        // The nodes on the current path, each with its next child and the
+        // addresses of the children before it.
+        std::vector<Frame> path;
+        path.push_back(Frame{&root, root->children_.begin(), {}});
+        uint64_t address = 0;
+        while (!path.empty()) {
+            Frame& top = path.back();
+            if (top.next != (*top.node)->children_.end()) {
+                const std::shared_ptr<TrieNode>& child = (top.next++)->second;
+                if (auto known = Lookup(child)) top.children.push_back(*known);
+                else path.push_back(Frame{&child, child->children_.begin(), {}});
+                continue;
+            }
+            address = WriteNode(*top.node, top.children, batch, written);
+            path.pop_back();
+            if (!path.empty()) path.back().children.push_back(address);
+        }
+        return address;
+    }
+
+    // The address of `node` if it is on disk. An entry is only trusted while
+    // its node is alive: a dead node's address may have been reused.
+    auto Lookup(const std::shared_ptr<TrieNode>& node) const -> std::optional<uint64_t> {
+        auto it = known_.find(node.get());
+        if (it == known_.end() || it->second.node.expired()) return std::nullopt;
+        return it->second.address;
+    }
+
+    // Append one node whose children are at `children`.
+    auto WriteNode(const std::shared_ptr<TrieNode>& node, const std::vector<uint64_t>& children, Batch& batch,
+                   Written& written) -> uint64_t {
+        value_.clear();
+        if (node->is_value_node_) {
+            const T* value = TrieAccess::ValueOf<T>(node.get());
+            if (!value) throw std::invalid_argument("LogStore: value of another type");
+            ValueCodec<T>::Encode(*value, value_);
+        }
+        std::string labels;
+        for (const auto& child : node->children_) labels.push_back(child.first);
+        const uint64_t address = batch.NextAddress();
+        AppendNode(batch.Payload(), node->is_value_node_, labels, children, value_);
+        batch.MaybeFlush();
+        written.emplace_back(&node, address);
+        return address;
+    }
+
+    // Copy the node at `address` and everything below it into `batch`,
+    // skipping what has been copied already. Returns the new address.
+    auto CopyTree(uint64_t address, Batch& batch, std::unordered_map<uint64_t, uint64_t>& moved) -> uint64_t {
+        if (auto it = moved.find(address); it != moved.end()) return it->second;
+        struct Frame {
+            uint64_t address;
+            DiskNode node;
+            // Children before this one have been copied and hold their new
+            // addresses.
+            size_t next;
+        };
+        std::vector<Frame> path;
+        path.push_back(Frame{address, ReadShared(address), 0});
+        for (;;) {
+            Frame& top = path.back();
+            if (top.next < top.node.children.size()) {
+                const uint64_t child = top.node.children[top.next];
+                if (auto it = moved.find(child); it != moved.end()) {
+                    top.node.children[top.next++] = it->second;
+                } else {
+                    DiskNode node = ReadShared(child);
+                    path.push_back(Frame{child, std::move(node), 0});
+                }
+                continue;
+            }
+            const uint64_t copy = batch.NextAddress();
+            AppendNode(batch.Payload(), top.node.has_value, top.node.labels, top.node.children, top.node.value);
+            batch.MaybeFlush();
+            moved.emplace(top.address, copy);
+            if (path.size() == 1) return copy;
+            path.pop_back();
+        }
+    }
+
+    // ReadNode under lock_, for callers that do not hold it.
+    auto ReadShared(uint64_t address) -> DiskNode {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        return ReadNode(address);
+    }
+
+    static void AppendNode(std::string& out, bool has_value, std::string_view labels,
+                           const std::vector<uint64_t>& children, std::string_view value) {
+        std::string body;
+        body.push_back(static_cast<char>(has_value ? 1 : 0));
+        PutVarint(body, labels.size());
+        body += labels;
+        for (uint64_t child : children) PutVarint(body, child);
+        if (has_value) {
+            PutVarint(body, value.size());
+            body += value;
+        }
+        PutVarint(out, body.size());
+        out += body;
+    }
+
+    // Read and decode the node at `address`. The caller must hold lock_.
+    auto ReadNode(uint64_t address) const -> DiskNode {
+        auto segment = segments_.find(static_cast<uint32_t>(address >> kOffsetBits));
+        if (segment == segments_.end()) throw std::runtime_error("LogStore: dangling node address");
+        const off_t offset = static_cast<off_t>(address & ((uint64_t{1} << kOffsetBits) - 1));
+        std::string bytes(256, '\0');
+        ssize_t got = ::pread(segment->second.fd, bytes.data(), bytes.size(), offset);
+        if (got <= 0) throw std::runtime_error("LogStore: cannot read node");
+        bytes.resize(static_cast<size_t>(got));
+        std::string_view in = bytes;
+        const uint64_t length = GetVarint(in);
+        const size_t header = bytes.size() - in.size();
+        if (in.size() < length) {
+            bytes.resize(header + length);
+            if (::pread(segment->second.fd, bytes.data(), bytes.size(), offset) != static_cast<ssize_t>(bytes.size()))
+                throw std::runtime_error("LogStore: truncated node");
+        }
+        in = std::string_view(bytes).substr(header, length);
+
+        DiskNode node;
+        node.has_value = in.front() & 1;
+        in.remove_prefix(1);
+        const uint64_t fanout = GetVarint(in);
+        if (fanout > 256 || in.size() < fanout) throw std::runtime_error("LogStore: corrupt node");
+        node.labels.assign(in.substr(0, fanout));
+        in.remove_prefix(fanout);
+        node.children.resize(fanout);
+        for (auto& child : node.children) child = GetVarint(in);
+        if (node.has_value) {
+            const uint64_t size = GetVarint(in);
+            if (in.size() < size) throw std::runtime_error("LogStore: corrupt value");
+            node.value.assign(in.substr(0, size));
+        }
+        return node;
+    }
+
+    // The node at `address` through the cache. The caller must hold lock_.
+    auto CachedNode(uint64_t address) -> std::shared_ptr<const DiskNode> {
+        {
+            std::lock_guard<std::mutex> cache(cache_lock_);
+            auto it = cache_.find(address);
+            if (it != cache_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second.second);
+                return it->second.first;
+            }
+        }
+        auto node = std::make_shared<const DiskNode>(ReadNode(address));
+        std::lock_guard<std::mutex> cache(cache_lock_);
+        if (cache_.count(address) || options_.cache_nodes == 0) return node;
+        lru_.push_front(address);
+        cache_.emplace(address, std::make_pair(node, lru_.begin()));
+        while (cache_.size() > options_.cache_nodes) {
+            cache_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        return node;
+    }
+
+    // Load the subtree at `address`. A node shared by several parents is
+    // loaded once. The caller must hold writer_lock_ and lock_.
+    auto LoadTree(uint64_t address) -> std::shared_ptr<TrieNode> {
+        struct Frame {
+            uint64_t address;
+            std::shared_ptr<TrieNode> node;
+            DiskNode disk;
+            size_t next;
+        };
+        std::unordered_map<uint64_t, std::shared_ptr<TrieNode>> loaded;
+        std::vector<Frame> path;
+        auto push = [&](uint64_t at) {
+            DiskNode disk = ReadNode(at);
+            std::shared_ptr<TrieNode> node;
+            if (disk.has_value)
+                node = std::make_shared<TrieNodeWithValue<T>>(std::make_shared<T>(ValueCodec<T>::Decode(disk.value)));
+            else
+                node = std::make_shared<TrieNode>();
+            path.push_back(Frame{at, std::move(node), std::move(disk), 0});
+        };
+        push(address);
+        for (;;) {
+            Frame& top = path.back();
+            if (top.next < top.disk.children.size()) {
+                // A child is attached once it is loaded, which is right away
+                // if another parent has loaded it already.
+                auto it = loaded.find(top.disk.children[top.next]);
+                if (it == loaded.end()) {
+                    push(top.disk.children[top.next]);
+                } else {
+                    top.node->children_.emplace_hint(top.node->children_.end(), top.disk.labels[top.next], it->second);
+                    ++top.next;
+                }
+                continue;
+            }
+            known_[top.node.get()] = Known{top.node, top.address};
+            loaded.emplace(top.address, top.node);
+            if (path.size() == 1) return top.node;
+            path.pop_back();
+        }
+    }
+
+    // Drop entries of dead nodes once the map has doubled since the last
+    // sweep. The caller must hold writer_lock_.
+    void Prune() {
+        if (known_.size() < prune_at_) return;
+        for (auto it = known_.begin(); it != known_.end();) {
+            if (it->second.node.expired()) it = known_.erase(it);
+            else ++it;
+        }
+        prune_at_ = std::max<size_t>(1024, known_.size() * 2);
+    }
+
+    void CompactLoop() {
+        std::unique_lock<std::mutex> lock(stop_lock_);
+        while (!stop_.wait_for(lock, options_.compact_interval, [this] { return stopping_; })) {
+            lock.unlock();
+            try {
+                if (SegmentCount() > options_.compact_segments) Compact();
+            } catch (const std::exception&) {
+                // The old segments are intact; the next round tries again.
+            }
+            lock.lock();
+        }
+    }
+
+    const std::string dir_;
+    const LogStoreOptions options_;
+
+    // Serializes commits and the catch-up phase of compaction; guards the
+    // active segment, known_ and next_id_.
+    std::mutex writer_lock_;
+    int active_fd_{-1};
+    uint32_t active_{0};
+    uint64_t active_size_{0};
+    uint32_t next_id_{1};
+    std::unordered_map<const TrieNode*, Known> known_;
+    size_t prune_at_{1024};
+    size_t nodes_written_{0};
+    std::string value_;
+    // Set once a failed commit cannot be cut off the active segment, or
+    // compaction cannot open a new one.
+    std::string error_;
+    // Whether this store has been written through Put and Remove, or taken
+    // a commit as a listener. A log is written one way only.
+    bool direct_{false};
+    bool listening_{false};
+
+    // Guards the segment files and the version index. Readers share it.
+    std::shared_mutex lock_;
+    std::map<uint32_t, Segment> segments_;
+    std::vector<std::pair<size_t, uint64_t>> index_;
+
+    std::mutex cache_lock_;
+    std::unordered_map<uint64_t, std::pair<std::shared_ptr<const DiskNode>, std::list<uint64_t>::iterator>> cache_;
+    std::list<uint64_t> lru_;
+
+    std::mutex compact_lock_;
+    std::mutex stop_lock_;
+    std::condition_variable stop_;
+    bool stopping_{false};
+    std::thread compactor_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_LOG_STORE_HPP
@@ -0,0 +1,381 @@
+#ifndef SJTU_MAPPED_TRIE_HPP
+#define SJTU_MAPPED_TRIE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+
+namespace sjtu {
+
+// The mapped trie format is read in place, without being loaded: nodes are
+// addressed by their byte offset from the start of the image, so the image
+// can live at any address (a file mapping, shared memory, ...). Everything is
+// 8-byte aligned and stored in host byte order, so an image is only read on
+// machines of the same endianness as the one that wrote it.
+//
+//   image:  "SJTUMTRI", nodes in post-order, footer
+//   node:   u16 fanout, u8 flags (bit 0: has value), u8 0, u32 value length,
+//           `fanout` labels sorted as unsigned bytes, padded to 8,
+//           `fanout` u64 child offsets, value bytes padded to 8
+//   footer: u64 root offset (0: empty trie), u64 node count,
+//           u32 format version, u32 0, "SJTUMTRI"
+//
+// Values are the bytes produced by ValueCodec<T>.
+inline constexpr std::string_view kMappedMagic{"SJTUMTRI", 8};
+inline constexpr uint32_t kMappedVersion = 1;
+inline constexpr size_t kMappedFooterSize = 32;
+
+namespace detail {
+
+template <class T, class Sink>
+class MappedImageWriter {
+   public:
+    explicit MappedImageWriter(Sink sink) : writer_(std::move(sink)) {}
+
+    void Write(const Trie& trie) {
+        writer_.Buffer() += kMappedMagic;
+        uint64_t root = 0;
+        if (const auto& node = TrieAccess::Root(trie)) root = WriteTree(node.get());
+        std::string& out = writer_.Buffer();
+        Append(out, root);
+        Append(out, nodes_);
+        Append(out, kMappedVersion);
+        Append(out, uint32_t{0});
+        out += kMappedMagic;
+        writer_.Flush();
+    }
+
+    auto BytesWritten() const -> size_t { return writer_.BytesWritten(); }
+
+   private:
+    template <class U>
+    static void Append(std::string& out, U value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(U));
+    }
+
+    static void Pad(std::string& out, size_t size) { out.append((8 - size % 8) % 8, '\0'); }
+
+    // Children go first so that the parent knows their offsets.
+    auto WriteTree(const TrieNode* root) -> uint64_t {
+        struct Frame {
+            const TrieNode* node;
+            ChildCursor next;
+            std::vector<uint64_t> offsets;
+        };
+        // The nodes on the current path, each with its next child to write
+        // and the offsets of the children written so far.
+        std::vector<Frame> path;
+        path.push_back(Frame{root, ChildCursor(root->children_), {}});
+        uint64_t offset = 0;
+        while (!path.empty()) {
+            Frame& top = path.back();
+            if (!top.next.Done()) {
+                const TrieNode* child = top.next.Child().get();
+                top.next.Next();
+                path.push_back(Frame{child, ChildCursor(child->children_), {}});
+                continue;
+            }
+            offset = WriteNode(top.node, top.offsets);
+            path.pop_back();
+            if (!path.empty()) path.back().offsets.push_back(offset);
+        }
+        return offset;
+    }
+
+    // Write one node whose children are at `offsets`, in unsigned label
+    // order.
+    auto WriteNode(const TrieNode* node, const std::vector<uint64_t>& offsets) -> uint64_t {
+        value_.clear();
+        if (node->is_value_node_) {
+            const T* v = TrieAccess::ValueOf<T>(node);
+            if (!v) throw std::invalid_argument("WriteMappedTrie: trie holds a value of another type");
+            ValueCodec<T>::Encode(*v, value_);
+            if (value_.size() > UINT32_MAX) throw std::invalid_argument("WriteMappedTrie: value of 4 GiB or more");
+        }
+
+        const uint64_t offset = writer_.BytesWritten();
+        std::string& out = writer_.Buffer();
+        Append(out, static_cast<uint16_t>(offsets.size()));
+        Append(out, static_cast<uint8_t>(node->is_value_node_ ? 1 : 0));
+        Append(out, uint8_t{0});
+        Append(out, static_cast<uint32_t>(value_.size()));
+        for (ChildCursor it(node->children_); !it.Done(); it.Next()) out.push_back(it.Byte());
+        Pad(out, offsets.size());
+        for (uint64_t child : offsets) Append(out, child);
+        out += value_;
+        Pad(out, value_.size());
+        writer_.MaybeFlush();
+        ++nodes_;
+        return offset;
+    }
+
+    TrieWriter<Sink> writer_;
+    std::string value_;
+    uint64_t nodes_{0};
+};
+
+}  // namespace detail
+
+// Write `trie`, whose values must all be of type T, as a mapped trie image
+// to `sink` (a callable taking (const char* data, size_t size)). Returns the
+// image size.
+template <class T, class Sink>
+auto WriteMappedImage(const Trie& trie, Sink sink) -> size_t {
+    detail::MappedImageWriter<T, Sink> writer(std::move(sink));
+    writer.Write(trie);
+    return writer.BytesWritten();
+}
+
+// Write `trie` as a mapped trie file at `path`. The image is written to
+// `path + ".tmp"`, synced and renamed over `path`, so processes that have the
+// old file mapped keep reading it undisturbed.
+template <class T>
+void WriteMappedTrie(const Trie& trie, const std::string& path) {
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error("WriteMappedTrie: cannot create " + tmp);
+    try {
+        WriteMappedImage<T>(trie, [fd, &tmp](const char* data, size_t size) {
+            detail::WriteAll(fd, data, size, tmp);
+        });
+        if (::fdatasync(fd) != 0) throw std::runtime_error("WriteMappedTrie: cannot sync " + tmp);
+        const int closed = ::close(fd);
+        fd = -1;
+        if (closed != 0) throw std::runtime_error("WriteMappedTrie: cannot write " + tmp);
+        detail::CommitFile(tmp, path);
+    } catch (...) {
+        if (fd >= 0) ::close(fd);
+        std::remove(tmp.c_str());
+        throw;
+    }
+}
+
+// A MappedTrie serves a mapped trie image in place. Opening a file maps it
+// read-only, so pages are faulted in on demand and shared through the page
+// cache by every process mapping the same file. Lookups never copy: values
+// are returned as views into the image, valid as long as the MappedTrie.
+// Every node is checked against the image bounds as it is reached, so a
+// truncated or corrupt image makes lookups throw std::runtime_error instead
+// of reading past the mapping.
+class MappedTrie {
+   public:
+    // Map the file at `path`. Throws std::runtime_error if it is not a mapped
+    // trie image.
+    static auto Open(const std::string& path) -> MappedTrie {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("MappedTrie: cannot open " + path);
+        try {
+            MappedTrie trie = Map(fd, path);
+            ::close(fd);
+            return trie;
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    // Map the whole file behind `fd`, e.g. a shared memory object. The
+    // mapping outlives `fd`, which the caller still closes.
+    static auto Map(int fd, const std::string& name) -> MappedTrie {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) throw std::runtime_error("MappedTrie: cannot stat " + name);
+        void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) throw std::runtime_error("MappedTrie: cannot map " + name);
+        ::madvise(data, static_cast<size_t>(st.st_size), MADV_RANDOM);
+        return MappedTrie(static_cast<const char*>(data), static_cast<size_t>(st.st_size), true);
+    }
+
+    // View an image already in memory (8-byte aligned), without owning it.
+    static auto View(const char* data, size_t size) -> MappedTrie { return MappedTrie(data, size, false); }
+
+    MappedTrie(const MappedTrie&) = delete;
+    auto operator=(const MappedTrie&) -> MappedTrie& = delete;
+
+    MappedTrie(MappedTrie&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+          root_(other.root_), nodes_(other.nodes_), owned_(std::exchange(other.owned_, false)) {}
+
+    auto operator=(MappedTrie&& other) noexcept -> MappedTrie& {
+        if (this != &other) {
+            Unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            root_ = other.root_;
+            nodes_ = other.nodes_;
+            owned_ = std::exchange(other.owned_, false);
+        }
+        return *this;
+    }
+
+    ~MappedTrie() { Unmap(); }
+
+    // The encoded value of `key`, if any.
+    auto Get(std::string_view key) const -> std::optional<std::string_view> {
+        uint64_t node = root_;
+        for (size_t i = 0; i < key.size() && node; ++i) node = Child(node, key[i]);
+        if (!node || !HasValue(node)) return std::nullopt;
+        return Value(node);
+    }
+
+    // The value of `key` decoded with ValueCodec<T>, if any.
+    template <class T>
+    auto GetAs(std::string_view key) const -> std::optional<T> {
+        auto bytes = Get(key);
+        if (!bytes) return std::nullopt;
+        return ValueCodec<T>::Decode(*bytes);
+    }
+
+    // Call `callback(key, value)` for every key starting with `prefix`, in
+    // std::string order. Returning false from the callback stops the scan.
+    template <class F>
+    void Scan(std::string_view prefix, F&& callback) const {
+        uint64_t node = root_;
+        for (size_t i = 0; i < prefix.size() && node; ++i) node = Child(node, prefix[i]);
+        if (!node) return;
+        std::string key(prefix);
+        ScanTree(node, key, callback);
+    }
+
+    // The longest prefix of `key` that has a value, with that value.
+    auto LongestPrefixMatch(std::string_view key) const
+        -> std::optional<std::pair<std::string_view, std::string_view>> {
+        std::optional<std::pair<std::string_view, std::string_view>> best;
+        uint64_t node = root_;
+        for (size_t i = 0; node; ++i) {
+            if (HasValue(node)) best.emplace(key.substr(0, i), Value(node));
+            if (i == key.size()) break;
+            node = Child(node, key[i]);
+        }
+        return best;
+    }
+
+    auto NodeCount() const -> size_t { return nodes_; }
+    auto Size() const -> size_t { return size_; }
+
+   private:
+    MappedTrie(const char* data, size_t size, bool owned) : data_(data), size_(size), owned_(owned) {
+        if (size_ < kMappedMagic.size() + kMappedFooterSize ||
+            std::string_view(data_, kMappedMagic.size()) != kMappedMagic ||
+            std::string_view(data_ + size_ - kMappedMagic.size(), kMappedMagic.size()) != kMappedMagic) {
+            Unmap();
+            throw std::runtime_error("MappedTrie: not a mapped trie image");
+        }
+        const char* footer = data_ + size_ - kMappedFooterSize;
+        root_ = Load<uint64_t>(footer);
+        nodes_ = Load<uint64_t>(footer + 8);
+        if (Load<uint32_t>(footer + 16) != kMappedVersion || root_ >= size_ - kMappedFooterSize) {
+            Unmap();
+            throw std::runtime_error("MappedTrie: unsupported or corrupt image");
+        }
+        if (root_) {
+            try {
+                CheckNode(root_);
+            } catch (...) {
+                Unmap();
+                throw;
+            }
+        }
+    }
+
+    void Unmap() {
+        if (owned_ && data_) ::munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        owned_ = false;
+    }
+
+    template <class U>
+    auto Load(const char* at) const -> U {
+        U value;
+        std::memcpy(&value, at, sizeof(U));
+        return value;
+    }
+
+    // Throws unless the node at `node`, with its labels, child offsets and
+    // value, lies between the magic and the footer.
+    void CheckNode(uint64_t node) const {
+        const uint64_t limit = size_ - kMappedFooterSize;
+        if (node < kMappedMagic.size() || node > limit || limit - node < 8)
+            throw std::runtime_error("MappedTrie: node offset out of bounds");
+        const uint64_t fanout = Load<uint16_t>(data_ + node);
+        const uint64_t value = Load<uint32_t>(data_ + node + 4);
+        if (fanout > 256 || limit - node - 8 < (fanout + 7) / 8 * 8 + 8 * fanout + value)
+            throw std::runtime_error("MappedTrie: node runs past the image");
+    }
+
+    auto Fanout(uint64_t node) const -> size_t { return Load<uint16_t>(data_ + node); }
+    auto HasValue(uint64_t node) const -> bool { return data_[node + 2] & 1; }
+    auto Labels(uint64_t node) const -> const unsigned char* {
+        return reinterpret_cast<const unsigned char*>(data_ + node + 8);
+    }
+    auto Offsets(uint64_t node) const -> const char* { return data_ + node + 8 + (Fanout(node) + 7) / 8 * 8; }
+
+    auto Value(uint64_t node) const -> std::string_view {
+        return std::string_view(Offsets(node) + 8 * Fanout(node), Load<uint32_t>(data_ + node + 4));
+    }
+
+    // The offset of child `i`, checked. Children are written before their
+    // parent, so offsets strictly decrease on the way down and every walk
+    // ends.
+    auto ChildAt(uint64_t node, size_t i) const -> uint64_t {
+        const uint64_t child = Load<uint64_t>(Offsets(node) + 8 * i);
+        if (child >= node) throw std::runtime_error("MappedTrie: child does not precede its parent");
+        CheckNode(child);
+        return child;
+    }
+
+    // The offset of the child labelled `c`, or 0.
+    auto Child(uint64_t node, char c) const -> uint64_t {
+        const size_t fanout = Fanout(node);
+        const unsigned char* labels = Labels(node);
+        const unsigned char* it = std::lower_bound(labels, labels + fanout, static_cast<unsigned char>(c));
+        if (it == labels + fanout || *it != static_cast<unsigned char>(c)) return 0;
+        return ChildAt(node, it - labels);
+    }
+
+    // Pre-order, so keys come out in unsigned byte order. `key` holds the
+    // labels along the path.
+    template <class F>
+    void ScanTree(uint64_t root, std::string& key, F& callback) const {
+        if (HasValue(root) && !callback(std::as_const(key), Value(root))) return;
+        // The nodes on the current path, each with its next child to visit.
+        std::vector<std::pair<uint64_t, size_t>> path{{root, 0}};
+        while (!path.empty()) {
+            auto& [node, next] = path.back();
+            if (next == Fanout(node)) {
+                path.pop_back();
+                if (!path.empty()) key.pop_back();
+                continue;
+            }
+            key.push_back(static_cast<char>(Labels(node)[next]));
+            const uint64_t child = ChildAt(node, next++);
+            if (HasValue(child) && !callback(std::as_const(key), Value(child))) return;
+            path.emplace_back(child, 0);
+        }
+    }
+
+    const char* data_{nullptr};
+    size_t size_{0};
+    uint64_t root_{0};
+    uint64_t nodes_{0};
+    bool owned_{false};
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_MAPPED_TRIE_HPP
@@ -0,0 +1,163 @@
+#ifndef SJTU_MEMORY_HPP
+#define SJTU_MEMORY_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "src.hpp"
+
+namespace sjtu {
+
+// A ValueFootprint<T> reports the heap memory a value of type T owns beyond
+// sizeof(T). Specialize it for value types that own heap memory:
+//
+//   template <>
+//   struct ValueFootprint<MyType> {
+//       static auto HeapBytes(const MyType& value) -> size_t;
+//   };
+template <class T, class Enable = void>
+struct ValueFootprint {
+    static auto HeapBytes(const T&) -> size_t { return 0; }
+};
+
+template <>
+struct ValueFootprint<std::string> {
+    // Short strings live inside the object.
+    static auto HeapBytes(const std::string& value) -> size_t {
+        static const size_t inline_capacity = std::string().capacity();
+        return value.capacity() > inline_capacity ? value.capacity() + 1 : 0;
+    }
+};
+
+// The memory held by trie nodes, by kind. Byte counts are the sizes of the
+// objects as the standard library lays them out (libstdc++ for the map and
+// control block estimates), without the allocator's own per-block overhead;
+// `allocations` counts the heap blocks so that overhead can be added.
+struct MemoryUsage {
+    // TrieNode and TrieNodeWithValue<T> objects, including the std::map
+    // header inside each.
+    size_t nodes{0};
+    size_t node_bytes{0};
+    // std::map tree nodes, one per child pointer.
+    size_t map_entries{0};
+    size_t map_bytes{0};
+    // shared_ptr control blocks, one per node and one per value. Which
+    // allocation a control block lives in is not visible through shared_ptr,
+    // so this is an estimate: a node's is taken to be a separate block, as
+    // for the nodes Put, Remove and Clone create with new, and a value's to
+    // share the value's allocation, as std::make_shared does. For nodes made
+    // with std::make_shared (e.g. by TrieBuilder) this overstates each node
+    // by a pointer and an allocation.
+    size_t control_blocks{0};
+    size_t control_block_bytes{0};
+    // The values: sizeof(T) plus ValueFootprint<T>::HeapBytes.
+    size_t values{0};
+    size_t value_bytes{0};
+    // Heap blocks: one per node, map entry and value (two if the value owns
+    // heap memory), and one per node control block, estimated as above.
+    size_t allocations{0};
+
+    auto Bytes() const -> size_t { return node_bytes + map_bytes + control_block_bytes + value_bytes; }
+
+    auto operator+=(const MemoryUsage& other) -> MemoryUsage& {
+        nodes += other.nodes;
+        node_bytes += other.node_bytes;
+        map_entries += other.map_entries;
+        map_bytes += other.map_bytes;
+        control_blocks += other.control_blocks;
+        control_block_bytes += other.control_block_bytes;
+        values += other.values;
+        value_bytes += other.value_bytes;
+        allocations += other.allocations;
+        return *this;
+    }
+};
+
+// A MemoryCounter measures the memory of tries whose values are of type T.
+// Nodes and values are counted once however many of the added tries share
+// them, so adding the versions of a TrieStore one by one yields what each
+// version costs on top of the ones before it:
+//
+//   sjtu::MemoryCounter<std::string> counter;
+//   for (size_t v = first; v <= last; ++v)
+//       std::cout << counter.Add(store.GetSnapshot(v)->second).Bytes() << '\n';
+//
+// Values of other types are counted as plain nodes.
+template <class T>
+class MemoryCounter {
+   public:
+    // An rb-tree node: three links and the colour, then the key and child.
+    static constexpr size_t kMapEntryBytes = 4 * sizeof(void*) + sizeof(std::pair<const char, std::shared_ptr<TrieNode>>);
+    // The vtable pointer and the use and weak counts, in front of an object
+    // made with std::make_shared.
+    static constexpr size_t kInplaceControlBlockBytes = sizeof(void*) + 2 * sizeof(int);
+    // A control block of its own also points to the object.
+    static constexpr size_t kControlBlockBytes = kInplaceControlBlockBytes + sizeof(void*);
+
+    // Count the nodes and values of `trie` not counted before and return
+    // their usage.
+    auto Add(const Trie& trie) -> MemoryUsage {
+        MemoryUsage added;
+        const std::shared_ptr<TrieNode>& root = TrieAccess::Root(trie);
+        if (!root || !nodes_.insert(root.get()).second) return added;
+        std::vector<const std::shared_ptr<TrieNode>*> stack{&root};
+        while (!stack.empty()) {
+            const std::shared_ptr<TrieNode>& node = *stack.back();
+            stack.pop_back();
+            CountNode(node, added);
+            for (const auto& [c, child] : node->children_)
+                if (nodes_.insert(child.get()).second) stack.push_back(&child);
+        }
+        total_ += added;
+        return added;
+    }
+
+    // The usage of everything added so far.
+    auto Total() const -> const MemoryUsage& { return total_; }
+
+   private:
+    void CountNode(const std::shared_ptr<TrieNode>& node, MemoryUsage& usage) {
+        ++usage.nodes;
+        ++usage.control_blocks;
+        usage.control_block_bytes += kControlBlockBytes;
+        usage.allocations += 2;
+        usage.map_entries += node->children_.size();
+        usage.map_bytes += node->children_.size() * kMapEntryBytes;
+        usage.allocations += node->children_.size();
+        auto with_value = node->is_value_node_ ? dynamic_cast<const TrieNodeWithValue<T>*>(node.get()) : nullptr;
+        if (!with_value) {
+            usage.node_bytes += sizeof(TrieNode);
+            return;
+        }
+        usage.node_bytes += sizeof(TrieNodeWithValue<T>);
+        // Clone shares the value, so values are deduplicated on their own.
+        const T* value = with_value->value_.get();
+        if (!value || !values_.insert(value).second) return;
+        ++usage.values;
+        ++usage.allocations;
+        ++usage.control_blocks;
+        usage.control_block_bytes += kInplaceControlBlockBytes;
+        const size_t heap = ValueFootprint<T>::HeapBytes(*value);
+        usage.value_bytes += sizeof(T) + heap;
+        if (heap > 0) ++usage.allocations;
+    }
+
+    std::unordered_set<const TrieNode*> nodes_;
+    std::unordered_set<const void*> values_;
+    MemoryUsage total_;
+};
+
+// The memory of one trie.
+template <class T>
+auto MeasureMemory(const Trie& trie) -> MemoryUsage {
+    MemoryCounter<T> counter;
+    return counter.Add(trie);
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_MEMORY_HPP
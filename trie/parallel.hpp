@@ -0,0 +1,430 @@
+#ifndef SJTU_PARALLEL_HPP
+#define SJTU_PARALLEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "src.hpp"
+#include "thread_pool.hpp"
+
+namespace sjtu {
+
+namespace detail {
+
+template <class T>
+class ParallelBuilder {
+   public:
+    ParallelBuilder(std::vector<std::pair<std::string, T>>& input, ThreadPool& pool)
+        : input_(input), pool_(pool) {
+        // Enough partitions for every worker to have several to steal, but
+        // not so many that stitching dominates.
+        cutoff_ = std::max<size_t>(4096, input.size() / (pool.Size() * 16));
+    }
+
+    // Build the subtree for input_[i] with i in `items`, all of which share
+    // their first `depth` bytes. Each level is split by the next byte; this
+    // call carries on with the largest partition itself and hands the others
+    // to tasks. A task therefore gets at most half of its level's items, so
+    // the recursion is at most log2(items / cutoff) deep however long the
+    // shared prefixes are.
+    auto Build(std::vector<size_t> items, size_t depth) -> std::shared_ptr<TrieNode> {
+        struct Level {
+            std::array<std::shared_ptr<TrieNode>, 256> children;
+            size_t value{static_cast<size_t>(-1)};
+            size_t next{0};
+        };
+        std::vector<std::unique_ptr<Level>> levels;
+        // Declared after `levels`, so that the tasks filling them are waited
+        // for first if a task throws.
+        std::deque<TaskGroup> groups;
+        std::vector<std::vector<size_t>> partitions(256);
+        while (items.size() > cutoff_) {
+            // Input order is kept inside each partition, so a later
+            // duplicate still overwrites an earlier one.
+            auto level = std::make_unique<Level>();
+            for (size_t i : items) {
+                const std::string& key = input_[i].first;
+                if (key.size() == depth) level->value = i;
+                else partitions[static_cast<unsigned char>(key[depth])].push_back(i);
+            }
+            for (size_t c = 1; c < 256; ++c)
+                if (partitions[c].size() > partitions[level->next].size()) level->next = c;
+            TaskGroup& group = groups.emplace_back(pool_);
+            for (size_t c = 0; c < 256; ++c) {
+                if (c == level->next || partitions[c].empty()) continue;
+                group.Run([this, part = std::move(partitions[c]), slot = &level->children[c], depth]() mutable {
+                    *slot = Build(std::move(part), depth + 1);
+                });
+                partitions[c] = std::vector<size_t>();
+            }
+            items = std::move(partitions[level->next]);
+            partitions[level->next] = std::vector<size_t>();
+            levels.push_back(std::move(level));
+            ++depth;
+        }
+
+        TrieBuilder builder;
+        for (size_t i : items) {
+            std::string_view key = input_[i].first;
+            builder.Put<T>(key.substr(depth), std::move(input_[i].second));
+        }
+        std::shared_ptr<TrieNode> node = TrieAccess::Root(builder.Build());
+        for (size_t l = levels.size(); l-- > 0;) {
+            groups[l].Wait();
+            Level& level = *levels[l];
+            level.children[level.next] = std::move(node);
+            std::map<char, std::shared_ptr<TrieNode>> stitched;
+            for (size_t c = 0; c < 256; ++c)
+                if (level.children[c]) stitched.emplace(static_cast<char>(c), std::move(level.children[c]));
+            if (level.value == static_cast<size_t>(-1)) {
+                node = std::make_shared<TrieNode>(std::move(stitched));
+            } else {
+                auto value = std::make_shared<T>(std::move(input_[level.value].second));
+                node = std::make_shared<TrieNodeWithValue<T>>(std::move(stitched), std::move(value));
+            }
+        }
+        return node;
+    }
+
+   private:
+    std::vector<std::pair<std::string, T>>& input_;
+    ThreadPool& pool_;
+    size_t cutoff_;
+};
+
+// Reduce the keys of type T below a node, in key order (unsigned bytes, as
+// std::string compares them). The walk descends through single-child chains
+// inline and fans out into one task per child at branching nodes until
+// enough tasks exist to keep every worker busy; below that, subtrees are
+// folded sequentially into one accumulator.
+template <class T, class R, class Fold, class Combine>
+class ParallelReducer {
+   public:
+    ParallelReducer(const R& identity, Fold& fold, Combine& combine, ThreadPool& pool)
+        : identity_(identity), fold_(fold), combine_(combine), pool_(pool), budget_(pool.Size() * 32) {}
+
+    auto Reduce(const TrieNode* node, std::string key) -> R {
+        R acc = identity_;
+        while (true) {
+            FoldValue(node, key, acc);
+            if (node->children_.size() != 1) break;
+            key.push_back(node->children_.begin()->first);
+            node = node->children_.begin()->second.get();
+        }
+        if (node->children_.empty()) return acc;
+        if (!Claim(node->children_.size())) {
+            for (ChildCursor it(node->children_); !it.Done(); it.Next()) {
+                key.push_back(it.Byte());
+                Walk(it.Child().get(), key, acc);
+                key.pop_back();
+            }
+            return acc;
+        }
+
+        std::vector<R> parts(node->children_.size(), identity_);
+        {
+            TaskGroup group(pool_);
+            size_t i = 0;
+            for (ChildCursor it(node->children_); !it.Done(); it.Next()) {
+                group.Run([this, &parts, i, node = it.Child().get(), child_key = key + it.Byte()] {
+                    parts[i] = Reduce(node, child_key);
+                });
+                ++i;
+            }
+            group.Wait();
+        }
+        for (auto& part : parts) acc = combine_(std::move(acc), std::move(part));
+        return acc;
+    }
+
+   private:
+    auto Claim(size_t tasks) -> bool {
+        size_t left = budget_.load();
+        while (left >= tasks)
+            if (budget_.compare_exchange_weak(left, left - tasks)) return true;
+        return false;
+    }
+
+    void FoldValue(const TrieNode* node, const std::string& key, R& acc) {
+        if (!node->is_value_node_) return;
+        auto target = dynamic_cast<const TrieNodeWithValue<T>*>(node);
+        if (target && target->value_) fold_(acc, key, std::as_const(*target->value_));
+    }
+
+    void Walk(const TrieNode* node, std::string& key, R& acc) {
+        FoldValue(node, key, acc);
+        for (ChildCursor it(node->children_); !it.Done(); it.Next()) {
+            key.push_back(it.Byte());
+            Walk(it.Child().get(), key, acc);
+            key.pop_back();
+        }
+    }
+
+    const R& identity_;
+    Fold& fold_;
+    Combine& combine_;
+    ThreadPool& pool_;
+    std::atomic<size_t> budget_;
+};
+
+using ChildPairs = std::vector<std::tuple<char, std::shared_ptr<TrieNode>, std::shared_ptr<TrieNode>>>;
+
+// Pairs up the children of two nodes by label, in key order. Shared children
+// are dropped, since there is nothing to diff or merge below them.
+inline auto DifferingChildren(const TrieNode* a, const TrieNode* b) -> ChildPairs {
+    ChildPairs pairs;
+    static const std::map<char, std::shared_ptr<TrieNode>> none;
+    ChildCursor i(a ? a->children_ : none);
+    ChildCursor j(b ? b->children_ : none);
+    while (!i.Done() || !j.Done()) {
+        if (j.Done() || (!i.Done() && ChildCursor::Less(i.Byte(), j.Byte()))) {
+            pairs.emplace_back(i.Byte(), i.Child(), nullptr);
+            i.Next();
+        } else if (i.Done() || ChildCursor::Less(j.Byte(), i.Byte())) {
+            pairs.emplace_back(j.Byte(), nullptr, j.Child());
+            j.Next();
+        } else {
+            if (i.Child() != j.Child()) pairs.emplace_back(i.Byte(), i.Child(), j.Child());
+            i.Next();
+            j.Next();
+        }
+    }
+    return pairs;
+}
+
+// Shared task budget: a node fans out into tasks only if it has at least
+// `min_fanout` differing child pairs and the budget still covers them.
+class SpawnBudget {
+   public:
+    SpawnBudget(ThreadPool& pool, size_t min_fanout) : left_(pool.Size() * 32), min_fanout_(min_fanout) {}
+
+    auto Claim(size_t tasks) -> bool {
+        if (tasks < min_fanout_) return false;
+        size_t left = left_.load();
+        while (left >= tasks)
+            if (left_.compare_exchange_weak(left, left - tasks)) return true;
+        return false;
+    }
+
+   private:
+    std::atomic<size_t> left_;
+    size_t min_fanout_;
+};
+
+// Diff below `from` and `to`, whose key is `key`. The walk keeps one frame
+// per level; only a node that fans out into tasks waits for them on the
+// stack, and the budget bounds how often that can nest.
+template <class T, class F>
+void ParallelDiffNodes(const TrieNode* from, const TrieNode* to, std::string key, F& callback, ThreadPool& pool,
+                       SpawnBudget& budget) {
+    std::vector<std::pair<ChildPairs, size_t>> path;
+    // Report the node pair at `key`, then either push its children or diff
+    // them as tasks. Returns whether a frame was pushed.
+    auto enter = [&](const TrieNode* a, const TrieNode* b) {
+        if (a == b) return false;
+        const T* old_value = detail::ValueOf<T>(a);
+        const T* new_value = detail::ValueOf<T>(b);
+        if (old_value != new_value) callback(std::as_const(key), old_value, new_value);
+        auto pairs = DifferingChildren(a, b);
+        if (!budget.Claim(pairs.size())) {
+            path.emplace_back(std::move(pairs), 0);
+            return true;
+        }
+        TaskGroup group(pool);
+        for (const auto& [c, x, y] : pairs) {
+            group.Run([&, x = x.get(), y = y.get(), child = key + c] {
+                ParallelDiffNodes<T>(x, y, child, callback, pool, budget);
+            });
+        }
+        group.Wait();
+        return false;
+    };
+
+    enter(from, to);
+    while (!path.empty()) {
+        auto& [pairs, next] = path.back();
+        if (next == pairs.size()) {
+            path.pop_back();
+            if (!path.empty()) key.pop_back();
+            continue;
+        }
+        const auto& [c, a, b] = pairs[next++];
+        key.push_back(c);
+        if (!enter(a.get(), b.get())) key.pop_back();
+    }
+}
+
+// Merge below `left` and `right` as ParallelDiffNodes walks them: one frame
+// per level, holding the differing child pairs and their merged results.
+inline auto ParallelMergeNodes(const std::shared_ptr<TrieNode>& left, const std::shared_ptr<TrieNode>& right,
+                               ThreadPool& pool, SpawnBudget& budget) -> std::shared_ptr<TrieNode> {
+    struct Frame {
+        const TrieNode* left;
+        const TrieNode* right;
+        ChildPairs pairs;
+        std::vector<std::shared_ptr<TrieNode>> merged;
+        size_t next;
+    };
+    auto finish = [](Frame& frame) {
+        auto children = frame.left->children_;
+        for (size_t i = 0; i < frame.pairs.size(); ++i)
+            children[std::get<0>(frame.pairs[i])] = std::move(frame.merged[i]);
+        return detail::MergedNode(*frame.left, *frame.right, std::move(children));
+    };
+    std::vector<Frame> path;
+    // Set `merged` and return true if the pair is merged right away: when a
+    // side is missing or both are shared, or when its children are merged
+    // as tasks. Otherwise push a frame for it.
+    auto settled = [&](const std::shared_ptr<TrieNode>& a, const std::shared_ptr<TrieNode>& b,
+                       std::shared_ptr<TrieNode>& merged) {
+        if (!a || a == b) {
+            merged = b;
+            return true;
+        }
+        if (!b) {
+            merged = a;
+            return true;
+        }
+        Frame frame{a.get(), b.get(), DifferingChildren(a.get(), b.get()), {}, 0};
+        frame.merged.resize(frame.pairs.size());
+        if (!budget.Claim(frame.pairs.size())) {
+            path.push_back(std::move(frame));
+            return false;
+        }
+        TaskGroup group(pool);
+        for (size_t i = 0; i < frame.pairs.size(); ++i) {
+            group.Run([&, i] {
+                frame.merged[i] =
+                    ParallelMergeNodes(std::get<1>(frame.pairs[i]), std::get<2>(frame.pairs[i]), pool, budget);
+            });
+        }
+        group.Wait();
+        merged = finish(frame);
+        return true;
+    };
+
+    std::shared_ptr<TrieNode> merged;
+    if (settled(left, right, merged)) return merged;
+    while (true) {
+        Frame& top = path.back();
+        if (top.next < top.pairs.size()) {
+            const size_t i = top.next++;
+            if (settled(std::get<1>(top.pairs[i]), std::get<2>(top.pairs[i]), merged))
+                top.merged[i] = std::move(merged);
+            continue;
+        }
+        merged = finish(top);
+        path.pop_back();
+        if (path.empty()) return merged;
+        path.back().merged[path.back().next - 1] = std::move(merged);
+    }
+}
+
+}  // namespace detail
+
+// Build a trie holding every key-value pair of `input` on `pool`. If a key
+// appears more than once, the last value wins, as with a sequence of Puts.
+// Keys are partitioned by their leading bytes until each partition is small
+// enough to be built by one task with a TrieBuilder; the partitions are then
+// stitched together under freshly built parent nodes. Values are moved out of
+// `input`.
+template <class T>
+auto ParallelBuild(std::vector<std::pair<std::string, T>> input, ThreadPool& pool) -> Trie {
+    if (input.empty()) return Trie();
+    std::vector<size_t> items(input.size());
+    for (size_t i = 0; i < items.size(); ++i) items[i] = i;
+    detail::ParallelBuilder<T> builder(input, pool);
+    return TrieAccess::Make(builder.Build(std::move(items), 0));
+}
+
+// Same as above, on a pool of `threads` workers (0: one per hardware thread).
+template <class T>
+auto ParallelBuild(std::vector<std::pair<std::string, T>> input, size_t threads = 0) -> Trie {
+    ThreadPool pool(threads);
+    return ParallelBuild<T>(std::move(input), pool);
+}
+
+// Reduce every key of type T in `trie` on `pool`. `fold(acc, key, value)`
+// adds one key to an accumulator and `combine(left, right)` merges the
+// accumulators of two adjacent key ranges, left one first. Each range is
+// folded in key order and ranges are combined in key order, so the result is
+// the same as a sequential fold whenever `combine` is associative; this is
+// the ordered mode for consumers such as exports. A Trie is immutable, so no
+// synchronization is needed while reading it.
+template <class T, class R, class Fold, class Combine>
+auto ParallelReduce(const Trie& trie, R identity, Fold fold, Combine combine, ThreadPool& pool) -> R {
+    const auto& root = TrieAccess::Root(trie);
+    if (!root) return identity;
+    detail::ParallelReducer<T, R, Fold, Combine> reducer(identity, fold, combine, pool);
+    return reducer.Reduce(root.get(), std::string());
+}
+
+// Same as above, on a pool of `threads` workers (0: one per hardware thread).
+template <class T, class R, class Fold, class Combine>
+auto ParallelReduce(const Trie& trie, R identity, Fold fold, Combine combine, size_t threads = 0) -> R {
+    ThreadPool pool(threads);
+    return ParallelReduce<T>(trie, std::move(identity), std::move(fold), std::move(combine), pool);
+}
+
+// Call `fn(key, value)` for every key of type T in `trie` on `pool`. Calls
+// run concurrently and in no particular order, so `fn` must be thread-safe.
+// With `ordered` set, the keys of each range are collected in parallel and
+// `fn` is then called on the calling thread, in key order.
+template <class T, class F>
+void ParallelForEach(const Trie& trie, F fn, ThreadPool& pool, bool ordered = false) {
+    if (!ordered) {
+        ParallelReduce<T>(
+            trie, nullptr, [&fn](std::nullptr_t&, const std::string& key, const T& value) { fn(key, value); },
+            [](std::nullptr_t, std::nullptr_t) { return nullptr; }, pool);
+        return;
+    }
+    using Range = std::vector<std::pair<std::string, const T*>>;
+    Range all = ParallelReduce<T>(
+        trie, Range(), [](Range& range, const std::string& key, const T& value) { range.emplace_back(key, &value); },
+        [](Range left, Range right) {
+            left.insert(left.end(), std::make_move_iterator(right.begin()), std::make_move_iterator(right.end()));
+            return left;
+        },
+        pool);
+    for (const auto& [key, value] : all) fn(key, *value);
+}
+
+// Same as above, on a pool of `threads` workers (0: one per hardware thread).
+template <class T, class F>
+void ParallelForEach(const Trie& trie, F fn, size_t threads = 0, bool ordered = false) {
+    ThreadPool pool(threads);
+    ParallelForEach<T>(trie, std::move(fn), pool, ordered);
+}
+
+// Parallel Trie::Diff. Where two nodes have at least `min_fanout` differing
+// child pairs, the pairs are diffed as separate tasks on `pool`; shared
+// children are skipped as in the sequential diff. `callback(key, old_value,
+// new_value)` is called concurrently and in no particular order, so it must
+// be thread-safe.
+template <class T, class F>
+void ParallelDiff(const Trie& from, const Trie& to, F callback, ThreadPool& pool, size_t min_fanout = 2) {
+    detail::SpawnBudget budget(pool, min_fanout);
+    detail::ParallelDiffNodes<T>(TrieAccess::Root(from).get(), TrieAccess::Root(to).get(), std::string(), callback,
+                                 pool, budget);
+}
+
+// Parallel Trie::Merge: the same result, with differing child pairs merged
+// as separate tasks on `pool` as in ParallelDiff.
+inline auto ParallelMerge(const Trie& left, const Trie& right, ThreadPool& pool, size_t min_fanout = 2) -> Trie {
+    detail::SpawnBudget budget(pool, min_fanout);
+    return TrieAccess::Make(
+        detail::ParallelMergeNodes(TrieAccess::Root(left), TrieAccess::Root(right), pool, budget));
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_PARALLEL_HPP
@@ -0,0 +1,364 @@
+#ifndef SJTU_PATTERN_HPP
+#define SJTU_PATTERN_HPP
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sjtu {
+
+// A Pattern is a glob or a simple regular expression compiled into a DFA over
+// bytes. Patterns are anchored at both ends: they must match the whole key.
+//
+// Glob syntax:  `*` any sequence, `?` any byte, `[abc]`, `[a-z]`, `[!a]` or
+//               `[^a]` classes, and `\` to escape the next byte.
+// Regex syntax: literals, `.`, classes as above (negation with `^` only),
+//               `*`, `+`, `?`, `|`, `( )` and `\` escapes. A leading `^`
+//               and a trailing `$` are accepted and ignored.
+//
+// Every state of the compiled DFA can still reach an accepting state, so a
+// transition to -1 means that no key with the current prefix can match. This
+// is what lets Trie::Match prune whole subtrees.
+class Pattern {
+   public:
+    // Patterns such as `*a` followed by many `?` need a DFA state for every
+    // combination of positions the NFA may be in; past this many states a
+    // pattern is rejected rather than compiled.
+    static constexpr size_t kMaxStates = 4096;
+
+    // Compile a glob pattern. Throws std::invalid_argument on a malformed
+    // pattern, or on one whose DFA would exceed kMaxStates states.
+    static auto Glob(std::string_view glob) -> Pattern {
+        Nfa nfa;
+        Fragment whole = nfa.Empty();
+        for(size_t i = 0; i < glob.size(); ++i)
+        {
+            Fragment next;
+            if(glob[i] == '*') next = nfa.Star(nfa.Byte(AnyByte()));
+            else if(glob[i] == '?') next = nfa.Byte(AnyByte());
+            else if(glob[i] == '[') next = nfa.Byte(ParseClass(glob, i, true));
+            else
+            {
+                if(glob[i] == '\\' && ++i == glob.size())
+                    throw std::invalid_argument("pattern ends with an escape");
+                next = nfa.Byte(Single(glob[i]));
+            }
+            whole = nfa.Concat(whole, next);
+        }
+        return Pattern(nfa, whole);
+    }
+
+    // Compile a simple regular expression. Throws std::invalid_argument on a
+    // malformed pattern, or on one whose DFA would exceed kMaxStates states.
+    static auto Regex(std::string_view regex) -> Pattern {
+        if(!regex.empty() && regex.front() == '^') regex.remove_prefix(1);
+        if(!regex.empty() && regex.back() == '$' &&
+           (regex.size() < 2 || regex[regex.size() - 2] != '\\'))
+            regex.remove_suffix(1);
+        Nfa nfa;
+        size_t pos = 0;
+        Fragment whole = ParseAlternation(nfa, regex, pos);
+        if(pos != regex.size())
+            throw std::invalid_argument("unbalanced ')' in pattern");
+        return Pattern(nfa, whole);
+    }
+
+    // The initial state, or -1 if the pattern matches nothing.
+    auto Start() const -> int { return start_; }
+
+    // The state reached from `state` on byte `c`, or -1 if no key continuing
+    // this way can match.
+    auto Next(int state, char c) const -> int {
+        return next_[state * 256 + static_cast<unsigned char>(c)];
+    }
+
+    // Whether a key ending in `state` matches.
+    auto Accepts(int state) const -> bool { return accepting_[state]; }
+
+    // The bytes with a live transition out of `state`, in key order (as
+    // unsigned bytes).
+    auto LiveBytes(int state) const -> const std::string& { return live_[state]; }
+
+    // Match a whole string against the pattern.
+    auto Matches(std::string_view s) const -> bool {
+        int state = start_;
+        for(size_t i = 0; i < s.size() && state >= 0; ++i) state = Next(state, s[i]);
+        return state >= 0 && accepting_[state];
+    }
+
+   private:
+    using ByteSet = std::bitset<256>;
+
+    // Thompson construction. A state has either one byte edge or up to two
+    // epsilon edges.
+    struct NfaState {
+        ByteSet bytes;
+        int out{-1};
+        int eps1{-1};
+        int eps2{-1};
+    };
+
+    struct Fragment {
+        int in{-1};
+        int out{-1};  // the single dangling accept state
+    };
+
+    struct Nfa {
+        std::vector<NfaState> states;
+
+        auto Add() -> int {
+            states.emplace_back();
+            return static_cast<int>(states.size()) - 1;
+        }
+        auto Empty() -> Fragment {
+            int s = Add();
+            return {s, s};
+        }
+        auto Byte(const ByteSet& set) -> Fragment {
+            int in = Add(), out = Add();
+            states[in].bytes = set;
+            states[in].out = out;
+            return {in, out};
+        }
+        auto Concat(Fragment a, Fragment b) -> Fragment {
+            states[a.out].eps1 = b.in;
+            return {a.in, b.out};
+        }
+        auto Alternate(Fragment a, Fragment b) -> Fragment {
+            int in = Add(), out = Add();
+            states[in].eps1 = a.in;
+            states[in].eps2 = b.in;
+            states[a.out].eps1 = out;
+            states[b.out].eps1 = out;
+            return {in, out};
+        }
+        auto Star(Fragment a) -> Fragment {
+            int in = Add(), out = Add();
+            states[in].eps1 = a.in;
+            states[in].eps2 = out;
+            states[a.out].eps1 = a.in;
+            states[a.out].eps2 = out;
+            return {in, out};
+        }
+        auto Plus(Fragment a) -> Fragment {
+            int out = Add();
+            states[a.out].eps1 = a.in;
+            states[a.out].eps2 = out;
+            return {a.in, out};
+        }
+        auto Optional(Fragment a) -> Fragment {
+            int in = Add();
+            states[in].eps1 = a.in;
+            states[in].eps2 = a.out;
+            return {in, a.out};
+        }
+    };
+
+    static auto AnyByte() -> ByteSet { return ByteSet().set(); }
+
+    static auto Single(char c) -> ByteSet {
+        return ByteSet().set(static_cast<unsigned char>(c));
+    }
+
+    // Parse a `[...]` class starting at pattern[pos] == '['. On return pos is
+    // at the closing ']'.
+    static auto ParseClass(std::string_view pattern, size_t& pos, bool glob) -> ByteSet {
+        ByteSet set;
+        bool negate = false;
+        ++pos;
+        if(pos < pattern.size() && (pattern[pos] == '^' || (glob && pattern[pos] == '!')))
+        {
+            negate = true;
+            ++pos;
+        }
+        bool first = true;
+        while(pos < pattern.size() && (pattern[pos] != ']' || first))
+        {
+            first = false;
+            unsigned char lo = pattern[pos];
+            if(lo == '\\' && pos + 1 < pattern.size()) lo = pattern[++pos];
+            unsigned char hi = lo;
+            if(pos + 2 < pattern.size() && pattern[pos + 1] == '-' && pattern[pos + 2] != ']')
+            {
+                pos += 2;
+                hi = pattern[pos];
+                if(hi == '\\' && pos + 1 < pattern.size()) hi = pattern[++pos];
+                if(hi < lo) throw std::invalid_argument("reversed range in character class");
+            }
+            for(unsigned c = lo; c <= hi; ++c) set.set(c);
+            ++pos;
+        }
+        if(pos >= pattern.size()) throw std::invalid_argument("unterminated character class");
+        return negate ? ~set : set;
+    }
+
+    static auto ParseAlternation(Nfa& nfa, std::string_view re, size_t& pos) -> Fragment {
+        Fragment left = ParseConcatenation(nfa, re, pos);
+        while(pos < re.size() && re[pos] == '|')
+        {
+            ++pos;
+            left = nfa.Alternate(left, ParseConcatenation(nfa, re, pos));
+        }
+        return left;
+    }
+
+    static auto ParseConcatenation(Nfa& nfa, std::string_view re, size_t& pos) -> Fragment {
+        Fragment whole = nfa.Empty();
+        while(pos < re.size() && re[pos] != '|' && re[pos] != ')')
+        {
+            Fragment atom;
+            char c = re[pos];
+            if(c == '(')
+            {
+                ++pos;
+                atom = ParseAlternation(nfa, re, pos);
+                if(pos == re.size() || re[pos] != ')')
+                    throw std::invalid_argument("unbalanced '(' in pattern");
+            }
+            else if(c == '[') atom = nfa.Byte(ParseClass(re, pos, false));
+            else if(c == '.') atom = nfa.Byte(AnyByte());
+            else if(c == '*' || c == '+' || c == '?')
+                throw std::invalid_argument("repetition without an operand");
+            else
+            {
+                if(c == '\\' && ++pos == re.size())
+                    throw std::invalid_argument("pattern ends with an escape");
+                atom = nfa.Byte(Single(re[pos]));
+            }
+            ++pos;
+            for(; pos < re.size(); ++pos)
+            {
+                if(re[pos] == '*') atom = nfa.Star(atom);
+                else if(re[pos] == '+') atom = nfa.Plus(atom);
+                else if(re[pos] == '?') atom = nfa.Optional(atom);
+                else break;
+            }
+            whole = nfa.Concat(whole, atom);
+        }
+        return whole;
+    }
+
+    static void Closure(const Nfa& nfa, std::vector<int>& set) {
+        std::vector<char> seen(nfa.states.size(), 0);
+        std::vector<int> stack(set);
+        for(int s : set) seen[s] = 1;
+        while(!stack.empty())
+        {
+            int s = stack.back();
+            stack.pop_back();
+            for(int e : {nfa.states[s].eps1, nfa.states[s].eps2})
+            {
+                if(e < 0 || seen[e]) continue;
+                seen[e] = 1;
+                set.push_back(e);
+                stack.push_back(e);
+            }
+        }
+        std::sort(set.begin(), set.end());
+    }
+
+    // Number the bytes so that two bytes get the same class exactly when no
+    // byte edge of the NFA tells them apart. The DFA then only has to follow
+    // one byte of each class.
+    static auto ByteClasses(const Nfa& nfa) -> std::vector<int> {
+        std::vector<int> classes(256, 0);
+        for(const NfaState& state : nfa.states)
+        {
+            if(state.out < 0) continue;
+            std::map<std::pair<int, bool>, int> split;
+            for(unsigned c = 0; c < 256; ++c)
+                classes[c] = split.emplace(std::make_pair(classes[c], state.bytes.test(c)),
+                                           static_cast<int>(split.size())).first->second;
+        }
+        return classes;
+    }
+
+    // Subset construction over byte classes, followed by removal of every
+    // state that cannot reach an accepting state. Throws
+    // std::invalid_argument if the DFA needs more than kMaxStates states.
+    Pattern(const Nfa& nfa, Fragment whole) {
+        const std::vector<int> classes = ByteClasses(nfa);
+        const int class_count = *std::max_element(classes.begin(), classes.end()) + 1;
+        std::vector<unsigned> sample(class_count);
+        for(unsigned c = 256; c-- > 0;) sample[classes[c]] = c;
+
+        std::map<std::vector<int>, int> ids;
+        std::vector<std::vector<int>> sets;
+        std::vector<int> moves;  // state * class_count + class -> state, or -1
+        std::vector<int> first{whole.in};
+        Closure(nfa, first);
+        ids.emplace(first, 0);
+        sets.push_back(std::move(first));
+        for(size_t d = 0; d < sets.size(); ++d)
+        {
+            moves.resize((d + 1) * class_count, -1);
+            accepting_.push_back(std::binary_search(sets[d].begin(), sets[d].end(), whole.out));
+            for(int k = 0; k < class_count; ++k)
+            {
+                std::vector<int> target;
+                for(int s : sets[d])
+                    if(nfa.states[s].out >= 0 && nfa.states[s].bytes.test(sample[k]))
+                        target.push_back(nfa.states[s].out);
+                if(target.empty()) continue;
+                Closure(nfa, target);
+                auto [it, inserted] = ids.emplace(target, static_cast<int>(sets.size()));
+                if(inserted)
+                {
+                    if(sets.size() == kMaxStates)
+                        throw std::invalid_argument("pattern needs more than " + std::to_string(kMaxStates) +
+                                                    " DFA states");
+                    sets.push_back(std::move(target));
+                }
+                moves[d * class_count + k] = it->second;
+            }
+        }
+
+        // A state is live if it accepts or moves to a live state: walk the
+        // moves backwards from the accepting states.
+        const size_t n = sets.size();
+        std::vector<std::vector<int>> sources(n);
+        for(size_t d = 0; d < n; ++d)
+            for(int k = 0; k < class_count; ++k)
+                if(moves[d * class_count + k] >= 0) sources[moves[d * class_count + k]].push_back(static_cast<int>(d));
+        std::vector<char> live(n, 0);
+        std::vector<int> stack;
+        for(size_t d = 0; d < n; ++d)
+            if(accepting_[d]) live[d] = 1, stack.push_back(static_cast<int>(d));
+        while(!stack.empty())
+        {
+            const int d = stack.back();
+            stack.pop_back();
+            for(int from : sources[d])
+                if(!live[from]) live[from] = 1, stack.push_back(from);
+        }
+
+        next_.assign(n * 256, -1);
+        live_.resize(n);
+        for(size_t d = 0; d < n; ++d)
+        {
+            for(int c = 0; c < 256; ++c)
+            {
+                const int to = moves[d * class_count + classes[c]];
+                if(to < 0 || !live[to]) continue;
+                next_[d * 256 + c] = to;
+                live_[d].push_back(static_cast<char>(c));
+            }
+        }
+        start_ = live[0] ? 0 : -1;
+    }
+
+    int start_{-1};
+    std::vector<int> next_;
+    std::vector<bool> accepting_;
+    std::vector<std::string> live_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_PATTERN_HPP
@@ -0,0 +1,239 @@
+#ifndef SJTU_RECOVERY_HPP
+#define SJTU_RECOVERY_HPP
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "src.hpp"
+#include "thread_pool.hpp"
+#include "wal.hpp"
+
+namespace sjtu {
+
+struct RecoveryStats {
+    // The version loaded from the checkpoint (0 without one).
+    size_t checkpoint_version{0};
+    // Log records applied on top of it.
+    size_t records_replayed{0};
+    // The newest version of the recovered store.
+    size_t version{0};
+};
+
+namespace detail {
+
+// The records of one log segment, up to its first torn record.
+struct DecodedSegment {
+    std::vector<WalRecord> records;
+    size_t intact_bytes{0};
+    bool torn{false};
+};
+
+inline auto DecodeSegment(const std::string& path) -> DecodedSegment {
+    DecodedSegment segment;
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string_view rest = bytes;
+    WalRecord record;
+    while (DecodeWalRecord(rest, record)) segment.records.push_back(std::move(record));
+    segment.intact_bytes = bytes.size() - rest.size();
+    segment.torn = !rest.empty();
+    return segment;
+}
+
+// The first key byte all keys touched by `record` start with, or nullopt if
+// the record may touch keys under several root children (or the root).
+inline auto PartitionOf(const WalRecord& record) -> std::optional<unsigned char> {
+    if (record.key.empty()) return std::nullopt;
+    if (record.op == Commit::Op::kRemoveRange &&
+        (record.payload.empty() || record.payload[0] != record.key[0]))
+        return std::nullopt;
+    return static_cast<unsigned char>(record.key[0]);
+}
+
+// Apply `records`, whose keys all start with the same byte, to the subtrie
+// under that byte. Point writes go through one TrieBuilder; range removals freeze it, use the
+// persistent operation and start a new builder on the result.
+template <class T>
+auto ReplayPartition(Trie subtrie, const std::vector<const WalRecord*>& records) -> Trie {
+    TrieBuilder builder(subtrie);
+    for (const WalRecord* record : records) {
+        const std::string_view key = std::string_view(record->key).substr(1);
+        switch (record->op) {
+            case Commit::Op::kPut:
+                builder.Put<T>(key, ValueCodec<T>::Decode(record->payload));
+                break;
+            case Commit::Op::kRemove:
+                builder.Remove(key);
+                break;
+            case Commit::Op::kRemovePrefix:
+                builder = TrieBuilder(builder.Build().RemovePrefix(key));
+                break;
+            case Commit::Op::kRemoveRange: {
+                // An empty relative upper bound means hi is the partition's
+                // byte itself, which is below every key of the partition.
+                const std::string_view hi = std::string_view(record->payload).substr(1);
+                if (!hi.empty()) builder = TrieBuilder(builder.Build().RemoveRange(key, hi));
+                break;
+            }
+            default:
+                throw std::runtime_error("WAL: unknown operation");
+        }
+    }
+    return builder.Build();
+}
+
+// Apply one record that spans partitions to `trie`.
+template <class T>
+auto ReplayRecord(const Trie& trie, const WalRecord& record) -> Trie {
+    switch (record.op) {
+        case Commit::Op::kPut: {
+            TrieBuilder builder(trie);
+            builder.Put<T>(record.key, ValueCodec<T>::Decode(record.payload));
+            return builder.Build();
+        }
+        case Commit::Op::kRemove: {
+            TrieBuilder builder(trie);
+            builder.Remove(record.key);
+            return builder.Build();
+        }
+        case Commit::Op::kRemovePrefix:
+            return trie.RemovePrefix(record.key);
+        case Commit::Op::kRemoveRange:
+            return trie.RemoveRange(record.key, record.payload);
+        default:
+            throw std::runtime_error("WAL: unknown operation");
+    }
+}
+
+template <class T>
+auto Recover(TrieStore& store, std::optional<std::pair<size_t, Trie>> base, const std::string& wal_dir,
+             ThreadPool& pool) -> RecoveryStats {
+    RecoveryStats stats;
+    Trie trie;
+    if (base) {
+        stats.checkpoint_version = base->first;
+        trie = std::move(base->second);
+    }
+
+    // Segments wholly covered by the checkpoint are not read. Decode the rest
+    // in parallel, then cut the log back to its first torn record as ReadWal
+    // does.
+    auto paths = WalSegments(wal_dir);
+    paths.erase(paths.begin(), paths.begin() + CoveredSegments(paths, stats.checkpoint_version));
+    std::vector<DecodedSegment> segments(paths.size());
+    {
+        TaskGroup group(pool);
+        for (size_t i = 0; i < paths.size(); ++i)
+            group.Run([&segments, &paths, i] { segments[i] = DecodeSegment(paths[i]); });
+        group.Wait();
+    }
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (!segments[i].torn) continue;
+        std::filesystem::resize_file(paths[i], segments[i].intact_bytes);
+        for (size_t j = i + 1; j < paths.size(); ++j) std::filesystem::remove(paths[j]);
+        segments.resize(i + 1);
+        break;
+    }
+
+    // Records at or below the checkpoint are already in it; the rest must
+    // continue it without a gap.
+    std::vector<const WalRecord*> tail;
+    size_t version = stats.checkpoint_version;
+    for (const auto& segment : segments) {
+        for (const auto& record : segment.records) {
+            if (record.version <= version) continue;
+            if (record.version != version + 1)
+                throw std::runtime_error("WAL: log does not continue version " + std::to_string(version));
+            tail.push_back(&record);
+            version = record.version;
+        }
+    }
+
+    // Runs of records that each stay under one root child are replayed one
+    // task per child, in log order within the child. A record spanning
+    // children ends the run and is applied on its own.
+    for (size_t begin = 0; begin < tail.size();) {
+        if (!PartitionOf(*tail[begin])) {
+            trie = ReplayRecord<T>(trie, *tail[begin++]);
+            continue;
+        }
+        std::array<std::vector<const WalRecord*>, 256> partitions;
+        size_t end = begin;
+        for (; end < tail.size(); ++end) {
+            auto partition = PartitionOf(*tail[end]);
+            if (!partition) break;
+            partitions[*partition].push_back(tail[end]);
+        }
+        std::array<std::optional<Trie>, 256> results;
+        {
+            TaskGroup group(pool);
+            for (size_t c = 0; c < partitions.size(); ++c) {
+                if (partitions[c].empty()) continue;
+                group.Run([&, c] {
+                    const char label = static_cast<char>(c);
+                    results[c] = ReplayPartition<T>(trie.SubTrie(std::string(1, label)), partitions[c]);
+                });
+            }
+            group.Wait();
+        }
+        for (size_t c = 0; c < results.size(); ++c)
+            if (results[c]) trie = trie.Graft(std::string(1, static_cast<char>(c)), *results[c]);
+        begin = end;
+    }
+
+    stats.records_replayed = tail.size();
+    stats.version = version;
+    store.Restore(std::move(trie), version);
+    return stats;
+}
+
+}  // namespace detail
+
+// Recover `store` from the latest checkpoint of `checkpointer` and the log
+// in `wal_dir`, whose values are of type T. Segments are decoded in parallel
+// on `pool`, and the records after the checkpoint are replayed in batches:
+// records touching different root children are applied concurrently through
+// TrieBuilder, each child's records in log order. The store ends up at the
+// last logged version, as if every commit had been replayed; the
+// intermediate versions are not kept. Segments the checkpoint covers are
+// skipped unread (TrimWal deletes them), so restart time follows the log
+// tail. A torn record at the tail of the log is cut off, as
+// WriteAheadLog::Replay does.
+template <class T>
+auto Recover(TrieStore& store, const Checkpointer<T>& checkpointer, const std::string& wal_dir, ThreadPool& pool)
+    -> RecoveryStats {
+    return detail::Recover<T>(store, checkpointer.Latest(), wal_dir, pool);
+}
+
+template <class T>
+auto Recover(TrieStore& store, const Checkpointer<T>& checkpointer, const std::string& wal_dir,
+             size_t threads = 0) -> RecoveryStats {
+    ThreadPool pool(threads);
+    return Recover<T>(store, checkpointer, wal_dir, pool);
+}
+
+// Recover `store` from the log in `wal_dir` alone.
+template <class T>
+auto Recover(TrieStore& store, const std::string& wal_dir, ThreadPool& pool) -> RecoveryStats {
+    return detail::Recover<T>(store, std::nullopt, wal_dir, pool);
+}
+
+template <class T>
+auto Recover(TrieStore& store, const std::string& wal_dir, size_t threads = 0) -> RecoveryStats {
+    ThreadPool pool(threads);
+    return Recover<T>(store, wal_dir, pool);
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_RECOVERY_HPP
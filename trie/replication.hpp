@@ -0,0 +1,465 @@
+#ifndef SJTU_REPLICATION_HPP
+#define SJTU_REPLICATION_HPP
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "serialize.hpp"
+#include "src.hpp"
+#include "wal.hpp"
+
+namespace sjtu {
+
+// A ReplicationTransport carries messages from a ReplicationLeader to a
+// ReplicationFollower, in order. Implement it for your own transport.
+class ReplicationTransport {
+   public:
+    virtual ~ReplicationTransport() = default;
+
+    // Send one message. Throws std::runtime_error if the peer is gone.
+    virtual void Send(std::string_view message) = 0;
+
+    // Receive the next message. Returns false once the peer has closed the
+    // stream.
+    virtual auto Receive(std::string& message) -> bool = 0;
+
+    // Tell the peer that no more messages follow.
+    virtual void Close() = 0;
+
+    // Make a Send or Receive blocked on another thread fail or return, and
+    // every later one too. The default does nothing.
+    virtual void Shutdown() {}
+};
+
+// An FdTransport frames messages (u32 length, bytes) over a byte stream: a
+// pipe, a socketpair or a connected Unix socket. It owns its descriptors.
+// Writing to a pipe whose reader is gone raises SIGPIPE; sockets report an
+// error instead. Only sockets can be shut down; a pipe stays blocked until
+// its peer reads or writes.
+class FdTransport : public ReplicationTransport {
+   public:
+    // Read from `read_fd` and write to `write_fd`; either may be -1 for a
+    // one-way transport, or both the same socket.
+    FdTransport(int read_fd, int write_fd) : read_fd_(read_fd), write_fd_(write_fd) {}
+
+    FdTransport(const FdTransport&) = delete;
+    auto operator=(const FdTransport&) -> FdTransport& = delete;
+
+    ~FdTransport() override {
+        Close();
+        if (read_fd_ >= 0) ::close(read_fd_);
+    }
+
+    // A pipe: {sending end, receiving end}.
+    static auto Pipe() -> std::pair<std::unique_ptr<FdTransport>, std::unique_ptr<FdTransport>> {
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC) != 0) throw std::runtime_error("FdTransport: cannot create a pipe");
+        return {std::make_unique<FdTransport>(-1, fds[1]), std::make_unique<FdTransport>(fds[0], -1)};
+    }
+
+    // A connected pair of Unix sockets.
+    static auto SocketPair() -> std::pair<std::unique_ptr<FdTransport>, std::unique_ptr<FdTransport>> {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+            throw std::runtime_error("FdTransport: cannot create a socket pair");
+        return {std::make_unique<FdTransport>(fds[0], fds[0]), std::make_unique<FdTransport>(fds[1], fds[1])};
+    }
+
+    // Listen on the Unix socket `path` and accept one peer.
+    static auto AcceptUnix(const std::string& path) -> std::unique_ptr<FdTransport> {
+        sockaddr_un address = Address(path);
+        int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0) throw std::runtime_error("FdTransport: cannot create a socket");
+        ::unlink(path.c_str());
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, 1) != 0) {
+            ::close(listener);
+            throw std::runtime_error("FdTransport: cannot listen on " + path);
+        }
+        int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        ::close(listener);
+        ::unlink(path.c_str());
+        if (fd < 0) throw std::runtime_error("FdTransport: accept failed on " + path);
+        return std::make_unique<FdTransport>(fd, fd);
+    }
+
+    // Connect to the Unix socket `path`.
+    static auto ConnectUnix(const std::string& path) -> std::unique_ptr<FdTransport> {
+        sockaddr_un address = Address(path);
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) throw std::runtime_error("FdTransport: cannot create a socket");
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("FdTransport: cannot connect to " + path);
+        }
+        return std::make_unique<FdTransport>(fd, fd);
+    }
+
+    void Send(std::string_view message) override {
+        if (write_fd_ < 0) throw std::runtime_error("FdTransport: not open for writing");
+        std::string frame;
+        detail::AppendFixed32(frame, static_cast<uint32_t>(message.size()));
+        frame += message;
+        const char* data = frame.data();
+        size_t size = frame.size();
+        while (size > 0) {
+            ssize_t n = ::send(write_fd_, data, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == ENOTSOCK) n = ::write(write_fd_, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::runtime_error("FdTransport: peer is gone");
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    auto Receive(std::string& message) -> bool override {
+        char header[4];
+        if (!ReadExactly(header, 4, true)) return false;
+        message.resize(detail::LoadFixed32(header));
+        if (!ReadExactly(message.data(), message.size(), false))
+            throw std::runtime_error("FdTransport: stream ended inside a message");
+        return true;
+    }
+
+    void Close() override {
+        if (write_fd_ < 0) return;
+        if (write_fd_ == read_fd_) ::shutdown(write_fd_, SHUT_WR);
+        else ::close(write_fd_);
+        write_fd_ = -1;
+    }
+
+    void Shutdown() override {
+        if (read_fd_ >= 0) ::shutdown(read_fd_, SHUT_RDWR);
+        if (write_fd_ >= 0 && write_fd_ != read_fd_) ::shutdown(write_fd_, SHUT_RDWR);
+    }
+
+   private:
+    static auto Address(const std::string& path) -> sockaddr_un {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) throw std::invalid_argument("FdTransport: socket path too long");
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    // Returns false at a clean end of stream before the first byte.
+    auto ReadExactly(char* data, size_t size, bool eof_ok) -> bool {
+        if (read_fd_ < 0) throw std::runtime_error("FdTransport: not open for reading");
+        for (size_t done = 0; done < size;) {
+            ssize_t n = ::read(read_fd_, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::runtime_error("FdTransport: read failed");
+            if (n == 0) {
+                if (done == 0 && eof_ok) return false;
+                throw std::runtime_error("FdTransport: stream ended inside a message");
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int read_fd_;
+    int write_fd_;
+};
+
+namespace detail {
+
+// Messages start with a type byte.
+inline constexpr char kReplicationSnapshot = 'S';  // varint version, Serialize<T> bytes
+inline constexpr char kReplicationRecords = 'R';   // WAL records, in version order
+
+}  // namespace detail
+
+struct ReplicationOptions {
+    // Commits buffered for a follower that falls this far behind stop the
+    // leader: the transport is shut down and CheckError reports the lag.
+    // Resync by starting a new leader and follower.
+    size_t max_pending_bytes{64 << 20};
+};
+
+// A ReplicationLeader streams a TrieStore whose values are of type T to one
+// follower: first its newest version as a snapshot, then every commit as the
+// key and value it changed, in the WAL record format. Commits are buffered
+// under the store's write lock and shipped by a sender thread, so a slow
+// follower never holds up writers; a busy stream sends many commits per
+// message, up to ReplicationOptions::max_pending_bytes. A commit is held back
+// until it is known to be published, so an abandoned commit is never sent.
+template <class T>
+class ReplicationLeader : public CommitListener {
+   public:
+    // Start streaming `store` through `transport`.
+    static auto Start(TrieStore& store, std::unique_ptr<ReplicationTransport> transport,
+                      ReplicationOptions options = {}) -> std::shared_ptr<ReplicationLeader> {
+        std::shared_ptr<ReplicationLeader> leader(new ReplicationLeader(std::move(transport), options));
+        // Listen first, so no commit falls between the snapshot and the
+        // stream; commits up to the snapshot's version are skipped.
+        store.AddListener(leader);
+        std::optional<std::pair<size_t, Trie>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(leader->lock_);
+            snapshot = store.GetSnapshot();
+            leader->snapshot_version_ = snapshot->first;
+            // Drop the commits buffered before the snapshot that it holds.
+            std::string_view rest = leader->pending_;
+            WalRecord record;
+            for (std::string_view next = rest; DecodeWalRecord(next, record) && record.version <= snapshot->first;)
+                rest = next;
+            leader->pending_.erase(0, leader->pending_.size() - rest.size());
+            if (leader->held_version_ <= snapshot->first) leader->held_.clear();
+        }
+        std::string message(1, detail::kReplicationSnapshot);
+        PutVarint(message, snapshot->first);
+        Serialize<T>(snapshot->second, [&message](const char* data, size_t size) { message.append(data, size); });
+        {
+            std::lock_guard<std::mutex> lock(leader->lock_);
+            leader->snapshot_ = std::move(message);
+        }
+        leader->sender_ = std::thread([raw = leader.get()] { raw->SendLoop(); });
+        return leader;
+    }
+
+    ReplicationLeader(const ReplicationLeader&) = delete;
+    auto operator=(const ReplicationLeader&) -> ReplicationLeader& = delete;
+
+    ~ReplicationLeader() override { Stop(); }
+
+    void OnCommit(const Commit& commit) override {
+        WalRecord record{commit.op, commit.version, std::string(commit.key), std::string()};
+        if (commit.op == Commit::Op::kPut) {
+            const T* value = TrieAccess::ValueOf<T>(commit.value);
+            if (!value) throw std::invalid_argument("ReplicationLeader: value of another type");
+            ValueCodec<T>::Encode(*value, record.payload);
+        } else if (commit.op == Commit::Op::kRemoveRange) {
+            record.payload.assign(commit.hi);
+        }
+        std::string encoded;
+        EncodeWalRecord(record, encoded);
+        std::lock_guard<std::mutex> lock(lock_);
+        if (stopping_ || commit.version <= snapshot_version_) return;
+        // Commits are published in order, so the previous one made it.
+        Release();
+        held_ = std::move(encoded);
+        held_version_ = commit.version;
+    }
+
+    void OnAbort(size_t version) override {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (held_version_ == version) held_.clear();
+    }
+
+    void AfterCommit(size_t version) override {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (held_version_ == version) Release();
+        }
+        cv_.notify_one();
+    }
+
+    // Send what is buffered, end the stream and stop the sender. Later
+    // commits are not replicated; detach the leader with
+    // TrieStore::RemoveListener to stop buffering them at all.
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (sender_.joinable()) sender_.join();
+    }
+
+    // The newest version handed to the transport.
+    auto SentVersion() -> size_t {
+        std::lock_guard<std::mutex> lock(lock_);
+        return sent_version_;
+    }
+
+    // Rethrows the error that stopped the sender, if any.
+    void CheckError() {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (error_) std::rethrow_exception(error_);
+    }
+
+   private:
+    ReplicationLeader(std::unique_ptr<ReplicationTransport> transport, ReplicationOptions options)
+        : transport_(std::move(transport)), options_(options) {}
+
+    // Queue the held-back commit for sending. The caller must hold lock_.
+    void Release() {
+        if (held_.empty()) return;
+        if (pending_.size() + held_.size() > options_.max_pending_bytes) {
+            // The follower is not keeping up: cut it off rather than buffer
+            // without bound.
+            error_ = std::make_exception_ptr(std::runtime_error("ReplicationLeader: follower fell behind"));
+            stopping_ = true;
+            pending_.clear();
+            held_.clear();
+            transport_->Shutdown();
+            return;
+        }
+        pending_ += held_;
+        held_.clear();
+        pending_version_ = held_version_;
+    }
+
+    void SendLoop() {
+        std::unique_lock<std::mutex> lock(lock_);
+        try {
+            std::string message = std::move(snapshot_);
+            size_t version = snapshot_version_;
+            while (true) {
+                lock.unlock();
+                transport_->Send(message);
+                lock.lock();
+                sent_version_ = version;
+                cv_.wait(lock, [this] { return !pending_.empty() || stopping_; });
+                if (pending_.empty()) break;
+                message.assign(1, detail::kReplicationRecords);
+                message += pending_;
+                pending_.clear();
+                version = pending_version_;
+            }
+        } catch (...) {
+            if (!lock.owns_lock()) lock.lock();
+            if (!error_) error_ = std::current_exception();
+            stopping_ = true;
+        }
+        lock.unlock();
+        transport_->Close();
+    }
+
+    std::unique_ptr<ReplicationTransport> transport_;
+    const ReplicationOptions options_;
+    std::thread sender_;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::string snapshot_;
+    size_t snapshot_version_{0};
+    // The record of the newest commit, until it is known to be published.
+    std::string held_;
+    size_t held_version_{0};
+    std::string pending_;
+    size_t pending_version_{0};
+    size_t sent_version_{0};
+    bool stopping_{false};
+    std::exception_ptr error_;
+};
+
+// A ReplicationFollower applies the stream of a ReplicationLeader to its own
+// TrieStore on a background thread. The store reproduces the leader's
+// version numbers: it starts at the snapshot's version and every record must
+// be the next version. The store must not be written to directly.
+template <class T>
+class ReplicationFollower {
+   public:
+    ReplicationFollower(TrieStore& store, std::unique_ptr<ReplicationTransport> transport)
+        : store_(store), transport_(std::move(transport)) {
+        receiver_ = std::thread([this] { ReceiveLoop(); });
+    }
+
+    ReplicationFollower(const ReplicationFollower&) = delete;
+    auto operator=(const ReplicationFollower&) -> ReplicationFollower& = delete;
+
+    // Stops receiving: shuts the transport down and waits for the message
+    // being applied, if any.
+    ~ReplicationFollower() {
+        transport_->Shutdown();
+        if (receiver_.joinable()) receiver_.join();
+    }
+
+    // The newest version applied to the store.
+    auto AppliedVersion() -> size_t {
+        std::lock_guard<std::mutex> lock(lock_);
+        return applied_;
+    }
+
+    // Wait until `version` has been applied. Returns false on timeout or if
+    // the stream ended before it.
+    auto WaitForVersion(size_t version, std::chrono::milliseconds timeout) -> bool {
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait_for(lock, timeout, [&] { return (started_ && applied_ >= version) || done_; });
+        return started_ && applied_ >= version;
+    }
+
+    // Wait for the stream to end. Rethrows the error that stopped it, if any.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait(lock, [this] { return done_; });
+        if (error_) std::rethrow_exception(error_);
+    }
+
+   private:
+    void ReceiveLoop() {
+        try {
+            std::string message;
+            WalRecord record;
+            while (transport_->Receive(message)) {
+                std::string_view in = message;
+                if (in.empty()) throw std::runtime_error("ReplicationFollower: empty message");
+                const char type = in.front();
+                in.remove_prefix(1);
+                size_t version;
+                if (type == detail::kReplicationSnapshot) {
+                    version = GetVarint(in);
+                    store_.Restore(Deserialize<T>(StringSource(in)), version);
+                } else if (type == detail::kReplicationRecords) {
+                    version = AppliedVersion();
+                    while (DecodeWalRecord(in, record)) {
+                        ApplyWalRecord<T>(store_, record);
+                        version = record.version;
+                    }
+                    if (!in.empty()) throw std::runtime_error("ReplicationFollower: corrupt records");
+                } else {
+                    throw std::runtime_error("ReplicationFollower: unknown message");
+                }
+                {
+                    std::lock_guard<std::mutex> lock(lock_);
+                    applied_ = version;
+                    started_ = true;
+                }
+                cv_.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(lock_);
+            error_ = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            done_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    TrieStore& store_;
+    std::unique_ptr<ReplicationTransport> transport_;
+    std::thread receiver_;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    size_t applied_{0};
+    bool started_{false};
+    bool done_{false};
+    std::exception_ptr error_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_REPLICATION_HPP
@@ -0,0 +1,384 @@
+#ifndef SJTU_SERIALIZE_HPP
+#define SJTU_SERIALIZE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "src.hpp"
+
+namespace sjtu {
+
+// A ValueCodec<T> turns values of type T into bytes and back. Specialize it
+// for your own value types:
+//
+//   template <>
+//   struct ValueCodec<MyType> {
+//       static void Encode(const MyType& value, std::string& out);  // append
+//       static auto Decode(std::string_view bytes) -> MyType;
+//   };
+//
+// Decode receives exactly the bytes appended by Encode.
+template <class T, class Enable = void>
+struct ValueCodec;
+
+// Arithmetic values are stored as their bytes in host byte order.
+template <class T>
+struct ValueCodec<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+    static void Encode(const T& value, std::string& out) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+    static auto Decode(std::string_view bytes) -> T {
+        if (bytes.size() != sizeof(T)) throw std::runtime_error("ValueCodec: bad value size");
+        T value;
+        std::memcpy(&value, bytes.data(), sizeof(T));
+        return value;
+    }
+};
+
+template <>
+struct ValueCodec<std::string> {
+    static void Encode(const std::string& value, std::string& out) { out += value; }
+    static auto Decode(std::string_view bytes) -> std::string { return std::string(bytes); }
+};
+
+// LEB128 variable-length integers.
+inline void PutVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline auto GetVarint(std::string_view& in) -> uint64_t {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in.empty()) throw std::runtime_error("truncated varint");
+        auto byte = static_cast<unsigned char>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+    throw std::runtime_error("varint is too long");
+}
+
+// A TrieWriter buffers output and hands it to a sink in large chunks. The
+// sink is any callable taking (const char* data, size_t size).
+template <class Sink>
+class TrieWriter {
+   public:
+    explicit TrieWriter(Sink sink, size_t buffer_size = 1 << 20)
+        : sink_(std::move(sink)), buffer_size_(buffer_size) {
+        buffer_.reserve(buffer_size_ + 64);
+    }
+
+    // The buffer that callers append to directly.
+    auto Buffer() -> std::string& { return buffer_; }
+
+    // Flush once the buffer is full.
+    void MaybeFlush() {
+        if (buffer_.size() >= buffer_size_) Flush();
+    }
+
+    void Flush() {
+        if (buffer_.empty()) return;
+        written_ += buffer_.size();
+        sink_(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
+
+    // Bytes handed to the sink or still buffered.
+    auto BytesWritten() const -> size_t { return written_ + buffer_.size(); }
+
+   private:
+    Sink sink_;
+    size_t buffer_size_;
+    size_t written_{0};
+    std::string buffer_;
+};
+
+// A TrieReader reads from a source in large chunks. The source is any callable
+// taking (char* data, size_t size) and returning the number of bytes read,
+// 0 at end of input.
+template <class Source>
+class TrieReader {
+   public:
+    explicit TrieReader(Source source, size_t buffer_size = 1 << 20)
+        : source_(std::move(source)), buffer_(buffer_size, '\0') {}
+
+    // Return a view of the next `size` bytes, which stays valid until the
+    // next call.
+    auto Read(size_t size) -> std::string_view {
+        if (end_ - pos_ < size) Refill(size);
+        std::string_view bytes(buffer_.data() + pos_, size);
+        pos_ += size;
+        return bytes;
+    }
+
+    auto ReadByte() -> unsigned char { return static_cast<unsigned char>(Read(1)[0]); }
+
+    auto ReadVarint() -> uint64_t {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            unsigned char byte = ReadByte();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) return value;
+        }
+        throw std::runtime_error("varint is too long");
+    }
+
+    // Whether every byte of the source has been consumed.
+    auto AtEnd() -> bool {
+        if (pos_ < end_) return false;
+        pos_ = end_ = 0;
+        end_ = source_(buffer_.data(), buffer_.size());
+        return end_ == 0;
+    }
+
+   private:
+    // The buffer grows only as data arrives, so a corrupt length runs into
+    // the end of the input instead of a huge allocation.
+    void Refill(size_t size) {
+        std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+        while (end_ < size) {
+            if (end_ == buffer_.size()) buffer_.resize(std::min(size, std::max<size_t>(2 * buffer_.size(), 4096)));
+            size_t got = source_(buffer_.data() + end_, buffer_.size() - end_);
+            if (got == 0) throw std::runtime_error("unexpected end of trie data");
+            end_ += got;
+        }
+    }
+
+    Source source_;
+    std::string buffer_;
+    size_t pos_{0};
+    size_t end_{0};
+};
+
+inline auto OstreamSink(std::ostream& out) {
+    return [&out](const char* data, size_t size) {
+        if (!out.write(data, static_cast<std::streamsize>(size))) throw std::runtime_error("write failed");
+    };
+}
+
+inline auto IstreamSource(std::istream& in) {
+    return [&in](char* data, size_t size) -> size_t {
+        in.read(data, static_cast<std::streamsize>(size));
+        return static_cast<size_t>(in.gcount());
+    };
+}
+
+inline auto StringSource(std::string_view bytes) {
+    return [bytes](char* data, size_t size) mutable -> size_t {
+        size = std::min(size, bytes.size());
+        std::memcpy(data, bytes.data(), size);
+        bytes.remove_prefix(size);
+        return size;
+    };
+}
+
+namespace detail {
+
+// Write all of `data` to `fd`.
+inline void WriteAll(int fd, const char* data, size_t size, const std::string& what) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw std::runtime_error("cannot write " + what);
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+// Sync the directory holding `path`, so that a file just created or renamed
+// there survives a crash. Returns false if the directory cannot be synced.
+inline auto SyncParentDir(const std::string& path) -> bool {
+    const std::string dir = std::filesystem::path(path).parent_path().string();
+    int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dir_fd < 0) return false;
+    const bool synced = ::fsync(dir_fd) == 0;
+    ::close(dir_fd);
+    return synced;
+}
+
+// Rename the synced file `tmp` over `path` and sync the directory, so that
+// `path` is either the old file or the complete new one after a crash. Throws
+// if the directory cannot be synced: `path` already names the new file then,
+// but the rename may not survive a crash.
+inline void CommitFile(const std::string& tmp, const std::string& path) {
+    if (::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("cannot rename " + tmp);
+    if (!SyncParentDir(path)) throw std::runtime_error("cannot sync the directory of " + path);
+}
+
+// Replace `path` with `contents` atomically.
+inline void ReplaceFile(const std::string& path, const std::string& contents) {
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error("cannot create " + tmp);
+    try {
+        WriteAll(fd, contents.data(), contents.size(), tmp);
+        if (::fdatasync(fd) != 0) throw std::runtime_error("cannot sync " + tmp);
+    } catch (...) {
+        ::close(fd);
+        std::remove(tmp.c_str());
+        throw;
+    }
+    if (::close(fd) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot write " + tmp);
+    }
+    CommitFile(tmp, path);
+}
+
+}  // namespace detail
+
+// The snapshot format is a header followed by every node in pre-order:
+//
+//   header: "SJTUTRIE" 0x01
+//   node:   flags (bit 0: has value), varint fanout, `fanout` label bytes,
+//           [varint value length, value bytes], then the `fanout` children
+//
+// An empty trie is a header followed by nothing.
+inline constexpr std::string_view kSnapshotMagic{"SJTUTRIE\x01", 9};
+
+namespace detail {
+
+// Write one node without its children.
+template <class T, class Sink>
+void SerializeNode(const TrieNode* node, TrieWriter<Sink>& writer, std::string& value) {
+    std::string& out = writer.Buffer();
+    out.push_back(static_cast<char>(node->is_value_node_ ? 1 : 0));
+    PutVarint(out, node->children_.size());
+    for (const auto& child : node->children_) out.push_back(child.first);
+    if (node->is_value_node_) {
+        const T* v = TrieAccess::ValueOf<T>(node);
+        if (!v) throw std::invalid_argument("Serialize: trie holds a value of another type");
+        value.clear();
+        ValueCodec<T>::Encode(*v, value);
+        PutVarint(out, value.size());
+        out += value;
+    }
+    writer.MaybeFlush();
+}
+
+// Write a subtree in pre-order. Keys may be of any length, so the walk keeps
+// its path on the heap rather than recursing.
+template <class T, class Sink>
+void SerializeTree(const TrieNode* root, TrieWriter<Sink>& writer) {
+    // The nodes on the current path, each with its next child to write.
+    std::vector<std::pair<const TrieNode*, std::map<char, std::shared_ptr<TrieNode>>::const_iterator>> path;
+    std::string value;
+    SerializeNode<T>(root, writer, value);
+    path.emplace_back(root, root->children_.begin());
+    while (!path.empty()) {
+        auto& [node, next] = path.back();
+        if (next == node->children_.end()) {
+            path.pop_back();
+            continue;
+        }
+        const TrieNode* child = (next++)->second.get();
+        SerializeNode<T>(child, writer, value);
+        path.emplace_back(child, child->children_.begin());
+    }
+}
+
+// Read one node without its children; their labels go to `labels`.
+template <class T, class Source>
+auto DeserializeNode(TrieReader<Source>& reader, std::string& labels) -> std::shared_ptr<TrieNode> {
+    unsigned char flags = reader.ReadByte();
+    if (flags > 1) throw std::runtime_error("Deserialize: corrupt node header");
+    uint64_t fanout = reader.ReadVarint();
+    if (fanout > 256) throw std::runtime_error("Deserialize: corrupt fanout");
+    labels.assign(reader.Read(fanout));
+    if (flags & 1) {
+        uint64_t size = reader.ReadVarint();
+        return std::make_shared<TrieNodeWithValue<T>>(std::make_shared<T>(ValueCodec<T>::Decode(reader.Read(size))));
+    }
+    return std::make_shared<TrieNode>();
+}
+
+// Read a subtree written by SerializeTree.
+template <class T, class Source>
+auto DeserializeTree(TrieReader<Source>& reader) -> std::shared_ptr<TrieNode> {
+    struct Frame {
+        std::shared_ptr<TrieNode> node;
+        std::string labels;
+        size_t next;
+    };
+    // The nodes on the current path that still have children to read.
+    std::vector<Frame> path;
+    std::string labels;
+    auto root = DeserializeNode<T>(reader, labels);
+    if (!labels.empty()) path.push_back(Frame{root, std::move(labels), 0});
+    while (!path.empty()) {
+        auto child = DeserializeNode<T>(reader, labels);
+        Frame& parent = path.back();
+        parent.node->children_.emplace_hint(parent.node->children_.end(), parent.labels[parent.next++], child);
+        if (parent.next == parent.labels.size()) path.pop_back();
+        if (!labels.empty()) path.push_back(Frame{std::move(child), std::move(labels), 0});
+    }
+    return root;
+}
+
+}  // namespace detail
+
+// Write `trie`, whose values must all be of type T, to `sink` (a callable
+// taking (const char* data, size_t size)). Returns the number of bytes
+// written.
+template <class T, class Sink, class = std::enable_if_t<!std::is_base_of_v<std::ios_base, Sink>>>
+auto Serialize(const Trie& trie, Sink sink) -> size_t {
+    TrieWriter<Sink> writer(std::move(sink));
+    writer.Buffer() += kSnapshotMagic;
+    if (const auto& root = TrieAccess::Root(trie)) detail::SerializeTree<T>(root.get(), writer);
+    writer.Flush();
+    return writer.BytesWritten();
+}
+
+template <class T>
+auto Serialize(const Trie& trie, std::ostream& out) -> size_t {
+    return Serialize<T>(trie, OstreamSink(out));
+}
+
+// Read a trie written by Serialize<T> from `source` (a callable taking
+// (char* data, size_t size) and returning the bytes read). Throws
+// std::runtime_error on malformed input.
+template <class T, class Source, class = std::enable_if_t<!std::is_base_of_v<std::ios_base, Source>>>
+auto Deserialize(Source source) -> Trie {
+    TrieReader<Source> reader(std::move(source));
+    if (reader.Read(kSnapshotMagic.size()) != kSnapshotMagic)
+        throw std::runtime_error("Deserialize: not a trie snapshot");
+    if (reader.AtEnd()) return Trie();
+    auto root = detail::DeserializeTree<T, Source>(reader);
+    if (!reader.AtEnd()) throw std::runtime_error("Deserialize: trailing data after snapshot");
+    return TrieAccess::Make(std::move(root));
+}
+
+template <class T>
+auto Deserialize(std::istream& in) -> Trie {
+    return Deserialize<T>(IstreamSource(in));
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_SERIALIZE_HPP
@@ -0,0 +1,201 @@
+#ifndef SJTU_SHARED_TRIE_HPP
+#define SJTU_SHARED_TRIE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "mapped_trie.hpp"
+#include "serialize.hpp"
+#include "src.hpp"
+
+namespace sjtu {
+
+namespace detail {
+
+// The control object "<name>" holds the generation of the newest snapshot,
+// which lives in the shared memory object "<name>.<generation>" as a mapped
+// trie image. Generation 0 means nothing has been published yet.
+struct SharedTrieControl {
+    char magic[8];
+    std::atomic<uint64_t> generation;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the generation is shared between processes");
+
+inline constexpr std::string_view kSharedTrieMagic{"SJTUSHMT", 8};
+
+inline auto SharedTrieObject(const std::string& name, uint64_t generation) -> std::string {
+    return name + "." + std::to_string(generation);
+}
+
+}  // namespace detail
+
+// A SharedTriePublisher publishes frozen snapshots of a trie into POSIX
+// shared memory for SharedTrieReaders in other processes. Every process maps
+// the same pages, so the host holds one copy of each snapshot however many
+// readers there are.
+//
+// Publishing writes the whole image into a new shared memory object, then
+// bumps the generation in the control object; readers switch over when they
+// next call Refresh. The previous object is unlinked right away: readers that
+// still map it keep it alive until they move on.
+class SharedTriePublisher {
+   public:
+    // `name` is a shared memory name such as "/my-trie": one leading slash
+    // and no other.
+    explicit SharedTriePublisher(std::string name) : name_(std::move(name)) {
+        int fd = ::shm_open(name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("SharedTriePublisher: cannot create " + name_);
+        if (::ftruncate(fd, sizeof(detail::SharedTrieControl)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("SharedTriePublisher: cannot size " + name_);
+        }
+        void* data = ::mmap(nullptr, sizeof(detail::SharedTrieControl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) throw std::runtime_error("SharedTriePublisher: cannot map " + name_);
+        control_ = static_cast<detail::SharedTrieControl*>(data);
+        // A restarted publisher carries on from the last generation.
+        if (std::string_view(control_->magic, 8) != detail::kSharedTrieMagic) {
+            new (&control_->generation) std::atomic<uint64_t>(0);
+            std::memcpy(control_->magic, detail::kSharedTrieMagic.data(), 8);
+        }
+        generation_ = control_->generation.load(std::memory_order_acquire);
+    }
+
+    SharedTriePublisher(const SharedTriePublisher&) = delete;
+    auto operator=(const SharedTriePublisher&) -> SharedTriePublisher& = delete;
+
+    // Readers keep their current snapshot but can no longer Refresh.
+    ~SharedTriePublisher() {
+        if (generation_ > 0) ::shm_unlink(detail::SharedTrieObject(name_, generation_).c_str());
+        ::shm_unlink(name_.c_str());
+        ::munmap(control_, sizeof(detail::SharedTrieControl));
+    }
+
+    // Publish `trie`, whose values must all be of type T, as the next
+    // generation and return it.
+    template <class T>
+    auto Publish(const Trie& trie) -> uint64_t {
+        const uint64_t generation = generation_ + 1;
+        const std::string object = detail::SharedTrieObject(name_, generation);
+        int fd = ::shm_open(object.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("SharedTriePublisher: cannot create " + object);
+        try {
+            WriteMappedImage<T>(trie, [fd, &object](const char* data, size_t size) {
+                detail::WriteAll(fd, data, size, object);
+            });
+        } catch (...) {
+            ::close(fd);
+            ::shm_unlink(object.c_str());
+            throw;
+        }
+        ::close(fd);
+        control_->generation.store(generation, std::memory_order_release);
+        if (generation_ > 0) ::shm_unlink(detail::SharedTrieObject(name_, generation_).c_str());
+        generation_ = generation;
+        return generation;
+    }
+
+    auto Generation() const -> uint64_t { return generation_; }
+
+   private:
+    const std::string name_;
+    detail::SharedTrieControl* control_{nullptr};
+    uint64_t generation_{0};
+};
+
+// A SharedTrieReader queries the snapshot published under a name, in place:
+// lookups read the shared pages and never copy the trie.
+class SharedTrieReader {
+   public:
+    // Attach to the publisher of `name` and map its newest snapshot, if any.
+    // Throws std::runtime_error if there is no such publisher.
+    explicit SharedTrieReader(std::string name) : name_(std::move(name)) {
+        int fd = ::shm_open(name_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) throw std::runtime_error("SharedTrieReader: no publisher for " + name_);
+        void* data = ::mmap(nullptr, sizeof(detail::SharedTrieControl), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) throw std::runtime_error("SharedTrieReader: cannot map " + name_);
+        control_ = static_cast<const detail::SharedTrieControl*>(data);
+        if (std::string_view(control_->magic, 8) != detail::kSharedTrieMagic) {
+            ::munmap(const_cast<detail::SharedTrieControl*>(control_), sizeof(detail::SharedTrieControl));
+            throw std::runtime_error("SharedTrieReader: " + name_ + " is not a shared trie");
+        }
+        Refresh();
+    }
+
+    SharedTrieReader(const SharedTrieReader&) = delete;
+    auto operator=(const SharedTrieReader&) -> SharedTrieReader& = delete;
+
+    ~SharedTrieReader() {
+        ::munmap(const_cast<detail::SharedTrieControl*>(control_), sizeof(detail::SharedTrieControl));
+    }
+
+    // Switch to the newest published snapshot. Returns whether it changed.
+    // Views returned by Get before the switch become invalid.
+    auto Refresh() -> bool {
+        while (true) {
+            const uint64_t generation = control_->generation.load(std::memory_order_acquire);
+            if (generation == generation_) return false;
+            const std::string object = detail::SharedTrieObject(name_, generation);
+            int fd = ::shm_open(object.c_str(), O_RDONLY | O_CLOEXEC, 0);
+            if (fd < 0 && errno == ENOENT) {
+                // Already replaced and unlinked, so read the generation
+                // again, unless the publisher is gone.
+                if (control_->generation.load(std::memory_order_acquire) == generation) return false;
+                continue;
+            }
+            if (fd < 0) throw std::runtime_error("SharedTrieReader: cannot open " + object);
+            try {
+                snapshot_.emplace(MappedTrie::Map(fd, object));
+            } catch (...) {
+                ::close(fd);
+                throw;
+            }
+            ::close(fd);
+            generation_ = generation;
+            return true;
+        }
+    }
+
+    // The generation being read; 0 before anything is published.
+    auto Generation() const -> uint64_t { return generation_; }
+
+    // The encoded value of `key` in the current snapshot, if any.
+    auto Get(std::string_view key) const -> std::optional<std::string_view> {
+        if (!snapshot_) return std::nullopt;
+        return snapshot_->Get(key);
+    }
+
+    template <class T>
+    auto GetAs(std::string_view key) const -> std::optional<T> {
+        if (!snapshot_) return std::nullopt;
+        return snapshot_->GetAs<T>(key);
+    }
+
+    // The current snapshot, for scans and prefix matches; nullptr before
+    // anything is published.
+    auto Snapshot() const -> const MappedTrie* { return snapshot_ ? &*snapshot_ : nullptr; }
+
+   private:
+    const std::string name_;
+    const detail::SharedTrieControl* control_{nullptr};
+    uint64_t generation_{0};
+    std::optional<MappedTrie> snapshot_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_SHARED_TRIE_HPP
@@ -6,7 +6,13 @@
 #define SJTU_TRIE_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <future>
 #include <iostream>
 #include <map>
@@ -17,12 +23,67 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "pattern.hpp"
+
 namespace sjtu {
 
+namespace detail {
+
+// The counters behind TrieStore::Stats.
+enum Stat : size_t {
+    kStatHits,
+    kStatMisses,
+    kStatPuts,
+    kStatRemoves,
+    kStatNoopRemoves,
+    kStatVersionsPublished,
+    kStatWriteLockWaitNs,
+    kStatSnapshotsLockWaitNs,
+    kStatNodesCloned,
+    kStatNodesAllocated,
+    kStatCount,
+};
+
+// Counters split into cache-line sized shards. Each thread is given a shard
+// round-robin when it first counts and keeps it for its lifetime, so threads
+// share a shard, and its cache line, only when their turns are kShards apart;
+// reading sums all shards.
+class ShardedCounters {
+   public:
+    static constexpr size_t kShards = 32;
+
+    void Add(Stat stat, uint64_t n = 1) {
+        shards_[ThisShard()].values[stat].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    auto Sum(Stat stat) const -> uint64_t {
+        uint64_t sum = 0;
+        for (const auto& shard : shards_) sum += shard.values[stat].load(std::memory_order_relaxed);
+        return sum;
+    }
+
+   private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> values[kStatCount]{};
+    };
+
+    static auto ThisShard() -> size_t {
+        static std::atomic<size_t> next{0};
+        thread_local const size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return shard;
+    }
+
+    Shard shards_[kShards];
+};
+
+}  // namespace detail
+
 // A TrieNode is a node in a Trie.
 class TrieNode {
    public:
@@ -33,7 +94,17 @@ class TrieNode {
     explicit TrieNode(std::map<char, std::shared_ptr<TrieNode>> children)
         : children_(std::move(children)) {}
 
-    virtual ~TrieNode() = default;
+    // Children held only by this node are unlinked before they go, one level
+    // at a time, so freeing a long key's chain does not recurse per byte.
+    virtual ~TrieNode() {
+        std::vector<std::shared_ptr<TrieNode>> orphans;
+        Orphan(children_, orphans);
+        while (!orphans.empty()) {
+            std::shared_ptr<TrieNode> node = std::move(orphans.back());
+            orphans.pop_back();
+            Orphan(node->children_, orphans);
+        }
+    }
 
     // Clone returns a copy of this TrieNode. If the TrieNode has a value, the
     // value is copied. The return type of this function is a unique_ptr to a
@@ -57,6 +128,16 @@ class TrieNode {
 
     // You can add additional fields and methods here. But in general, you don't
     // need to add extra fields to complete this project.
+
+   private:
+    // Move the children that nothing else holds to `orphans` and drop the
+    // rest.
+    static void Orphan(std::map<char, std::shared_ptr<TrieNode>>& children,
+                       std::vector<std::shared_ptr<TrieNode>>& orphans) {
+        for (auto& [c, child] : children)
+            if (child.use_count() == 1) orphans.push_back(std::move(child));
+        children.clear();
+    }
 };
 
 // A TrieNodeWithValue is a TrieNode that also has a value of type T associated
@@ -89,6 +170,65 @@ class TrieNodeWithValue : public TrieNode {
     std::shared_ptr<T> value_;
 };
 
+namespace detail {
+
+// Return the value of type T stored in `node`, or nullptr.
+template <class T>
+auto ValueOf(const TrieNode* node) -> const T* {
+    if (!node || !node->is_value_node_) return nullptr;
+    auto target = dynamic_cast<const TrieNodeWithValue<T>*>(node);
+    return target ? target->value_.get() : nullptr;
+}
+
+// Return a node with the value (if any) of `right`, or else of `left`, and
+// the given children.
+inline auto MergedNode(const TrieNode& left, const TrieNode& right,
+                       std::map<char, std::shared_ptr<TrieNode>> children) -> std::shared_ptr<TrieNode> {
+    std::shared_ptr<TrieNode> node = right.is_value_node_ ? right.Clone() : left.Clone();
+    node->children_ = std::move(children);
+    return node;
+}
+
+// Walks the children of a node in key order, i.e. comparing bytes as
+// unsigned like std::string does. TrieNode::children_ sorts by char, which is
+// signed on most targets, so its bytes 0x80-0xff come first; the cursor
+// starts at byte 0x00 and wraps around to them.
+class ChildCursor {
+   public:
+    using Map = std::map<char, std::shared_ptr<TrieNode>>;
+
+    explicit ChildCursor(const Map& children)
+        : children_(children), middle_(children.lower_bound('\0')), it_(middle_) {
+        if (it_ == children_.end()) Wrap();
+    }
+
+    auto Done() const -> bool { return wrapped_ && it_ == middle_; }
+    auto Byte() const -> char { return it_->first; }
+    auto Child() const -> const std::shared_ptr<TrieNode>& { return it_->second; }
+
+    void Next() {
+        if (++it_ == children_.end() && !wrapped_) Wrap();
+    }
+
+    // Whether byte `a` comes before byte `b` in key order.
+    static auto Less(char a, char b) -> bool {
+        return static_cast<unsigned char>(a) < static_cast<unsigned char>(b);
+    }
+
+   private:
+    void Wrap() {
+        wrapped_ = true;
+        it_ = children_.begin();
+    }
+
+    const Map& children_;
+    const Map::const_iterator middle_;
+    Map::const_iterator it_;
+    bool wrapped_{false};
+};
+
+}  // namespace detail
+
 // A Trie is a data structure that maps strings to values of type T. All
 // operations on a Trie should not modify the trie itself. It should reuse the
 // existing nodes as much as possible, and create new nodes to represent the new
@@ -102,6 +242,8 @@ class Trie {
     explicit Trie(std::shared_ptr<TrieNode> root)
         : root_(std::move(root)) {}
 
+    friend class TrieAccess;
+
    public:
     // Create an empty trie.
     Trie() = default;
@@ -181,10 +323,679 @@ class Trie {
             current->children_[key[i]] = current->children_[key[i]]->Clone();
             current = current->children_[key[i]];
         }
-        if(current->children_.find(key.back()) == current->children_.end()) return *this;
+        auto target = current->children_.find(key.back());
+        if(target == current->children_.end() || !target->second->is_value_node_) return *this;
         current->children_[key.back()] = std::shared_ptr<TrieNode>(new TrieNode(current->children_[key.back()]->children_));
         return Trie(newroot);
     }
+
+    // Remove every key that starts with `prefix`. The whole subtree is unlinked
+    // with a single copy of the path to `prefix`. If no key starts with
+    // `prefix`, return the original trie.
+    auto RemovePrefix(std::string_view prefix) const -> Trie
+    {
+        return ReplaceAt(prefix, nullptr);
+    }
+
+    // Remove every key k with lo <= k < hi (compared as std::string does).
+    // Only the nodes on the paths to `lo` and `hi` are copied; subtrees lying
+    // entirely inside the range are unlinked as a whole and subtrees outside
+    // it are shared. If nothing is removed, return the original trie.
+    auto RemoveRange(std::string_view lo, std::string_view hi) const -> Trie
+    {
+        if(!root_ || !(lo < hi)) return *this;
+        auto newroot = RemoveRangeAt(root_, lo, hi);
+        if(newroot == root_) return *this;
+        return Trie(newroot);
+    }
+
+    // Split the trie at `key`: the first trie holds the keys below `key`, the
+    // second the keys at or above it (compared as std::string does). Only the
+    // nodes on the path to `key` are copied; every other subtree is shared by
+    // one of the two results.
+    auto SplitAt(std::string_view key) const -> std::pair<Trie, Trie>
+    {
+        if(!root_) return {Trie(), Trie()};
+        auto [left, right] = SplitNode(root_, key);
+        return {Trie(std::move(left)), Trie(std::move(right))};
+    }
+
+    // Join two tries where every key of `left` is below every key of `right`,
+    // e.g. the two halves returned by SplitAt. Only the nodes on the boundary
+    // path between the two tries are copied. Throws std::invalid_argument if
+    // the tries are not ordered this way.
+    static auto Join(const Trie& left, const Trie& right) -> Trie
+    {
+        return Trie(JoinNodes(left.root_, right.root_));
+    }
+
+    // Call `callback(key, old_value, new_value)` for every key of type T whose
+    // value differs between `from` and `to`, in key order. A pointer is null
+    // where the key is absent (or not of type T) in that trie. Subtrees shared
+    // by both tries are skipped without being visited.
+    template <class T, class F>
+    static void Diff(const Trie& from, const Trie& to, F&& callback)
+    {
+        DiffNodes<T>(from.root_.get(), to.root_.get(), callback);
+    }
+
+    // Merge two tries: the result holds every key of both, and where a key is
+    // in both, the value of `right` wins. Subtrees present in only one trie,
+    // or shared by both, are reused as they are; only nodes where the tries
+    // diverge are copied.
+    static auto Merge(const Trie& left, const Trie& right) -> Trie
+    {
+        return Trie(MergeNodes(left.root_, right.root_));
+    }
+
+    // Return the trie rooted at the node of `prefix`: its keys are the keys of
+    // this trie that start with `prefix`, with the prefix stripped. No node is
+    // copied, so this costs O(|prefix|). Returns an empty trie if no key
+    // starts with `prefix`.
+    auto SubTrie(std::string_view prefix) const -> Trie
+    {
+        std::shared_ptr<TrieNode> node = root_;
+        for(size_t i = 0; i < prefix.size() && node; ++i)
+        {
+            auto it = node->children_.find(prefix[i]);
+            node = it == node->children_.end() ? nullptr : it->second;
+        }
+        return Trie(node);
+    }
+
+    // Attach `other` under `prefix`: the keys starting with `prefix` are
+    // replaced by `prefix` followed by each key of `other`. Only the nodes on
+    // the path to `prefix` are copied; every node of `other` is shared.
+    // Returns the new trie.
+    auto Graft(std::string_view prefix, const Trie& other) const -> Trie
+    {
+        return ReplaceAt(prefix, other.root_);
+    }
+
+    // Call `callback(key, value, distance)` for every key of type T whose
+    // Levenshtein distance to `query` is at most `max_edits`, in key order.
+    // The trie is walked in lockstep with one row of the edit distance table
+    // per depth, so a shared prefix is scored only once, and a subtree is
+    // skipped as soon as every entry of its row exceeds `max_edits`.
+    template <class T, class F>
+    void FuzzySearch(std::string_view query, size_t max_edits, F&& callback) const
+    {
+        if(!root_) return;
+        std::vector<std::vector<size_t>> rows(1, std::vector<size_t>(query.size() + 1));
+        for(size_t j = 0; j <= query.size(); ++j) rows[0][j] = j;
+        FuzzyVisit<T>(root_.get(), query, max_edits, rows, callback);
+    }
+
+    // Return every key of type T matched by `pattern`, with its value, in key
+    // order. Only children whose DFA transition is still live are visited,
+    // and where the pattern allows fewer next bytes than the node has
+    // children (e.g. inside a literal fragment) those children are looked up
+    // directly instead of scanning the node.
+    template <class T>
+    auto Match(const Pattern& pattern) const -> std::vector<std::pair<std::string, const T*>>
+    {
+        std::vector<std::pair<std::string, const T*>> result;
+        if(!root_ || pattern.Start() < 0) return result;
+        MatchVisit<T>(root_.get(), pattern, result);
+        return result;
+    }
+
+    // Same as above, with `glob` compiled by Pattern::Glob.
+    template <class T>
+    auto Match(std::string_view glob) const -> std::vector<std::pair<std::string, const T*>>
+    {
+        return Match<T>(Pattern::Glob(glob));
+    }
+
+   private:
+    // Whether `node` or any node below it holds a value. Remove leaves
+    // valueless nodes behind, so a subtree may hold no key at all.
+    static auto HasValue(const TrieNode* node) -> bool
+    {
+        std::vector<const TrieNode*> stack{node};
+        while(!stack.empty())
+        {
+            node = stack.back();
+            stack.pop_back();
+            if(node->is_value_node_) return true;
+            for(const auto& [c, child] : node->children_) stack.push_back(child.get());
+        }
+        return false;
+    }
+
+    // Copy the path to `prefix` and hang `subtree` at its end. A null
+    // `subtree` unlinks the node at `prefix`, and ancestors left without a
+    // value or children are dropped as well.
+    auto ReplaceAt(std::string_view prefix, std::shared_ptr<TrieNode> subtree) const -> Trie
+    {
+        std::vector<const TrieNode*> path;
+        const TrieNode* node = root_.get();
+        for(size_t i = 0; i < prefix.size() && node; ++i)
+        {
+            path.push_back(node);
+            auto it = node->children_.find(prefix[i]);
+            node = it == node->children_.end() ? nullptr : it->second.get();
+        }
+        // Unlinking a subtree without keys removes nothing.
+        if(!subtree && (!node || !HasValue(node))) return *this;
+
+        std::shared_ptr<TrieNode> child = std::move(subtree);
+        for(size_t i = prefix.size(); i-- > 0;)
+        {
+            std::shared_ptr<TrieNode> parent =
+                i < path.size() ? std::shared_ptr<TrieNode>(path[i]->Clone()) : std::make_shared<TrieNode>();
+            if(child) parent->children_[prefix[i]] = std::move(child);
+            else
+            {
+                parent->children_.erase(prefix[i]);
+                if(parent->children_.empty() && !parent->is_value_node_) parent = nullptr;
+            }
+            child = std::move(parent);
+        }
+        return Trie(child);
+    }
+
+    // Remove every key lo <= k < hi below `root`. Only the nodes on the paths
+    // to `lo` and `hi` are opened; `path` holds the ones being rebuilt.
+    static auto RemoveRangeAt(const std::shared_ptr<TrieNode>& root, std::string_view lo, std::string_view hi)
+        -> std::shared_ptr<TrieNode>
+    {
+        std::string key;
+        auto is_prefix = [&key](std::string_view s) { return s.substr(0, key.size()) == key; };
+        // Set `kept` and return true if the subtree at `key` is settled as a
+        // whole: when every key below it is lo <= k < hi, it is dropped,
+        // unless it holds no key, so that nothing counts as removed; when no
+        // key below it is in the range, it is shared.
+        auto settled = [&](const std::shared_ptr<TrieNode>& node, std::shared_ptr<TrieNode>& kept) {
+            if(!(std::string_view(key) < lo) && key < hi && !is_prefix(hi))
+                kept = HasValue(node.get()) ? nullptr : node;
+            else if((key < lo && !is_prefix(lo)) || !(std::string_view(key) < hi)) kept = node;
+            else return false;
+            return true;
+        };
+
+        struct Frame {
+            const std::shared_ptr<TrieNode>* node;
+            std::map<char, std::shared_ptr<TrieNode>>::const_iterator next;
+            std::map<char, std::shared_ptr<TrieNode>> children;
+            bool strip;
+            bool changed;
+        };
+        auto open = [&](const std::shared_ptr<TrieNode>& node) {
+            const bool strip = node->is_value_node_ && !(std::string_view(key) < lo);
+            return Frame{&node, node->children_.begin(), {}, strip, strip};
+        };
+
+        std::shared_ptr<TrieNode> kept;
+        if(settled(root, kept)) return kept;
+        std::vector<Frame> path{open(root)};
+        while(true)
+        {
+            Frame& top = path.back();
+            const TrieNode& node = **top.node;
+            if(top.next != node.children_.end())
+            {
+                const auto& [c, child] = *top.next++;
+                key.push_back(c);
+                if(!settled(child, kept))
+                {
+                    path.push_back(open(child));
+                    continue;
+                }
+                key.pop_back();
+                top.changed |= kept != child;
+                if(kept) top.children.emplace(c, std::move(kept));
+                continue;
+            }
+
+            if(!top.changed) kept = *top.node;
+            else if(top.children.empty() && (top.strip || !node.is_value_node_)) kept = nullptr;
+            else if(top.strip) kept = std::make_shared<TrieNode>(std::move(top.children));
+            else
+            {
+                kept = node.Clone();
+                kept->children_ = std::move(top.children);
+            }
+            const bool changed = kept != *top.node;
+            path.pop_back();
+            if(path.empty()) return kept;
+            const char c = key.back();
+            key.pop_back();
+            path.back().changed |= changed;
+            if(kept) path.back().children.emplace(c, std::move(kept));
+        }
+    }
+
+    // Split the subtree of `root` at `key`. Only the nodes on the path to
+    // `key` are split; they are collected first and split bottom-up.
+    static auto SplitNode(const std::shared_ptr<TrieNode>& root, std::string_view key)
+        -> std::pair<std::shared_ptr<TrieNode>, std::shared_ptr<TrieNode>>
+    {
+        std::vector<const std::shared_ptr<TrieNode>*> path{&root};
+        while(path.size() <= key.size())
+        {
+            const auto& children = (*path.back())->children_;
+            auto it = children.find(key[path.size() - 1]);
+            if(it == children.end()) break;
+            path.push_back(&it->second);
+        }
+        // No key below the node of `key` itself is below `key`.
+        std::shared_ptr<TrieNode> left, right;
+        if(path.size() > key.size())
+        {
+            right = *path.back();
+            path.pop_back();
+        }
+
+        for(size_t depth = path.size(); depth-- > 0;)
+        {
+            const std::shared_ptr<TrieNode>& node = *path[depth];
+            const auto split = static_cast<unsigned char>(key[depth]);
+            std::map<char, std::shared_ptr<TrieNode>> low, high;
+            for(const auto& [c, child] : node->children_)
+            {
+                const auto byte = static_cast<unsigned char>(c);
+                if(byte < split) low.emplace(c, child);
+                else if(byte > split) high.emplace(c, child);
+                else
+                {
+                    // The halves of this child, split in the previous round.
+                    if(left) low.emplace(c, std::move(left));
+                    if(right) high.emplace(c, std::move(right));
+                }
+            }
+            // The key of `node` itself is below `key`, so its value stays left.
+            left = right = nullptr;
+            if(high.empty() && low == node->children_) left = node;
+            else if(node->is_value_node_ || !low.empty())
+            {
+                left = node->Clone();
+                left->children_ = std::move(low);
+            }
+            if(!high.empty()) right = std::make_shared<TrieNode>(std::move(high));
+        }
+        return {std::move(left), std::move(right)};
+    }
+
+    // Whether `root` or any node below it holds a value, like HasValue, but
+    // remembering the answer in `live` for every node the walk settles: the
+    // nodes on the path to the value found, and the subtrees found empty. A
+    // node is therefore walked at most once across calls sharing `live`.
+    static auto HasValue(const TrieNode* root, std::unordered_map<const TrieNode*, bool>& live) -> bool
+    {
+        std::vector<std::pair<const TrieNode*, std::map<char, std::shared_ptr<TrieNode>>::const_iterator>> path;
+        // 1 if `node` holds a key, 0 if it holds none, -1 if not known yet.
+        auto enter = [&](const TrieNode* node) -> int {
+            auto it = live.find(node);
+            if(it != live.end()) return it->second;
+            if(node->is_value_node_) return 1;
+            path.emplace_back(node, node->children_.begin());
+            return -1;
+        };
+        int found = enter(root);
+        while(found != 1 && !path.empty())
+        {
+            auto& [node, next] = path.back();
+            if(next == node->children_.end())
+            {
+                live[node] = false;
+                path.pop_back();
+                continue;
+            }
+            found = enter((next++)->second.get());
+        }
+        if(found == 1)
+            for(const auto& step : path) live[step.first] = true;
+        return found == 1;
+    }
+
+    // The byte (as unsigned) of the first child of `node` that holds a key,
+    // counting from the highest byte if `highest` is set and from the lowest
+    // otherwise, or -1 if no child holds a key. Children past that one are
+    // not looked at.
+    static auto LiveEdge(const TrieNode& node, bool highest, std::unordered_map<const TrieNode*, bool>& live)
+        -> int
+    {
+        std::vector<std::pair<char, const TrieNode*>> order;
+        for(detail::ChildCursor it(node.children_); !it.Done(); it.Next())
+            order.emplace_back(it.Byte(), it.Child().get());
+        if(highest) std::reverse(order.begin(), order.end());
+        for(const auto& [c, child] : order)
+            if(HasValue(child, live)) return static_cast<unsigned char>(c);
+        return -1;
+    }
+
+    static auto JoinNodes(const std::shared_ptr<TrieNode>& left, const std::shared_ptr<TrieNode>& right)
+        -> std::shared_ptr<TrieNode>
+    {
+        // A side without keys (e.g. a trie emptied by Remove) orders against
+        // anything.
+        std::unordered_map<const TrieNode*, bool> live;
+        if(!left || !HasValue(left.get(), live)) return right;
+        if(!right || !HasValue(right.get(), live)) return left;
+
+        // Walk down the boundary path, the one label per level under which
+        // both sides hold keys. Under any other label at most one side holds
+        // keys, and that side's child is taken as it is.
+        std::shared_ptr<TrieNode> root = left->Clone();
+        TrieNode* joined = root.get();
+        const TrieNode* other = right.get();
+        while(true)
+        {
+            // The left side has keys at or below this node, so the right side
+            // may not end here, and the left keys must not branch off after
+            // the right ones.
+            const int left_max = LiveEdge(*joined, true, live);
+            const int right_min = LiveEdge(*other, false, live);
+            if(other->is_value_node_ || left_max > right_min)
+                throw std::invalid_argument("Trie::Join: tries are not disjoint and ordered");
+
+            TrieNode* next = nullptr;
+            const TrieNode* next_other = nullptr;
+            for(const auto& [c, child] : other->children_)
+            {
+                const int byte = static_cast<unsigned char>(c);
+                auto it = joined->children_.find(c);
+                if(it == joined->children_.end()) joined->children_.emplace(c, child);
+                else if(byte == left_max && byte == right_min)
+                {
+                    it->second = it->second->Clone();
+                    next = it->second.get();
+                    next_other = child.get();
+                }
+                else if(byte >= right_min) it->second = child;
+            }
+            if(!next) return root;
+            joined = next;
+            other = next_other;
+        }
+    }
+
+    template <class T, class F>
+    static void DiffNodes(const TrieNode* from, const TrieNode* to, F& callback)
+    {
+        static const std::map<char, std::shared_ptr<TrieNode>> none;
+        // One pair of cursors over the children of each node pair on the
+        // path to `key`.
+        std::vector<std::pair<detail::ChildCursor, detail::ChildCursor>> path;
+        std::string key;
+        // Report the node pair at `key` and open its children, unless it is
+        // shared and so holds no difference.
+        auto enter = [&](const TrieNode* x, const TrieNode* y) {
+            if(x == y) return false;
+            const T* old_value = detail::ValueOf<T>(x);
+            const T* new_value = detail::ValueOf<T>(y);
+            if(old_value != new_value) callback(std::as_const(key), old_value, new_value);
+            path.emplace_back(detail::ChildCursor(x ? x->children_ : none),
+                              detail::ChildCursor(y ? y->children_ : none));
+            return true;
+        };
+
+        enter(from, to);
+        while(!path.empty())
+        {
+            auto& [i, j] = path.back();
+            if(i.Done() && j.Done())
+            {
+                path.pop_back();
+                if(!path.empty()) key.pop_back();
+                continue;
+            }
+            const TrieNode* x = nullptr;
+            const TrieNode* y = nullptr;
+            char c;
+            if(j.Done() || (!i.Done() && detail::ChildCursor::Less(i.Byte(), j.Byte())))
+                c = i.Byte(), x = i.Child().get(), i.Next();
+            else if(i.Done() || detail::ChildCursor::Less(j.Byte(), i.Byte()))
+                c = j.Byte(), y = j.Child().get(), j.Next();
+            else c = i.Byte(), x = i.Child().get(), y = j.Child().get(), i.Next(), j.Next();
+            key.push_back(c);
+            if(!enter(x, y)) key.pop_back();
+        }
+    }
+
+    static auto MergeNodes(const std::shared_ptr<TrieNode>& left, const std::shared_ptr<TrieNode>& right)
+        -> std::shared_ptr<TrieNode>
+    {
+        if(!left || left == right) return right;
+        if(!right) return left;
+        // A node pair present in both tries, with the children merged so far
+        // and the next child of `right` to merge in.
+        struct Frame {
+            const TrieNode* left;
+            const TrieNode* right;
+            std::map<char, std::shared_ptr<TrieNode>> children;
+            std::map<char, std::shared_ptr<TrieNode>>::const_iterator next;
+            char label;
+        };
+        std::vector<Frame> path;
+        path.push_back({left.get(), right.get(), left->children_, right->children_.begin(), '\0'});
+        while(true)
+        {
+            Frame& top = path.back();
+            if(top.next != top.right->children_.end())
+            {
+                const auto& [c, child] = *top.next++;
+                const std::shared_ptr<TrieNode>& slot = top.children[c];
+                if(!slot || slot == child) top.children[c] = child;
+                else path.push_back({slot.get(), child.get(), slot->children_, child->children_.begin(), c});
+                continue;
+            }
+            auto merged = detail::MergedNode(*top.left, *top.right, std::move(top.children));
+            const char c = top.label;
+            path.pop_back();
+            if(path.empty()) return merged;
+            path.back().children[c] = std::move(merged);
+        }
+    }
+
+    template <class T>
+    static void MatchVisit(const TrieNode* root, const Pattern& pattern,
+                           std::vector<std::pair<std::string, const T*>>& result)
+    {
+        // A node on the path to `key` and its DFA state. Its children are
+        // either looked up by the live bytes of the state (`next` indexes
+        // them) or, where there are fewer children than live bytes, scanned.
+        struct Frame {
+            const TrieNode* node;
+            int state;
+            size_t next;
+            std::optional<detail::ChildCursor> scan;
+        };
+        std::vector<Frame> path;
+        std::string key;
+        auto enter = [&](const TrieNode* node, int state) {
+            if(node->is_value_node_ && pattern.Accepts(state))
+            {
+                auto target = dynamic_cast<const TrieNodeWithValue<T>*>(node);
+                if(target && target->value_) result.emplace_back(key, target->value_.get());
+            }
+            path.push_back({node, state, 0, std::nullopt});
+            if(pattern.LiveBytes(state).size() >= node->children_.size()) path.back().scan.emplace(node->children_);
+        };
+
+        enter(root, pattern.Start());
+        while(!path.empty())
+        {
+            Frame& top = path.back();
+            const TrieNode* child = nullptr;
+            int next = -1;
+            char c = 0;
+            if(top.scan)
+            {
+                for(; next < 0 && !top.scan->Done(); top.scan->Next())
+                {
+                    c = top.scan->Byte();
+                    next = pattern.Next(top.state, c);
+                    child = top.scan->Child().get();
+                }
+            }
+            else
+            {
+                const std::string& live = pattern.LiveBytes(top.state);
+                while(next < 0 && top.next < live.size())
+                {
+                    c = live[top.next++];
+                    auto it = top.node->children_.find(c);
+                    if(it == top.node->children_.end()) continue;
+                    child = it->second.get();
+                    next = pattern.Next(top.state, c);
+                }
+            }
+            if(next < 0)
+            {
+                path.pop_back();
+                if(!path.empty()) key.pop_back();
+                continue;
+            }
+            key.push_back(c);
+            enter(child, next);
+        }
+    }
+
+    template <class T, class F>
+    static void FuzzyVisit(const TrieNode* root, std::string_view query, size_t max_edits,
+                           std::vector<std::vector<size_t>>& rows, F& callback)
+    {
+        // One cursor per node on the path to `key`; rows[depth] is the row of
+        // the node at that depth.
+        std::vector<detail::ChildCursor> path;
+        std::string key;
+        auto enter = [&](const TrieNode* node) {
+            const size_t depth = key.size();
+            if(node->is_value_node_ && rows[depth][query.size()] <= max_edits)
+            {
+                auto target = dynamic_cast<const TrieNodeWithValue<T>*>(node);
+                if(target && target->value_)
+                    callback(std::as_const(key), std::as_const(*target->value_), rows[depth][query.size()]);
+            }
+            if(rows.size() <= depth + 1) rows.emplace_back(query.size() + 1);
+            path.emplace_back(node->children_);
+        };
+
+        enter(root);
+        while(!path.empty())
+        {
+            detail::ChildCursor& it = path.back();
+            if(it.Done())
+            {
+                path.pop_back();
+                if(!path.empty()) key.pop_back();
+                continue;
+            }
+            const char c = it.Byte();
+            const TrieNode* child = it.Child().get();
+            it.Next();
+            const size_t depth = key.size();
+            auto& next = rows[depth + 1];
+            const auto& prev = rows[depth];
+            next[0] = prev[0] + 1;
+            size_t best = next[0];
+            for(size_t j = 1; j <= query.size(); ++j)
+            {
+                size_t cost = prev[j - 1] + (query[j - 1] == c ? 0 : 1);
+                next[j] = std::min({cost, prev[j] + 1, next[j - 1] + 1});
+                best = std::min(best, next[j]);
+            }
+            if(best > max_edits) continue;
+            key.push_back(c);
+            enter(child);
+        }
+    }
+};
+
+// TrieAccess exposes the root of a Trie to the algorithms built on top of it
+// in the other headers of this directory (parallel construction,
+// serialization, ...). Nodes reachable from a Trie must never be modified.
+class TrieAccess {
+   public:
+    static auto Root(const Trie& trie) -> const std::shared_ptr<TrieNode>& { return trie.root_; }
+    static auto Make(std::shared_ptr<TrieNode> root) -> Trie { return Trie(std::move(root)); }
+
+    // The node of `key`, or nullptr.
+    static auto Find(const Trie& trie, std::string_view key) -> const TrieNode* {
+        const TrieNode* node = trie.root_.get();
+        for (size_t i = 0; i < key.size() && node; ++i) {
+            auto it = node->children_.find(key[i]);
+            node = it == node->children_.end() ? nullptr : it->second.get();
+        }
+        return node;
+    }
+
+    // The value of type T stored in `node`, or nullptr.
+    template <class T>
+    static auto ValueOf(const TrieNode* node) -> const T* { return detail::ValueOf<T>(node); }
+};
+
+// A TrieBuilder applies many updates to a trie in place before freezing it
+// into a Trie. Nodes created by the builder are modified directly instead of
+// being copied on every update, so building N keys allocates each node once.
+// Nodes of the base trie are still shared and are only cloned on first write.
+class TrieBuilder {
+   public:
+    // Start from an empty trie.
+    TrieBuilder() = default;
+
+    // Start from `base`, which is left untouched.
+    explicit TrieBuilder(const Trie& base)
+        : root_(TrieAccess::Root(base)), shared_base_(root_ != nullptr) {}
+
+    // Set the value of `key`, overwriting it if it exists. Unlike Trie::Put,
+    // the empty key is allowed and stores the value at the root.
+    template <class T>
+    void Put(std::string_view key, T value) {
+        std::shared_ptr<TrieNode>* slot = &root_;
+        for (char c : key) slot = &Own(*slot)->children_[c];
+        auto node = std::make_shared<TrieNodeWithValue<T>>(std::make_shared<T>(std::move(value)));
+        if (*slot) node->children_ = Owns(slot->get()) ? std::move((*slot)->children_) : (*slot)->children_;
+        Replace(*slot, std::move(node));
+    }
+
+    // Remove the value of `key` if it exists.
+    void Remove(std::string_view key) {
+        const TrieNode* node = root_.get();
+        for (size_t i = 0; i < key.size() && node; ++i) {
+            auto it = node->children_.find(key[i]);
+            node = it == node->children_.end() ? nullptr : it->second.get();
+        }
+        if (!node || !node->is_value_node_) return;
+        std::shared_ptr<TrieNode>* slot = &root_;
+        for (char c : key) slot = &Own(*slot)->children_[c];
+        auto plain = std::make_shared<TrieNode>(
+            Owns(slot->get()) ? std::move((*slot)->children_) : (*slot)->children_);
+        Replace(*slot, std::move(plain));
+    }
+
+    // Freeze the nodes built so far into a Trie and reset the builder.
+    auto Build() -> Trie {
+        owned_.clear();
+        shared_base_ = false;
+        return TrieAccess::Make(std::move(root_));
+    }
+
+   private:
+    auto Owns(const TrieNode* node) const -> bool { return !shared_base_ || owned_.count(node) > 0; }
+
+    // Make `slot` point to a node this builder may modify and return it.
+    auto Own(std::shared_ptr<TrieNode>& slot) -> TrieNode* {
+        if (!slot) Replace(slot, std::make_shared<TrieNode>());
+        else if (!Owns(slot.get())) Replace(slot, std::shared_ptr<TrieNode>(slot->Clone()));
+        return slot.get();
+    }
+
+    void Replace(std::shared_ptr<TrieNode>& slot, std::shared_ptr<TrieNode> node) {
+        if (shared_base_) {
+            if (slot) owned_.erase(slot.get());
+            owned_.insert(node.get());
+        }
+        slot = std::move(node);
+    }
+
+    std::shared_ptr<TrieNode> root_;
+    // Whether root_ started out as a shared trie. Otherwise every node below
+    // root_ was created here and owned_ is not needed.
+    bool shared_base_{false};
+    std::unordered_set<const TrieNode*> owned_;
 };
 
 // This class is used to guard the value returned by the trie. It holds a
@@ -202,6 +1013,155 @@ class ValueGuard {
     const T& value_;
 };
 
+namespace detail {
+
+// A Reclaimer releases retired tries on a background thread, so that the
+// thread dropping the last reference to a large subtree or a long history
+// does not pay for freeing it. The thread is started on first use and drains
+// the queue before the process exits.
+class Reclaimer {
+   public:
+    static auto Instance() -> Reclaimer& {
+        static Reclaimer reclaimer;
+        return reclaimer;
+    }
+
+    Reclaimer(const Reclaimer&) = delete;
+    auto operator=(const Reclaimer&) -> Reclaimer& = delete;
+
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    void Retire(std::vector<Trie> tries) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (!thread_.joinable()) thread_ = std::thread([this] { Run(); });
+            queue_.push_back(std::move(tries));
+            ++retired_;
+        }
+        wake_.notify_all();
+    }
+
+    // Wait until everything retired so far has been released.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(lock_);
+        const uint64_t target = retired_;
+        released_cv_.wait(lock, [&] { return released_ >= target; });
+    }
+
+   private:
+    Reclaimer() = default;
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (true) {
+            wake_.wait(lock, [this] { return !queue_.empty() || stopping_; });
+            if (queue_.empty()) return;
+            std::vector<Trie> tries = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            tries.clear();
+            lock.lock();
+            ++released_;
+            released_cv_.notify_all();
+        }
+    }
+
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable released_cv_;
+    std::deque<std::vector<Trie>> queue_;
+    uint64_t retired_{0};
+    uint64_t released_{0};
+    bool stopping_{false};
+    std::thread thread_;
+};
+
+}  // namespace detail
+
+// Drop `trie` on a background thread instead of in the caller. Whatever it
+// held alone is freed there, e.g. the subtree that RemovePrefix detached:
+//
+//   sjtu::Retire(std::exchange(trie, trie.RemovePrefix("tenant/")));
+inline void Retire(Trie trie) { detail::Reclaimer::Instance().Retire({std::move(trie)}); }
+
+// Wait until every trie retired so far has been released.
+inline void WaitRetired() { detail::Reclaimer::Instance().Wait(); }
+
+// A Commit describes one version published by a TrieStore.
+struct Commit {
+    enum class Op : uint8_t { kPut = 1, kRemove = 2, kRemovePrefix = 3, kRemoveRange = 4 };
+
+    Op op;
+    // The number of the published version.
+    size_t version;
+    // The key, or the prefix for kRemovePrefix, or `lo` for kRemoveRange.
+    std::string_view key;
+    // `hi` for kRemoveRange.
+    std::string_view hi;
+    // For kPut, the node holding the new value.
+    const TrieNode* value;
+    // The trie of the published version.
+    const Trie& trie;
+};
+
+// A CommitListener observes every version published by a TrieStore, e.g. to
+// log, replicate or announce it. Listeners are added with
+// TrieStore::AddListener.
+class CommitListener {
+   public:
+    virtual ~CommitListener() = default;
+
+    // Called for each commit in version order, with the store's write lock
+    // held and before the version becomes visible to readers. Throwing
+    // abandons the commit, and the listeners that already took it get
+    // OnAbort. Must not write to the store.
+    virtual void OnCommit(const Commit& commit) = 0;
+
+    // Called with the write lock held when a commit this listener took in
+    // OnCommit is abandoned, e.g. because a later listener threw. The next
+    // commit reuses the version number. Must not throw.
+    virtual void OnAbort(size_t version) { (void)version; }
+
+    // Called by the writer once the write lock is released, before its write
+    // returns. This is where a listener may block, e.g. to wait for fsync.
+    // Every listener is called even if one throws; the writer then rethrows
+    // the first exception.
+    virtual void AfterCommit(size_t version) { (void)version; }
+};
+
+// Operation counts of a TrieStore, see TrieStore::Stats.
+struct TrieStoreStats {
+    uint64_t gets{0};
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t puts{0};
+    // Remove, RemovePrefix and RemoveRange calls, including no-ops.
+    uint64_t removes{0};
+    uint64_t noop_removes{0};
+    uint64_t versions_published{0};
+    uint64_t versions_retained{0};
+    // Time spent blocked on the locks; uncontended acquisitions add nothing.
+    std::chrono::nanoseconds write_lock_wait{0};
+    std::chrono::nanoseconds snapshots_lock_wait{0};
+    // Nodes that the published versions hold and their predecessors did not:
+    // the paths each write copied or created. A new node that replaces one
+    // at the same key is a clone.
+    uint64_t nodes_cloned{0};
+    uint64_t nodes_allocated{0};
+    // There is no count of freed nodes. A store drops versions only in
+    // Restore, and a node it drops may live on in a snapshot handed out by
+    // GetSnapshot, a plain Trie or another store sharing it, so the store
+    // cannot tell when, or whether, the node is freed. MeasureMemory
+    // (memory.hpp) reports what a trie holds at any time.
+};
+
 // This class is a thread-safe wrapper around the Trie class. It provides a
 // simple interface for accessing the trie. It should allow concurrent reads and
 // a single write operation at the same time.
@@ -226,10 +1186,64 @@ class TrieStore {
     // if the key does not exist, version number should not be increased
     size_t Remove(std::string_view key);
 
+    // This function removes every key that starts with `prefix` and publishes
+    // exactly one version. Return the version number after operation; if no
+    // key starts with `prefix`, version number should not be increased. The
+    // detached subtree stays reachable from the older versions and is freed
+    // off the write path once Restore drops them.
+    size_t RemovePrefix(std::string_view prefix);
+
+    // This function removes every key k with lo <= k < hi and publishes
+    // exactly one version. Return the version number after operation; if no
+    // key is in the range, version number should not be increased
+    size_t RemoveRange(std::string_view lo, std::string_view hi);
+
+    // This function returns the version number and the trie of the given
+    // version (default: newest version). The trie is immutable and stays
+    // valid however the store changes. If the version does not exist, it will
+    // return std::nullopt.
+    auto GetSnapshot(size_t version = -1) -> std::optional<std::pair<size_t, Trie>>;
+
     // This function return the newest version number
     size_t get_version();
 
+    // This function replaces the whole history with `trie` as version
+    // `version`, e.g. a checkpoint being recovered. Older versions are no
+    // longer available and the next write publishes version + 1. The old
+    // history is released by the background reclaimer, not under the locks
+    // (see Retire). Listeners are not notified.
+    void Restore(Trie trie, size_t version);
+
+    // Notify `listener` of every version published from now on.
+    void AddListener(std::shared_ptr<CommitListener> listener);
+
+    // Stop notifying `listener`. A write already past its commit may still
+    // call its AfterCommit.
+    void RemoveListener(const std::shared_ptr<CommitListener>& listener);
+
+    // This function returns the operation counts so far. Counting is sharded
+    // per thread and only this function sums the shards. The shards make
+    // every TrieStore 4 KB larger: 32 of them, each padded to 128 bytes.
+    auto Stats() -> TrieStoreStats;
+
    private:
+    // Acquire `lock`, adding the time spent blocked to `stat`.
+    template <class Lock>
+    auto Acquire(Lock lock, detail::Stat stat) -> Lock;
+
+    // Count the nodes of `after` that `before` does not hold.
+    void CountNewNodes(const Trie& before, const Trie& after);
+    // Apply `update` to the newest version and publish the result, unless a
+    // removal left the trie unchanged. Return the version number after
+    // operation.
+    template <class F>
+    size_t Write(Commit::Op op, std::string_view key, std::string_view hi, F&& update);
+
+    // Hand the commit to the listeners, then append `trie` as the newest
+    // version and return its version number. The caller must hold
+    // write_lock_.
+    size_t Publish(Trie trie, Commit::Op op, std::string_view key, std::string_view hi);
+
     // This mutex sequences all writes operations and allows only one write
     // operation at a time. Concurrent modifications should have the effect of
     // applying them in some sequential order
@@ -237,10 +1251,206 @@ class TrieStore {
     std::shared_mutex snapshots_lock_;
 
     // Stores all historical versions of trie
-    // version number ranges from [0, snapshots_.size())
+    // version number ranges from [first_version_, first_version_ + snapshots_.size())
     std::vector<Trie> snapshots_{1};
+    size_t first_version_{0};
+
+    // Guarded by write_lock_
+    std::vector<std::shared_ptr<CommitListener>> listeners_;
+
+    detail::ShardedCounters stats_;
 };
 
+template <class Lock>
+auto TrieStore::Acquire(Lock lock, detail::Stat stat) -> Lock {
+    if (!lock.try_lock()) {
+        const auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        const auto waited = std::chrono::steady_clock::now() - start;
+        stats_.Add(stat, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    }
+    return lock;
+}
+
+template <class T>
+auto TrieStore::Get(std::string_view key, size_t version)
+    -> std::optional<ValueGuard<T>> {
+    Trie root;
+    {
+        auto lock = Acquire(std::shared_lock<std::shared_mutex>(snapshots_lock_, std::defer_lock),
+                            detail::kStatSnapshotsLockWaitNs);
+        if (version == static_cast<size_t>(-1)) version = first_version_ + snapshots_.size() - 1;
+        if (version < first_version_ || version - first_version_ >= snapshots_.size()) {
+            stats_.Add(detail::kStatMisses);
+            return std::nullopt;
+        }
+        root = snapshots_[version - first_version_];
+    }
+    const T* value = root.Get<T>(key);
+    if (!value) {
+        stats_.Add(detail::kStatMisses);
+        return std::nullopt;
+    }
+    stats_.Add(detail::kStatHits);
+    return ValueGuard<T>(std::move(root), *value);
+}
+
+// The new nodes of `after` hang off the nodes it does not share with
+// `before`, so only the written paths are walked.
+inline void TrieStore::CountNewNodes(const Trie& before, const Trie& after) {
+    uint64_t allocated = 0, cloned = 0;
+    std::vector<std::pair<const TrieNode*, const TrieNode*>> stack{
+        {TrieAccess::Root(before).get(), TrieAccess::Root(after).get()}};
+    while (!stack.empty()) {
+        auto [old_node, new_node] = stack.back();
+        stack.pop_back();
+        if (!new_node || new_node == old_node) continue;
+        ++allocated;
+        if (old_node) ++cloned;
+        for (const auto& [c, child] : new_node->children_) {
+            const TrieNode* old_child = nullptr;
+            if (old_node) {
+                auto it = old_node->children_.find(c);
+                if (it != old_node->children_.end()) old_child = it->second.get();
+            }
+            stack.emplace_back(old_child, child.get());
+        }
+    }
+    stats_.Add(detail::kStatNodesAllocated, allocated);
+    stats_.Add(detail::kStatNodesCloned, cloned);
+}
+
+// Only writers touch snapshots_ while holding write_lock_, so the newest
+// version can be read without snapshots_lock_ there. The lock is taken only
+// to publish, which keeps readers running while the value is being moved.
+template <class F>
+size_t TrieStore::Write(Commit::Op op, std::string_view key, std::string_view hi, F&& update) {
+    std::vector<std::shared_ptr<CommitListener>> listeners;
+    size_t version;
+    stats_.Add(op == Commit::Op::kPut ? detail::kStatPuts : detail::kStatRemoves);
+    Trie before, after;
+    {
+        auto guard = Acquire(std::unique_lock<std::mutex>(write_lock_, std::defer_lock), detail::kStatWriteLockWaitNs);
+        Trie trie = update(snapshots_.back());
+        if (op != Commit::Op::kPut && trie == snapshots_.back()) {
+            stats_.Add(detail::kStatNoopRemoves);
+            return first_version_ + snapshots_.size() - 1;
+        }
+        before = snapshots_.back();
+        after = trie;
+        version = Publish(std::move(trie), op, key, hi);
+        listeners = listeners_;
+    }
+    CountNewNodes(before, after);
+    std::exception_ptr error;
+    for (const auto& listener : listeners) {
+        try {
+            listener->AfterCommit(version);
+        } catch (...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (error) std::rethrow_exception(error);
+    return version;
+}
+
+template <class T>
+size_t TrieStore::Put(std::string_view key, T value) {
+    return Write(Commit::Op::kPut, key, {},
+                 [&](const Trie& trie) { return trie.Put<T>(key, std::move(value)); });
+}
+
+inline size_t TrieStore::Remove(std::string_view key) {
+    return Write(Commit::Op::kRemove, key, {},
+                 [&](const Trie& trie) { return trie.Remove(key); });
+}
+
+inline size_t TrieStore::RemovePrefix(std::string_view prefix) {
+    return Write(Commit::Op::kRemovePrefix, prefix, {},
+                 [&](const Trie& trie) { return trie.RemovePrefix(prefix); });
+}
+
+inline size_t TrieStore::RemoveRange(std::string_view lo, std::string_view hi) {
+    return Write(Commit::Op::kRemoveRange, lo, hi,
+                 [&](const Trie& trie) { return trie.RemoveRange(lo, hi); });
+}
+
+inline auto TrieStore::GetSnapshot(size_t version) -> std::optional<std::pair<size_t, Trie>> {
+    auto lock = Acquire(std::shared_lock<std::shared_mutex>(snapshots_lock_, std::defer_lock),
+                        detail::kStatSnapshotsLockWaitNs);
+    if (version == static_cast<size_t>(-1)) version = first_version_ + snapshots_.size() - 1;
+    if (version < first_version_ || version - first_version_ >= snapshots_.size()) return std::nullopt;
+    return std::make_pair(version, snapshots_[version - first_version_]);
+}
+
+inline size_t TrieStore::get_version() {
+    auto lock = Acquire(std::shared_lock<std::shared_mutex>(snapshots_lock_, std::defer_lock),
+                        detail::kStatSnapshotsLockWaitNs);
+    return first_version_ + snapshots_.size() - 1;
+}
+
+inline void TrieStore::Restore(Trie trie, size_t version) {
+    std::vector<Trie> snapshots{std::move(trie)};
+    {
+        auto guard = Acquire(std::unique_lock<std::mutex>(write_lock_, std::defer_lock), detail::kStatWriteLockWaitNs);
+        auto lock = Acquire(std::unique_lock<std::shared_mutex>(snapshots_lock_, std::defer_lock),
+                            detail::kStatSnapshotsLockWaitNs);
+        snapshots_.swap(snapshots);
+        first_version_ = version;
+    }
+    detail::Reclaimer::Instance().Retire(std::move(snapshots));
+}
+
+inline void TrieStore::AddListener(std::shared_ptr<CommitListener> listener) {
+    std::lock_guard<std::mutex> guard(write_lock_);
+    listeners_.push_back(std::move(listener));
+}
+
+inline void TrieStore::RemoveListener(const std::shared_ptr<CommitListener>& listener) {
+    std::lock_guard<std::mutex> guard(write_lock_);
+    listeners_.erase(std::remove(listeners_.begin(), listeners_.end(), listener), listeners_.end());
+}
+
+inline size_t TrieStore::Publish(Trie trie, Commit::Op op, std::string_view key, std::string_view hi) {
+    const size_t version = first_version_ + snapshots_.size();
+    size_t notified = 0;
+    try {
+        if (!listeners_.empty()) {
+            const TrieNode* value = op == Commit::Op::kPut ? TrieAccess::Find(trie, key) : nullptr;
+            const Commit commit{op, version, key, hi, value, trie};
+            for (; notified < listeners_.size(); ++notified) listeners_[notified]->OnCommit(commit);
+        }
+        auto lock = Acquire(std::unique_lock<std::shared_mutex>(snapshots_lock_, std::defer_lock),
+                            detail::kStatSnapshotsLockWaitNs);
+        snapshots_.push_back(std::move(trie));
+    } catch (...) {
+        for (size_t i = 0; i < notified; ++i) listeners_[i]->OnAbort(version);
+        throw;
+    }
+    stats_.Add(detail::kStatVersionsPublished);
+    return version;
+}
+
+inline auto TrieStore::Stats() -> TrieStoreStats {
+    TrieStoreStats stats;
+    stats.hits = stats_.Sum(detail::kStatHits);
+    stats.misses = stats_.Sum(detail::kStatMisses);
+    stats.gets = stats.hits + stats.misses;
+    stats.puts = stats_.Sum(detail::kStatPuts);
+    stats.removes = stats_.Sum(detail::kStatRemoves);
+    stats.noop_removes = stats_.Sum(detail::kStatNoopRemoves);
+    stats.versions_published = stats_.Sum(detail::kStatVersionsPublished);
+    stats.write_lock_wait = std::chrono::nanoseconds(stats_.Sum(detail::kStatWriteLockWaitNs));
+    stats.snapshots_lock_wait = std::chrono::nanoseconds(stats_.Sum(detail::kStatSnapshotsLockWaitNs));
+    {
+        std::shared_lock<std::shared_mutex> lock(snapshots_lock_);
+        stats.versions_retained = snapshots_.size();
+    }
+    stats.nodes_cloned = stats_.Sum(detail::kStatNodesCloned);
+    stats.nodes_allocated = stats_.Sum(detail::kStatNodesAllocated);
+    return stats;
+}
+
 }  // namespace sjtu
 
 #endif  // SJTU_TRIE_HPP
\ No newline at end of file
@@ -0,0 +1,236 @@
+#ifndef SJTU_THREAD_POOL_HPP
+#define SJTU_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sjtu {
+
+// A ThreadPool runs tasks on a fixed set of workers. Every worker has its own
+// deque: tasks submitted by a worker go to the back of its deque and are run
+// from the back (depth first), while idle workers steal from the front of the
+// other deques (breadth first). This suits recursive divide-and-conquer over
+// a trie, where a task spawns one subtask per large child.
+class ThreadPool {
+   public:
+    // Start `threads` workers, or one per hardware thread if `threads` is 0.
+    explicit ThreadPool(size_t threads = 0) {
+        if (threads == 0) threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < threads; ++i) workers_.emplace_back([this, i] { WorkerLoop(i); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    // Pending tasks are still run before the workers exit.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+
+    auto Size() const -> size_t { return workers_.size(); }
+
+    // Queue `task`. From a worker of this pool it goes to that worker's own
+    // deque, otherwise the deques are filled round-robin.
+    void Submit(std::function<void()> task) {
+        size_t index = current_pool_ == this ? current_index_ : next_++ % queues_.size();
+        // Count the task before it can be taken, so that Take never brings
+        // queued_ below zero.
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock_);
+            ++queued_;
+        }
+        try {
+            std::lock_guard<std::mutex> lock(queues_[index]->lock);
+            queues_[index]->tasks.push_back(std::move(task));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(sleep_lock_);
+            --queued_;
+            throw;
+        }
+        wake_.notify_one();
+    }
+
+    // Run one queued task on the calling thread. Returns false if there was
+    // none. Threads waiting for their subtasks call this to help out instead
+    // of blocking a worker.
+    auto RunPendingTask() -> bool {
+        std::function<void()> task;
+        size_t home = current_pool_ == this ? current_index_ : next_++ % queues_.size();
+        if (!Take(home, task)) return false;
+        task();
+        return true;
+    }
+
+   private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Pop from the back of our own deque, or steal from the front of another.
+    auto Take(size_t home, std::function<void()>& task) -> bool {
+        for (size_t i = 0; i < queues_.size(); ++i) {
+            Queue& queue = *queues_[(home + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.lock);
+            if (queue.tasks.empty()) continue;
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> sleep(sleep_lock_);
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t index) {
+        current_pool_ = this;
+        current_index_ = index;
+        std::function<void()> task;
+        while (true) {
+            if (Take(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_lock_);
+            wake_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+            if (queued_ == 0 && stopping_) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_{0};
+
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;
+    size_t queued_{0};
+    bool stopping_{false};
+
+    static inline thread_local ThreadPool* current_pool_{nullptr};
+    static inline thread_local size_t current_index_{0};
+};
+
+// A TaskGroup runs a set of tasks on a ThreadPool and waits for all of them.
+// Groups may be nested: a task can create its own group and wait on it.
+class TaskGroup {
+   public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    auto operator=(const TaskGroup&) -> TaskGroup& = delete;
+
+    ~TaskGroup() {
+        while (pending_.load() > 0)
+            if (!pool_.RunPendingTask()) std::this_thread::yield();
+    }
+
+    void Run(std::function<void()> task) {
+        pending_.fetch_add(1);
+        pool_.Submit([this, task = std::move(task)]() mutable {
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_lock_);
+                if (!error_) error_ = std::current_exception();
+            }
+            // The group may be gone once pending_ drops, so release the
+            // task's captures first.
+            task = nullptr;
+            pending_.fetch_sub(1);
+        });
+    }
+
+    // Wait for every task run so far, running queued tasks of the pool in the
+    // meantime. Rethrows the first exception thrown by a task.
+    void Wait() {
+        while (pending_.load() > 0)
+            if (!pool_.RunPendingTask()) std::this_thread::yield();
+        std::lock_guard<std::mutex> lock(error_lock_);
+        if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+   private:
+    ThreadPool& pool_;
+    std::atomic<size_t> pending_{0};
+    std::mutex error_lock_;
+    std::exception_ptr error_;
+};
+
+// A BoundedQueue hands items from producer threads to consumer threads. Push
+// blocks while the queue is full, which slows producers down to the pace of
+// the consumers (backpressure). After Close, Push drops its item and Pop
+// drains what is left, then returns false.
+template <class T>
+class BoundedQueue {
+   public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    auto operator=(const BoundedQueue&) -> BoundedQueue& = delete;
+
+    // Returns false if the queue was closed.
+    auto Push(T item) -> bool {
+        std::unique_lock<std::mutex> lock(lock_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty.
+    auto Pop(T& item) -> bool {
+        std::unique_lock<std::mutex> lock(lock_);
+        not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    const size_t capacity_;
+    std::mutex lock_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    bool closed_{false};
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_THREAD_POOL_HPP
@@ -0,0 +1,316 @@
+#ifndef SJTU_TSV_IMPORT_HPP
+#define SJTU_TSV_IMPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+#include "thread_pool.hpp"
+
+namespace sjtu {
+
+// A TsvValue<T> parses the value column of a row into a T. Specialize it for
+// your own value types:
+//
+//   template <>
+//   struct TsvValue<MyType> {
+//       static auto Parse(std::string_view text) -> MyType;  // throw if bad
+//   };
+template <class T, class Enable = void>
+struct TsvValue;
+
+template <>
+struct TsvValue<std::string> {
+    static auto Parse(std::string_view text) -> std::string { return std::string(text); }
+};
+
+template <class T>
+struct TsvValue<T, std::enable_if_t<std::is_integral_v<T>>> {
+    static auto Parse(std::string_view text) -> T {
+        T value{};
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end != text.data() + text.size())
+            throw std::invalid_argument("TsvValue: not an integer: " + std::string(text));
+        return value;
+    }
+};
+
+template <class T>
+struct TsvValue<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static auto Parse(std::string_view text) -> T {
+        const std::string copy(text);
+        char* end = nullptr;
+        const long double value = std::strtold(copy.c_str(), &end);
+        if (copy.empty() || end != copy.c_str() + copy.size())
+            throw std::invalid_argument("TsvValue: not a number: " + copy);
+        return static_cast<T>(value);
+    }
+};
+
+struct TsvImportOptions {
+    // The reader hands the parsers chunks of about this many bytes, cut at a
+    // line end.
+    size_t chunk_bytes{4 << 20};
+    // Parse workers; 0 means one per hardware thread.
+    size_t parse_threads{0};
+    // Chunks and parsed batches each queue holds. A full queue stalls the
+    // stage before it, and the reader stops once 2 * queue_capacity +
+    // parse_threads chunks are read but not yet inserted, so batches that
+    // wait behind a slow one cannot pile up either: memory stays
+    // proportional to chunk_bytes times the queue capacity and the number of
+    // parse workers.
+    size_t queue_capacity{4};
+    // Count and skip rows without a tab or with a bad value instead of
+    // failing.
+    bool skip_malformed{false};
+};
+
+struct TsvImportStats {
+    size_t rows{0};
+    size_t malformed{0};
+    size_t bytes{0};
+};
+
+namespace detail {
+
+// A counting semaphore that Close wakes up for good.
+class Tickets {
+   public:
+    explicit Tickets(size_t count) : count_(count) {}
+
+    // Returns false if closed.
+    auto Take() -> bool {
+        std::unique_lock<std::mutex> lock(lock_);
+        available_.wait(lock, [this] { return count_ > 0 || closed_; });
+        if (closed_) return false;
+        --count_;
+        return true;
+    }
+
+    void Give(size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            count_ += count;
+        }
+        available_.notify_all();
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closed_ = true;
+        }
+        available_.notify_all();
+    }
+
+   private:
+    std::mutex lock_;
+    std::condition_variable available_;
+    size_t count_;
+    bool closed_{false};
+};
+
+template <class T>
+class TsvImporter {
+   public:
+    explicit TsvImporter(TsvImportOptions options) : options_(Normalize(options)) {}
+
+    // The reader, the parse workers and the inserter (the calling thread)
+    // run concurrently, connected by bounded queues. Batches reach the
+    // inserter out of order and are applied in input order, so a key that
+    // appears twice ends up with its last value, as with one Put per row.
+    // The reader takes a ticket per chunk and the inserter gives it back
+    // once the chunk's batch is applied, which bounds the batches waiting
+    // for an earlier one.
+    template <class Source>
+    auto Run(Source& source, TsvImportStats* stats) -> Trie {
+        std::vector<std::thread> threads;
+        threads.emplace_back([this, &source] {
+            Guard([&] { ReadChunks(source); });
+            chunks_.Close();
+        });
+        for (size_t i = 0; i < options_.parse_threads; ++i) {
+            threads.emplace_back([this] {
+                Guard([&] { ParseChunks(); });
+                if (--parsers_running_ == 0) batches_.Close();
+            });
+        }
+
+        TrieBuilder builder;
+        std::map<size_t, Batch> pending;
+        size_t next = 0;
+        Batch batch;
+        try {
+            while (batches_.Pop(batch)) {
+                pending.emplace(batch.sequence, std::move(batch));
+                const size_t from = next;
+                for (auto it = pending.begin(); it != pending.end() && it->first == next;
+                     it = pending.erase(it), ++next) {
+                    for (auto& row : it->second.rows) builder.Put<T>(row.first, std::move(row.second));
+                    rows_ += it->second.rows.size();
+                }
+                if (next != from) tickets_.Give(next - from);
+            }
+        } catch (...) {
+            Fail(std::current_exception());
+        }
+        for (auto& thread : threads) thread.join();
+        if (error_) std::rethrow_exception(error_);
+        if (stats) *stats = TsvImportStats{rows_, malformed_.load(), bytes_};
+        return builder.Build();
+    }
+
+   private:
+    struct Chunk {
+        size_t sequence;
+        std::string text;
+    };
+
+    struct Batch {
+        size_t sequence{0};
+        std::vector<std::pair<std::string, T>> rows;
+    };
+
+    static auto Normalize(TsvImportOptions options) -> TsvImportOptions {
+        if (options.parse_threads == 0) options.parse_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        if (options.chunk_bytes == 0) throw std::invalid_argument("ImportTsv: zero chunk size");
+        return options;
+    }
+
+    // Run a stage, shutting the whole pipeline down if it fails.
+    template <class F>
+    void Guard(F&& stage) {
+        try {
+            stage();
+        } catch (...) {
+            Fail(std::current_exception());
+        }
+    }
+
+    void Fail(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(error_lock_);
+            if (!error_) error_ = error;
+        }
+        tickets_.Close();
+        chunks_.Close();
+        batches_.Close();
+    }
+
+    template <class Source>
+    void ReadChunks(Source& source) {
+        std::string carry;
+        size_t sequence = 0;
+        while (true) {
+            std::string text = std::move(carry);
+            const size_t old = text.size();
+            text.resize(old + options_.chunk_bytes);
+            const size_t got = source(text.data() + old, options_.chunk_bytes);
+            text.resize(old + got);
+            bytes_ += got;
+            if (got == 0) {
+                if (!text.empty() && tickets_.Take()) chunks_.Push(Chunk{sequence++, std::move(text)});
+                return;
+            }
+            // Hand over whole lines only.
+            const size_t end = text.rfind('\n');
+            if (end == std::string::npos) {
+                carry = std::move(text);
+                continue;
+            }
+            carry.assign(text, end + 1);
+            text.resize(end + 1);
+            if (!tickets_.Take() || !chunks_.Push(Chunk{sequence++, std::move(text)})) return;
+        }
+    }
+
+    void ParseChunks() {
+        Chunk chunk;
+        while (chunks_.Pop(chunk)) {
+            Batch batch;
+            batch.sequence = chunk.sequence;
+            std::string_view rest = chunk.text;
+            while (!rest.empty()) {
+                const size_t end = rest.find('\n');
+                std::string_view line = rest.substr(0, end);
+                rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if (line.empty()) continue;
+                ParseLine(line, batch);
+            }
+            // Stable, so that the later of two rows with the same key still
+            // wins.
+            std::stable_sort(batch.rows.begin(), batch.rows.end(),
+                             [](const auto& a, const auto& b) { return a.first < b.first; });
+            if (!batches_.Push(std::move(batch))) return;
+        }
+    }
+
+    void ParseLine(std::string_view line, Batch& batch) {
+        const size_t tab = line.find('\t');
+        try {
+            if (tab == std::string_view::npos)
+                throw std::invalid_argument("ImportTsv: row without a tab: " + std::string(line.substr(0, 64)));
+            batch.rows.emplace_back(std::string(line.substr(0, tab)), TsvValue<T>::Parse(line.substr(tab + 1)));
+        } catch (const std::invalid_argument&) {
+            if (!options_.skip_malformed) throw;
+            ++malformed_;
+        }
+    }
+
+    const TsvImportOptions options_;
+    BoundedQueue<Chunk> chunks_{options_.queue_capacity};
+    BoundedQueue<Batch> batches_{options_.queue_capacity};
+    Tickets tickets_{2 * std::max<size_t>(1, options_.queue_capacity) + options_.parse_threads};
+    std::atomic<size_t> parsers_running_{options_.parse_threads};
+    std::atomic<size_t> malformed_{0};
+    size_t rows_{0};
+    size_t bytes_{0};
+
+    std::mutex error_lock_;
+    std::exception_ptr error_;
+};
+
+}  // namespace detail
+
+// Build a trie from tab-separated rows "key<TAB>value" read from `source` (a
+// callable taking (char* data, size_t size) and returning the bytes read, 0
+// at end of input). The key is everything before the first tab; the value,
+// everything after it, is parsed with TsvValue<T>. Empty lines are skipped
+// and a trailing '\r' is dropped. If a key appears more than once, its last
+// row wins.
+//
+// Reading, parsing (on `parse_threads` workers, each batch sorted by key)
+// and insertion through a TrieBuilder overlap, so the import runs at the
+// speed of its slowest stage. Throws std::invalid_argument on a malformed
+// row unless `skip_malformed` is set.
+template <class T, class Source, class = std::enable_if_t<!std::is_base_of_v<std::ios_base, Source>>>
+auto ImportTsv(Source source, TsvImportOptions options = {}, TsvImportStats* stats = nullptr) -> Trie {
+    detail::TsvImporter<T> importer(options);
+    return importer.Run(source, stats);
+}
+
+template <class T>
+auto ImportTsv(std::istream& in, TsvImportOptions options = {}, TsvImportStats* stats = nullptr) -> Trie {
+    return ImportTsv<T>(IstreamSource(in), options, stats);
+}
+
+}  // namespace sjtu
+
+#endif  // SJTU_TSV_IMPORT_HPP
@@ -0,0 +1,474 @@
+#ifndef SJTU_WAL_HPP
+#define SJTU_WAL_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "serialize.hpp"
+#include "src.hpp"
+
+namespace sjtu {
+
+// How a WriteAheadLog makes commits durable.
+enum class WalSyncMode {
+    // Put/Remove return once their record is on disk. Writers waiting at the
+    // same time share one fdatasync (group commit).
+    kEveryCommit,
+    // Records are written and synced by a background thread every
+    // `sync_interval`; a crash loses at most that much.
+    kInterval,
+    // Records are written every `sync_interval` but never synced; they
+    // survive a process crash, not an OS crash.
+    kNone,
+};
+
+struct WalOptions {
+    WalSyncMode sync_mode{WalSyncMode::kEveryCommit};
+    std::chrono::milliseconds sync_interval{10};
+    // A new segment file is started once the current one reaches this size.
+    size_t segment_bytes{64 << 20};
+};
+
+// One logged commit.
+struct WalRecord {
+    Commit::Op op;
+    size_t version;
+    std::string key;
+    // The encoded value for kPut, `hi` for kRemoveRange.
+    std::string payload;
+};
+
+namespace detail {
+
+inline auto Crc32(std::string_view bytes) -> uint32_t {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xffffffffu;
+    for (char b : bytes) crc = table[(crc ^ static_cast<unsigned char>(b)) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+inline void AppendFixed32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline auto LoadFixed32(const char* at) -> uint32_t {
+    uint32_t value;
+    std::memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+// Segment files are named after the first version they hold, so sorting the
+// names sorts the log.
+inline auto SegmentName(size_t first_version) -> std::string {
+    char name[32];
+    std::snprintf(name, sizeof(name), "wal-%020zu.log", first_version);
+    return name;
+}
+
+// The first version held by the segment at `path`, from its name.
+inline auto SegmentFirstVersion(const std::string& path) -> size_t {
+    const std::string name = std::filesystem::path(path).filename().string();
+    return static_cast<size_t>(std::stoull(name.substr(4, 20)));
+}
+
+// The number of leading `segments` whose records are all at or below
+// `version`: a segment ends right before the next one starts, and the newest
+// one may still grow.
+inline auto CoveredSegments(const std::vector<std::string>& segments, size_t version) -> size_t {
+    size_t covered = 0;
+    while (covered + 1 < segments.size() && SegmentFirstVersion(segments[covered + 1]) <= version + 1) ++covered;
+    return covered;
+}
+
+}  // namespace detail
+
+// Record framing: u32 payload length, u32 CRC-32 of the payload, payload.
+// The payload is varint version, op byte, varint key length, key, and for
+// kPut and kRemoveRange a varint length followed by the value or `hi`.
+inline void EncodeWalRecord(const WalRecord& record, std::string& out) {
+    std::string payload;
+    PutVarint(payload, record.version);
+    payload.push_back(static_cast<char>(record.op));
+    PutVarint(payload, record.key.size());
+    payload += record.key;
+    if (record.op == Commit::Op::kPut || record.op == Commit::Op::kRemoveRange) {
+        PutVarint(payload, record.payload.size());
+        payload += record.payload;
+    }
+    detail::AppendFixed32(out, static_cast<uint32_t>(payload.size()));
+    detail::AppendFixed32(out, detail::Crc32(payload));
+    out += payload;
+}
+
+// Decode the record at the front of `in` and advance past it. Returns false
+// if `in` starts with a truncated or corrupt record (a torn write at the tail
+// of the log).
+inline auto DecodeWalRecord(std::string_view& in, WalRecord& record) -> bool {
+    if (in.size() < 8) return false;
+    const uint32_t size = detail::LoadFixed32(in.data());
+    if (in.size() - 8 < size) return false;
+    std::string_view payload = in.substr(8, size);
+    if (detail::Crc32(payload) != detail::LoadFixed32(in.data() + 4)) return false;
+    try {
+        record.version = GetVarint(payload);
+        if (payload.empty()) return false;
+        record.op = static_cast<Commit::Op>(payload.front());
+        payload.remove_prefix(1);
+        const uint64_t key_size = GetVarint(payload);
+        if (payload.size() < key_size) return false;
+        record.key.assign(payload.substr(0, key_size));
+        payload.remove_prefix(key_size);
+        record.payload.clear();
+        if (record.op == Commit::Op::kPut || record.op == Commit::Op::kRemoveRange) {
+            const uint64_t payload_size = GetVarint(payload);
+            if (payload.size() < payload_size) return false;
+            record.payload.assign(payload.substr(0, payload_size));
+        }
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    in.remove_prefix(8 + size);
+    return true;
+}
+
+// The segment files of the log in `dir`, oldest first.
+inline auto WalSegments(const std::string& dir) -> std::vector<std::string> {
+    std::vector<std::string> segments;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() == detail::SegmentName(0).size() && name.compare(0, 4, "wal-") == 0)
+            segments.push_back(entry.path().string());
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+// Call `fn(record)` for every intact record of the log in `dir`, in version
+// order. Reading stops at the first torn record. With `repair` set, the log
+// is then cut back to its last intact record, so that new segments appended
+// later are not hidden behind the torn one.
+template <class F>
+void ReadWal(const std::string& dir, F&& fn, bool repair = false) {
+    WalRecord record;
+    const auto segments = WalSegments(dir);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::ifstream in(segments[i], std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string_view rest = bytes;
+        while (DecodeWalRecord(rest, record)) fn(std::as_const(record));
+        if (rest.empty()) continue;
+        if (repair) {
+            std::filesystem::resize_file(segments[i], bytes.size() - rest.size());
+            for (size_t j = i + 1; j < segments.size(); ++j) std::filesystem::remove(segments[j]);
+        }
+        return;
+    }
+}
+
+// Delete the segments of the log in `dir` whose records are all at or below
+// `version`, once a checkpoint of `version` is durable. The newest segment is
+// always kept. Afterwards the log only replays on top of that checkpoint (or
+// a later one). Returns the number of segments deleted.
+inline auto TrimWal(const std::string& dir, size_t version) -> size_t {
+    const auto segments = WalSegments(dir);
+    const size_t covered = detail::CoveredSegments(segments, version);
+    for (size_t i = 0; i < covered; ++i) std::filesystem::remove(segments[i]);
+    return covered;
+}
+
+// Apply one logged commit to `store`, which must be at record.version - 1.
+template <class T>
+void ApplyWalRecord(TrieStore& store, const WalRecord& record) {
+    size_t version = 0;
+    switch (record.op) {
+        case Commit::Op::kPut:
+            version = store.Put<T>(record.key, ValueCodec<T>::Decode(record.payload));
+            break;
+        case Commit::Op::kRemove:
+            version = store.Remove(record.key);
+            break;
+        case Commit::Op::kRemovePrefix:
+            version = store.RemovePrefix(record.key);
+            break;
+        case Commit::Op::kRemoveRange:
+            version = store.RemoveRange(record.key, record.payload);
+            break;
+        default:
+            throw std::runtime_error("WAL: unknown operation");
+    }
+    if (version != record.version) throw std::runtime_error("WAL: replay diverged from the logged versions");
+}
+
+// A WriteAheadLog appends every commit of a TrieStore whose values are of
+// type T to segment files in a directory. Attach it with
+// TrieStore::AddListener after replaying the existing log:
+//
+//   sjtu::TrieStore store;
+//   sjtu::WriteAheadLog<std::string>::Replay(dir, store);
+//   store.AddListener(std::make_shared<sjtu::WriteAheadLog<std::string>>(dir));
+//
+// Records are appended to an in-memory buffer under the store's write lock.
+// A record is held back until its commit is known to be published (by its
+// AfterCommit or the next OnCommit), so an abandoned commit is never written.
+// In kEveryCommit mode each writer then waits, outside the write lock, until
+// its version is synced: the first waiter writes and fdatasyncs everything
+// buffered so far while later writers queue up behind it, so one sync covers
+// the whole group.
+//
+// If a write or sync fails, the log stops: part of the batch may be on disk
+// and what reached it is unknown, so the failing call and every later commit
+// throw instead of appending behind a possibly torn record.
+template <class T>
+class WriteAheadLog : public CommitListener {
+   public:
+    explicit WriteAheadLog(std::string dir, WalOptions options = {})
+        : dir_(std::move(dir)), options_(options) {
+        std::filesystem::create_directories(dir_);
+        if (options_.sync_mode != WalSyncMode::kEveryCommit) flusher_ = std::thread([this] { FlushLoop(); });
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    auto operator=(const WriteAheadLog&) -> WriteAheadLog& = delete;
+
+    // Everything buffered is written and synced, unless the log has failed.
+    ~WriteAheadLog() override {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+            // The store is gone, so a held-back commit was published.
+            Release();
+        }
+        cv_.notify_all();
+        if (flusher_.joinable()) flusher_.join();
+        try {
+            Sync();
+        } catch (const std::exception&) {
+            // SyncedVersion() tells what is on disk.
+        }
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    void OnCommit(const Commit& commit) override {
+        WalRecord record{commit.op, commit.version, std::string(commit.key), std::string()};
+        if (commit.op == Commit::Op::kPut) {
+            const T* value = TrieAccess::ValueOf<T>(commit.value);
+            if (!value) throw std::invalid_argument("WriteAheadLog: value of another type");
+            ValueCodec<T>::Encode(*value, record.payload);
+        } else if (commit.op == Commit::Op::kRemoveRange) {
+            record.payload.assign(commit.hi);
+        }
+        std::string encoded;
+        EncodeWalRecord(record, encoded);
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!error_.empty()) throw std::runtime_error(error_);
+        // Commits are published in order, so the previous one made it.
+        Release();
+        held_ = std::move(encoded);
+        held_version_ = commit.version;
+    }
+
+    void OnAbort(size_t version) override {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (held_version_ == version) held_.clear();
+    }
+
+    void AfterCommit(size_t version) override {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (held_version_ == version) Release();
+        }
+        if (options_.sync_mode == WalSyncMode::kEveryCommit) SyncTo(version, true);
+    }
+
+    // Write and sync everything appended so far.
+    void Sync() {
+        size_t target;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            target = appended_;
+        }
+        SyncTo(target, true);
+    }
+
+    // The newest version known to be on disk.
+    auto SyncedVersion() -> size_t {
+        std::lock_guard<std::mutex> lock(lock_);
+        return synced_;
+    }
+
+    // Delete the segments wholly at or below the checkpointed `version`, as
+    // TrimWal does. The segment being appended to is the newest and is kept.
+    auto Trim(size_t version) -> size_t { return TrimWal(dir_, version); }
+
+    // The number of fdatasync calls so far.
+    auto SyncCount() -> size_t {
+        std::lock_guard<std::mutex> lock(lock_);
+        return syncs_;
+    }
+
+    // Apply every record in `dir` newer than the store's version to `store`,
+    // reproducing the logged version numbers, and cut off a torn tail left by
+    // a crash. Returns the number of records applied.
+    static auto Replay(const std::string& dir, TrieStore& store) -> size_t {
+        size_t applied = 0;
+        const size_t base = store.get_version();
+        ReadWal(dir, [&](const WalRecord& record) {
+            if (record.version <= base) return;
+            ApplyWalRecord<T>(store, record);
+            ++applied;
+        }, true);
+        return applied;
+    }
+
+   private:
+    // Append the held-back record to the buffer. The caller must hold lock_.
+    void Release() {
+        if (held_.empty()) return;
+        if (buffer_.empty()) buffer_first_ = held_version_;
+        buffer_ += held_;
+        held_.clear();
+        appended_ = held_version_;
+    }
+
+    // Make every version up to `target` durable, either by leading a group
+    // write or by waiting for the current leader.
+    void SyncTo(size_t target, bool sync) {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (written_ < target || (sync && synced_ < target)) {
+            if (!error_.empty()) throw std::runtime_error(error_);
+            if (leading_) {
+                cv_.wait(lock);
+                continue;
+            }
+            leading_ = true;
+            std::string batch = std::exchange(buffer_, std::string());
+            const size_t first = buffer_first_;
+            const size_t last = appended_;
+            lock.unlock();
+            try {
+                WriteBatch(batch, first);
+                if (sync && fd_ >= 0 && ::fdatasync(fd_) != 0)
+                    throw std::runtime_error("WriteAheadLog: fdatasync failed");
+            } catch (const std::exception& e) {
+                lock.lock();
+                leading_ = false;
+                error_ = e.what();
+                cv_.notify_all();
+                throw;
+            }
+            lock.lock();
+            leading_ = false;
+            written_ = std::max(written_, last);
+            if (sync) {
+                synced_ = std::max(synced_, last);
+                ++syncs_;
+            }
+            cv_.notify_all();
+        }
+    }
+
+    // Called by the group leader only.
+    void WriteBatch(const std::string& batch, size_t first_version) {
+        if (batch.empty()) return;
+        if (fd_ < 0 || segment_size_ >= options_.segment_bytes) {
+            if (fd_ >= 0) {
+                const bool synced = ::fdatasync(fd_) == 0;
+                const bool closed = ::close(fd_) == 0;
+                fd_ = -1;
+                if (!synced || !closed) throw std::runtime_error("WriteAheadLog: cannot finish a segment");
+            }
+            const std::string path = dir_ + "/" + detail::SegmentName(first_version);
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd_ < 0) throw std::runtime_error("WriteAheadLog: cannot open " + path);
+            // A synced record is only durable once its segment's directory
+            // entry is.
+            if (!detail::SyncParentDir(path)) {
+                ::close(fd_);
+                fd_ = -1;
+                throw std::runtime_error("WriteAheadLog: cannot sync " + dir_);
+            }
+            segment_size_ = 0;
+        }
+        for (size_t done = 0; done < batch.size();) {
+            ssize_t n = ::write(fd_, batch.data() + done, batch.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::runtime_error("WriteAheadLog: write failed");
+            done += static_cast<size_t>(n);
+        }
+        segment_size_ += batch.size();
+    }
+
+    void FlushLoop() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!stopping_) {
+            cv_.wait_for(lock, options_.sync_interval, [this] { return stopping_; });
+            const size_t target = appended_;
+            lock.unlock();
+            try {
+                SyncTo(target, options_.sync_mode == WalSyncMode::kInterval);
+            } catch (const std::exception&) {
+                // The log has failed; commits throw from now on.
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    const std::string dir_;
+    const WalOptions options_;
+
+    // Owned by the group leader.
+    int fd_{-1};
+    size_t segment_size_{0};
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    // The record of the newest commit, until it is known to be published.
+    std::string held_;
+    size_t held_version_{0};
+    std::string buffer_;
+    size_t buffer_first_{0};
+    size_t appended_{0};
+    size_t written_{0};
+    size_t synced_{0};
+    size_t syncs_{0};
+    bool leading_{false};
+    bool stopping_{false};
+    // Set once a write or sync fails.
+    std::string error_;
+    std::thread flusher_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_WAL_HPP
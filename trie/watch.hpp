@@ -0,0 +1,314 @@
+#ifndef SJTU_WATCH_HPP
+#define SJTU_WATCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src.hpp"
+
+namespace sjtu {
+
+// One change seen by a Watcher.
+struct WatchEvent {
+    // The version that made the change.
+    size_t version{0};
+    Commit::Op op{Commit::Op::kPut};
+    // As in Commit: the key, the removed prefix or `lo` of a removed range.
+    std::string key;
+    // `hi` for kRemoveRange.
+    std::string hi;
+    // The trie of `version`, to read the new value without going back to the
+    // store.
+    Trie trie;
+    // Set when the watcher fell behind and events were dropped: anything
+    // under the watched prefix may have changed up to `version`. `key` is the
+    // prefix and `trie` is empty; read the store at `version` to resync.
+    bool coalesced{false};
+};
+
+// A Watcher receives the changes under one prefix of a TrieStore, see
+// ChangeFeed. The writer pushes events into a fixed-size single-producer,
+// single-consumer ring without taking a lock; once the ring is full, further
+// events collapse into one coalesced event until the consumer catches up.
+class Watcher {
+   public:
+    Watcher(std::string prefix, size_t capacity)
+        : prefix_(std::move(prefix)), slots_(std::max<size_t>(capacity, 1)) {}
+
+    Watcher(const Watcher&) = delete;
+    auto operator=(const Watcher&) -> Watcher& = delete;
+
+    auto Prefix() const -> const std::string& { return prefix_; }
+
+    // Take the next event, if any. Only one thread may consume.
+    auto TryNext(WatchEvent& event) -> bool {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head != tail_.load(std::memory_order_acquire)) {
+            event = std::move(slots_[head % slots_.size()]);
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        // The writer stops filling the ring while an overflow is pending, so
+        // the coalesced event is always newer than everything in the ring.
+        const size_t missed = overflow_.exchange(0, std::memory_order_acq_rel);
+        if (missed == 0) return false;
+        event = WatchEvent{missed, Commit::Op::kRemovePrefix, prefix_, std::string(), Trie(), true};
+        return true;
+    }
+
+    // Wait up to `timeout` for the next event.
+    template <class Rep, class Period>
+    auto Next(WatchEvent& event, std::chrono::duration<Rep, Period> timeout) -> bool {
+        if (TryNext(event)) return true;
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        wake_.wait_for(lock, timeout, [this] { return HasEvents() || cancelled_; });
+        lock.unlock();
+        return TryNext(event);
+    }
+
+    // Whether TryNext would return an event.
+    auto HasEvents() const -> bool {
+        return head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_acquire) ||
+               overflow_.load(std::memory_order_acquire) != 0;
+    }
+
+    // The number of events that were collapsed into coalesced events.
+    auto Dropped() const -> size_t { return dropped_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class ChangeFeed;
+
+    // Called by the feed only, with its watch lock held, which makes it the
+    // ring's single producer.
+    void Push(const WatchEvent& event) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (overflow_.load(std::memory_order_acquire) != 0 ||
+            tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+            overflow_.store(event.version, std::memory_order_release);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        slots_[tail % slots_.size()] = event;
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    void Wake() {
+        std::lock_guard<std::mutex> lock(sleep_lock_);
+        wake_.notify_all();
+    }
+
+    void Cancel() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock_);
+            cancelled_ = true;
+        }
+        wake_.notify_all();
+    }
+
+    const std::string prefix_;
+    std::vector<WatchEvent> slots_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<size_t> overflow_{0};
+    std::atomic<size_t> dropped_{0};
+    std::function<void(const WatchEvent&)> callback_;
+
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;
+    bool cancelled_{false};
+};
+
+// A ChangeFeed pushes the commits of a TrieStore to watchers of key prefixes,
+// replacing polling of get_version(). Attach it with TrieStore::AddListener:
+//
+//   auto feed = std::make_shared<sjtu::ChangeFeed>();
+//   store.AddListener(feed);
+//   auto watcher = feed->Watch("user/");
+//   sjtu::WatchEvent event;
+//   while (watcher->Next(event, std::chrono::seconds(1))) ...
+//
+// On each commit the writer looks up the watched prefixes that the commit's
+// key, prefix or range touches, which costs one map lookup per byte of the
+// key, and pushes an event to each once the commit is known to be published
+// (by its AfterCommit or the next OnCommit), so an abandoned commit is never
+// seen. A removed prefix or range is reported to every watcher whose prefix
+// overlaps it, even if none of its keys were removed. Only the watchers that
+// received an event are woken, after the write lock is released, so a commit
+// costs nothing for the watchers it does not touch.
+class ChangeFeed : public CommitListener {
+   public:
+    ChangeFeed() = default;
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    auto operator=(const ChangeFeed&) -> ChangeFeed& = delete;
+
+    ~ChangeFeed() override {
+        {
+            std::lock_guard<std::mutex> lock(dispatch_lock_);
+            stopping_ = true;
+        }
+        dispatch_wake_.notify_all();
+        if (dispatcher_.joinable()) dispatcher_.join();
+    }
+
+    // Watch every key starting with `prefix`. Up to `capacity` events are
+    // queued before they start being coalesced.
+    auto Watch(std::string prefix, size_t capacity = 1024) -> std::shared_ptr<Watcher> {
+        auto watcher = std::make_shared<Watcher>(std::move(prefix), capacity);
+        std::lock_guard<std::mutex> lock(watch_lock_);
+        watchers_[watcher->Prefix()].push_back(watcher);
+        return watcher;
+    }
+
+    // Watch `prefix` and call `callback` with each event on the feed's
+    // delivery thread. A slow callback makes its watcher coalesce events; it
+    // must not block on other watchers of this feed.
+    auto Watch(std::string prefix, std::function<void(const WatchEvent&)> callback, size_t capacity = 1024)
+        -> std::shared_ptr<Watcher> {
+        auto watcher = std::make_shared<Watcher>(std::move(prefix), capacity);
+        watcher->callback_ = std::move(callback);
+        {
+            std::lock_guard<std::mutex> lock(dispatch_lock_);
+            if (!dispatcher_.joinable()) dispatcher_ = std::thread([this] { DispatchLoop(); });
+        }
+        std::lock_guard<std::mutex> lock(watch_lock_);
+        watchers_[watcher->Prefix()].push_back(watcher);
+        return watcher;
+    }
+
+    // Stop delivering events to `watcher`. Events already queued can still be
+    // taken.
+    void Unwatch(const std::shared_ptr<Watcher>& watcher) {
+        {
+            std::lock_guard<std::mutex> lock(watch_lock_);
+            auto it = watchers_.find(watcher->Prefix());
+            if (it == watchers_.end()) return;
+            auto& list = it->second;
+            list.erase(std::remove(list.begin(), list.end(), watcher), list.end());
+            if (list.empty()) watchers_.erase(it);
+        }
+        watcher->Cancel();
+    }
+
+    void OnCommit(const Commit& commit) override {
+        std::lock_guard<std::mutex> lock(watch_lock_);
+        // Commits are published in order, so the previous one made it.
+        Release();
+        if (watchers_.empty()) return;
+        const std::string_view key = commit.key;
+        auto deliver = [&](const std::vector<std::shared_ptr<Watcher>>& list) {
+            held_targets_.insert(held_targets_.end(), list.begin(), list.end());
+        };
+        // Prefixes of the key always match. A Put or Remove touches nothing
+        // else; a removed prefix or range also touches watched prefixes that
+        // start inside it.
+        const size_t proper = commit.op == Commit::Op::kPut || commit.op == Commit::Op::kRemove
+                                  ? key.size() + 1
+                                  : key.size();
+        for (size_t i = 0; i < proper; ++i) {
+            auto it = watchers_.find(key.substr(0, i));
+            if (it != watchers_.end()) deliver(it->second);
+        }
+        if (commit.op == Commit::Op::kRemovePrefix) {
+            for (auto it = watchers_.lower_bound(key);
+                 it != watchers_.end() && std::string_view(it->first).substr(0, key.size()) == key; ++it)
+                deliver(it->second);
+        } else if (commit.op == Commit::Op::kRemoveRange) {
+            auto end = watchers_.lower_bound(commit.hi);
+            for (auto it = watchers_.lower_bound(key); it != end; ++it) deliver(it->second);
+        }
+        if (!held_targets_.empty())
+            held_ = WatchEvent{commit.version, commit.op, std::string(commit.key), std::string(commit.hi), commit.trie,
+                               false};
+    }
+
+    void OnAbort(size_t version) override {
+        std::lock_guard<std::mutex> lock(watch_lock_);
+        if (held_.version == version) held_targets_.clear();
+    }
+
+    void AfterCommit(size_t version) override {
+        std::vector<std::shared_ptr<Watcher>> released;
+        {
+            std::lock_guard<std::mutex> lock(watch_lock_);
+            if (held_.version == version) Release();
+            released.swap(released_);
+        }
+        // Several commits may have been released since the last wake-up.
+        std::sort(released.begin(), released.end());
+        released.erase(std::unique(released.begin(), released.end()), released.end());
+        // Callback watchers go to the delivery thread; the others are woken.
+        auto callbacks = std::partition(released.begin(), released.end(),
+                                        [](const auto& watcher) { return !watcher->callback_; });
+        for (auto it = released.begin(); it != callbacks; ++it) (*it)->Wake();
+        if (callbacks == released.end()) return;
+        {
+            std::lock_guard<std::mutex> lock(dispatch_lock_);
+            dispatch_targets_.insert(dispatch_targets_.end(), callbacks, released.end());
+        }
+        dispatch_wake_.notify_one();
+    }
+
+   private:
+    // Push the held-back event to its watchers. The caller must hold
+    // watch_lock_.
+    void Release() {
+        for (auto& watcher : held_targets_) {
+            watcher->Push(held_);
+            released_.push_back(std::move(watcher));
+        }
+        held_targets_.clear();
+        held_ = WatchEvent();
+    }
+
+    void DispatchLoop() {
+        std::vector<std::shared_ptr<Watcher>> targets;
+        WatchEvent event;
+        std::unique_lock<std::mutex> lock(dispatch_lock_);
+        while (true) {
+            dispatch_wake_.wait(lock, [this] { return !dispatch_targets_.empty() || stopping_; });
+            if (stopping_) return;
+            targets.swap(dispatch_targets_);
+            lock.unlock();
+            std::sort(targets.begin(), targets.end());
+            targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+            for (const auto& watcher : targets)
+                while (watcher->TryNext(event)) watcher->callback_(event);
+            targets.clear();
+            lock.lock();
+        }
+    }
+
+    std::mutex watch_lock_;
+    std::map<std::string, std::vector<std::shared_ptr<Watcher>>, std::less<>> watchers_;
+    // The event of the newest commit and the watchers it goes to, until the
+    // commit is known to be published.
+    WatchEvent held_;
+    std::vector<std::shared_ptr<Watcher>> held_targets_;
+    // Watchers pushed to since the last AfterCommit, to wake.
+    std::vector<std::shared_ptr<Watcher>> released_;
+
+    std::mutex dispatch_lock_;
+    std::condition_variable dispatch_wake_;
+    // Callback watchers with events for the delivery thread.
+    std::vector<std::shared_ptr<Watcher>> dispatch_targets_;
+    bool stopping_{false};
+    std::thread dispatcher_;
+};
+
+}  // namespace sjtu
+
+#endif  // SJTU_WATCH_HPP